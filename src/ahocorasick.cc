@@ -0,0 +1,107 @@
+#include "ahocorasick.h"
+
+namespace regen {
+
+std::size_t AhoCorasick::Add(const std::string &keyword)
+{
+  if (compiled_) exitmsg("can't add a keyword after compilation.\n");
+  if (keyword.empty()) exitmsg("empty keyword.\n");
+  std::map<std::string, std::size_t>::iterator iter = keyword_ids_.find(keyword);
+  if (iter != keyword_ids_.end()) return iter->second;
+  keyword_ids_[keyword] = keywords_.size();
+  keywords_.push_back(keyword);
+  return keywords_.size() - 1;
+}
+
+void AhoCorasick::Compile()
+{
+  if (compiled_) return;
+  compiled_ = true;
+
+  /* class 0 is for bytes which don't appear in keywords. */
+  std::fill(class_map_, class_map_ + 256, 0);
+  class_num_ = 1;
+  for (std::size_t i = 0; i < keywords_.size(); i++) {
+    for (std::size_t j = 0; j < keywords_[i].size(); j++) {
+      uint8_t c = keywords_[i][j];
+      if (class_map_[c] == 0) class_map_[c] = class_num_++;
+    }
+  }
+
+  // goto function (trie)
+  transition_.assign(class_num_, 0);
+  output_.assign(1, 0);
+  for (std::size_t i = 0; i < keywords_.size(); i++) {
+    state_t state = 0;
+    for (std::size_t j = 0; j < keywords_[i].size(); j++) {
+      state_t &next = transition_[state * class_num_ + class_map_[(uint8_t)keywords_[i][j]]];
+      if (next == 0) {
+        next = output_.size();
+        output_.push_back(0);
+        transition_.resize(transition_.size() + class_num_, 0);
+      }
+      state = transition_[state * class_num_ + class_map_[(uint8_t)keywords_[i][j]]];
+    }
+    output_[state] = i + 1;
+  }
+
+  // failure function, flattened into transition (breadth first order).
+  std::vector<state_t> failure(output_.size(), 0);
+  output_link_.assign(output_.size(), 0);
+  std::queue<state_t> queue;
+  for (std::size_t c = 0; c < class_num_; c++) {
+    if (transition_[c] != 0) queue.push(transition_[c]);
+  }
+  while (!queue.empty()) {
+    state_t state = queue.front();
+    queue.pop();
+    state_t *trans = &transition_[state * class_num_];
+    const state_t *fail_trans = &transition_[failure[state] * class_num_];
+    for (std::size_t c = 0; c < class_num_; c++) {
+      state_t next = trans[c];
+      if (next != 0) {
+        state_t fail = fail_trans[c];
+        failure[next] = fail;
+        output_link_[next] = output_[fail] != 0 ? fail : output_link_[fail];
+        queue.push(next);
+      } else {
+        trans[c] = fail_trans[c];
+      }
+    }
+  }
+}
+
+std::size_t AhoCorasick::Match(const Regen::StringPiece &string, std::vector<bool> *seen) const
+{
+  if (!compiled_) exitmsg("AhoCorasick must be compiled before matching.\n");
+  seen->assign(keywords_.size(), false);
+  std::size_t count = 0;
+  state_t state = 0;
+  const state_t *transition = &transition_[0];
+  for (const unsigned char *p = string.ubegin(); p < string.uend(); p++) {
+    state = transition[state * class_num_ + class_map_[*p]];
+    if ((output_[state] | output_link_[state]) == 0) continue;
+    for (state_t s = output_[state] != 0 ? state : output_link_[state]; s != 0; s = output_link_[s]) {
+      std::size_t id = output_[s] - 1;
+      if (!(*seen)[id]) {
+        (*seen)[id] = true;
+        if (++count == keywords_.size()) return count;
+      }
+    }
+  }
+  return count;
+}
+
+const char* AhoCorasick::FindEnd(const Regen::StringPiece &string) const
+{
+  if (!compiled_) exitmsg("AhoCorasick must be compiled before matching.\n");
+  state_t state = 0;
+  const state_t *transition = &transition_[0];
+  for (const unsigned char *p = string.ubegin(); p < string.uend(); p++) {
+    state = transition[state * class_num_ + class_map_[*p]];
+    if ((output_[state] | output_link_[state]) != 0) return (const char*)p + 1;
+  }
+  return NULL;
+}
+
+} // namespace regen
@@ -0,0 +1,37 @@
+#ifndef REGEN_AHOCORASICK_H_
+#define  REGEN_AHOCORASICK_H_
+#include "regen.h"
+#include "util.h"
+
+namespace regen {
+
+/* Aho-Corasick automaton for multiple keywords search.
+ * goto/failure functions are flattened into a DFA over the byte classes
+ * which appear in keywords, so that each byte costs one table lookup. */
+class AhoCorasick {
+public:
+  typedef uint32_t state_t;
+  AhoCorasick(): compiled_(false), class_num_(0) {}
+  /* returns id of the keyword (same keywords share the id). */
+  std::size_t Add(const std::string &keyword);
+  std::size_t size() const { return keywords_.size(); }
+  const std::string &keyword(std::size_t id) const { return keywords_[id]; }
+  void Compile();
+  /* (*seen)[id] is set for each keyword appeared in string,
+   * returns the number of distinct keywords appeared. */
+  std::size_t Match(const Regen::StringPiece& string, std::vector<bool> *seen) const;
+  /* returns the end of the earliest ending occurrence of keywords, or NULL. */
+  const char* FindEnd(const Regen::StringPiece& string) const;
+private:
+  std::vector<std::string> keywords_;
+  std::map<std::string, std::size_t> keyword_ids_;
+  bool compiled_;
+  std::size_t class_num_;
+  uint8_t class_map_[256];
+  std::vector<state_t> transition_;
+  std::vector<state_t> output_;      // keyword id + 1 (0: none)
+  std::vector<state_t> output_link_; // nearest state with output on failure chain (0: none)
+};
+
+} // namespace regen
+#endif // REGEN_AHOCORASICK_H_
@@ -1,5 +1,6 @@
 #include "../regex.h"
 #include "../sfa.h"
+#include "../simddfa.h"
 #include "../util.h"
 
 static inline uint64_t rdtsc()
@@ -19,9 +20,10 @@ int main(int argc, char *argv[]) {
   std::size_t thread_num = 1;
   std::size_t count = 1;
   bool print = false;
+  bool simd = false;
   Regen::Options::CompileFlag olevel = Regen::Options::Onone;
 
-  while ((opt = getopt(argc, argv, "pc:f:O:t:")) != -1) {
+  while ((opt = getopt(argc, argv, "pc:f:O:st:")) != -1) {
     switch(opt) {
       case 'c': {
         count = atoi(optarg);
@@ -44,6 +46,10 @@ int main(int argc, char *argv[]) {
         print = true;
         break;
       }
+      case 's': {
+        simd = true;
+        break;
+      }
     }
   }
   
@@ -65,7 +71,19 @@ int main(int argc, char *argv[]) {
     Regen::Options opt;
     opt.captured_match(print);
     opt.partial_match(print);    
-    if (thread_num <= 1) {
+    if (simd) {
+      compile_time -= rdtsc();
+      regen::Regex r(regex);
+      r.Compile(Regen::Options::O0);
+      r.MinimizeDFA();
+      regen::SIMDDFA sdfa(r.dfa(), thread_num);
+      compile_time += rdtsc();
+      if (!sdfa.Complete()) exitmsg("DFA has too many states for SIMD matching.\n");
+      Regen::StringPiece string(mm.ptr, mm.size);
+      matching_time -= rdtsc();
+      match = sdfa.Match(string);
+      matching_time += rdtsc();
+    } else if (thread_num <= 1) {
       compile_time -= rdtsc();
       Regen r(regex, opt);
       r.Compile(olevel);
@@ -78,7 +96,7 @@ int main(int argc, char *argv[]) {
     } else {
 #ifdef REGEN_ENABLE_PARALLEL
       compile_time -= rdtsc();
-      regen::Regex r = regen::Regex(regex);
+      regen::Regex r(regex);
       r.Compile(Regen::Options::O0);
       regen::SFA sfa(r.dfa(), thread_num);
       sfa.Compile(olevel);
@@ -92,8 +110,8 @@ int main(int argc, char *argv[]) {
 #endif
     }
 
-    printf("compile time = %, matching time = %, %s\n",
-           static_cast<size_t>(compile_time), static_cast<size_t>(matching_time), match ? "match" : "not match." );
+    printf("compile time = %llu, matching time = %llu, %s\n",
+           static_cast<unsigned long long>(compile_time), static_cast<unsigned long long>(matching_time), match ? "match" : "not match." );
   }
   
   return 0;
@@ -117,12 +117,16 @@ parse_transition:
     l.Consume();
   }
   ParseStates(l, dst);
+  if (!dst.empty()) GetState(nfa, *dst.rbegin());
 
-  for (std::size_t c = 0; c < 256; c++) {
-    for (std::set<regen::NFA::state_t>::iterator iter = src.begin(); iter != src.end(); ++iter) {
-      if (dot || cc.Match(c)) {
-        GetState(nfa, *iter).transition[c].insert(dst.begin(), dst.end());
-      }
+  for (std::set<regen::NFA::state_t>::iterator iter = src.begin(); iter != src.end(); ++iter) {
+    GetState(nfa, *iter);
+    for (std::size_t lo = 0; lo < 256; lo++) {
+      if (!(dot || cc.Match(lo))) continue;
+      std::size_t hi = lo;
+      while (hi < 255 && (dot || cc.Match(hi + 1))) hi++;
+      nfa.AddTransition(*iter, lo, hi, dst);
+      lo = hi;
     }
   }
   
@@ -241,7 +245,7 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
-  regen::Regex r = regen::Regex(regex, option);
+  regen::Regex r(regex, option);
 
   if (info) {
     printf("% chars involved. min length = %, max length = %\n", r.expr_info().involve.count(), r.min_length(), r.max_length());
@@ -1,18 +1,28 @@
 #include "../regen.h"
 #include "../util.h"
 #include <unistd.h>
+#include <algorithm>
+#ifdef REGEN_ENABLE_PARALLEL
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#endif
 
 struct Option {
-  Option(): count_line(false), only_matching(false), print_file(0), filename(NULL), pflag(Regen::Options::ShortestMatch | Regen::Options::PartialMatch), olevel(Regen::Options::O3) {}
+  Option(): count_line(false), only_matching(false), print_file(0), thread_num(1), filename(NULL), pflag(Regen::Options::ShortestMatch | Regen::Options::PartialMatch), olevel(Regen::Options::O3) {}
   bool count_line;
   bool only_matching;
   int print_file;
+  std::size_t thread_num;
   const char *filename;
   Regen::Options pflag;
   Regen::Options::CompileFlag olevel;
 };
 
+/* more threads than this only split the file into needlessly small chunks. */
+static const int MAX_THREAD_NUM = 64;
+
 void grep(const Regen &re, const regen::Util::mmap_t &buf, const Option &opt);
+int grep_chunk(const Regen &re, Regen::StringPiece string, const Option &opt, std::string *out);
 
 const char* get_line_beg(const char* buf, const char *beg)
 {
@@ -26,7 +36,7 @@ int main(int argc, char *argv[])
   Option opt;
   int opt_;
 
-  while ((opt_ = getopt(argc, argv, "cf:hHoiO:qU")) != -1) {
+  while ((opt_ = getopt(argc, argv, "cf:hHj:oiO:qU")) != -1) {
     switch(opt_) {
       case 'c':
         opt.count_line = true;
@@ -45,6 +55,12 @@ int main(int argc, char *argv[])
       case 'H':
         opt.print_file = 1;
         break;
+      case 'j': {
+        int thread_num = atoi(optarg);
+        if (thread_num < 1) exitmsg("USAGE: regen -j N (N >= 1)\n");
+        opt.thread_num = std::min(thread_num, MAX_THREAD_NUM);
+        break;
+      }
       case 'o':
         opt.only_matching = true;
         opt.pflag.longest_match(true);
@@ -78,7 +94,10 @@ int main(int argc, char *argv[])
   }
 
   Regen re(regex, opt.pflag);
-  re.Compile(opt.olevel);
+  if (!re.Compile(opt.olevel) || opt.olevel == Regen::Options::Onone) {
+    /* on-the-fly DFA is built while matching, so it can't be shared. */
+    opt.thread_num = 1;
+  }
 
   if (optind < argc+1 && opt.print_file != -1) opt.print_file = 1;
   
@@ -91,33 +110,99 @@ int main(int argc, char *argv[])
   return 0;
 }
 
-void grep(const Regen &re, const regen::Util::mmap_t &buf, const Option &opt)
+void output(std::string *out, const char *str, std::size_t len)
+{
+  if (out == NULL) {
+    write(1, str, len);
+  } else {
+    out->append(str, len);
+  }
+}
+
+/* every match is restarted at a line head, so [string.begin(), string.end())
+ * must be started at the head of line and ended at the end of line. */
+int grep_chunk(const Regen &re, Regen::StringPiece string, const Option &opt, std::string *out)
 {
-  Regen::StringPiece string(buf.ptr, buf.size), result;
+  Regen::StringPiece result;
   static const char newline[] = "\n";
   int count = 0;
-  while (re.Match(string, &result)) {
-    if (opt.only_matching) {
-      if (result.begin() == result.end()) {
-        string.set_begin(result.end() + 1);
-      } else {
-        write(1, result.begin(), result.size());
-        write(1, newline, 1);
-        string.set_begin(result.end());
-      }
+  if (opt.only_matching) {
+    std::vector<Regen::StringPiece> matches;
+    re.FindAll(string, &matches);
+    for (std::size_t i = 0; i < matches.size(); i++) {
+      if (matches[i].empty()) continue;
+      output(out, matches[i].begin(), matches[i].size());
+      output(out, newline, 1);
+    }
+    return count;
+  }
+  while (!string.empty() && re.Match(string, &result)) {
+    const char *end = (const char*)memchr(result.end(), '\n', string.end()-result.end());
+    if (opt.count_line) {
+      count++;
     } else {
-      const char *end = (const char*)memchr(result.end(), '\n', string.end()-result.end());
-      if (end == NULL) end = string.end();
-      if (opt.count_line) {
-        count++;
+      const char *beg = get_line_beg(result.end() > string.begin() ? result.end() - 1 : result.end(), string.begin());
+      if (*beg == '\n') beg++;
+      if (end == NULL) {
+        output(out, beg, string.end()-beg);
+        output(out, newline, 1);
       } else {
-        const char *beg = get_line_beg(result.end(), string.begin());
-        if (*beg == '\n') beg++;
-        write(1, beg, end-beg+1);
+        output(out, beg, end-beg+1);
       }
-      string.set_begin(end+1);
     }
-    if (string.empty()) break;
+    if (end == NULL) break;
+    string.set_begin(end+1);
+  }
+  return count;
+}
+
+#ifdef REGEN_ENABLE_PARALLEL
+struct GrepTask {
+  Regen::StringPiece string;
+  std::string out;
+  int count;
+};
+
+void grep_task(const Regen *re, const Option *opt, GrepTask *task)
+{
+  task->count = grep_chunk(*re, task->string, *opt, &task->out);
+}
+#endif
+
+void grep(const Regen &re, const regen::Util::mmap_t &buf, const Option &opt)
+{
+  Regen::StringPiece string(buf.ptr, buf.size);
+  int count = 0;
+#ifdef REGEN_ENABLE_PARALLEL
+  std::size_t thread_num = opt.thread_num;
+  if (string.size() < thread_num * 4096) thread_num = string.size() / 4096 + 1;
+  if (thread_num > 1) {
+    /* split the file into line-aligned chunks, and scan them in parallel.
+     * results are buffered per chunk and printed in file order. */
+    std::vector<GrepTask> tasks(thread_num);
+    std::vector<boost::thread*> threads;
+    const char *beg = string.begin();
+    for (std::size_t i = 0; i < thread_num && beg < string.end(); i++) {
+      const char *end = string.end();
+      if (i < thread_num - 1 && beg + string.size() / thread_num < string.end()) {
+        end = (const char*)memchr(beg + string.size() / thread_num, '\n', string.end() - (beg + string.size() / thread_num));
+        end = end == NULL ? string.end() : end + 1;
+      }
+      tasks[i].string.set(beg, end);
+      tasks[i].count = 0;
+      threads.push_back(new boost::thread(boost::bind(&grep_task, &re, &opt, &tasks[i])));
+      beg = end;
+    }
+    for (std::size_t i = 0; i < threads.size(); i++) {
+      threads[i]->join();
+      delete threads[i];
+      if (!tasks[i].out.empty()) write(1, tasks[i].out.data(), tasks[i].out.size());
+      count += tasks[i].count;
+    }
+    if (opt.count_line) printf("%d\n", count);
+    return;
   }
+#endif
+  count = grep_chunk(re, string, opt, NULL);
   if (opt.count_line) printf("%d\n", count);
 }
@@ -45,22 +45,30 @@ int main(int argc, char *argv[]) {
 
   Regen::Options option;
   option.extended(E);
-  regen::Regex r = regen::Regex(regex, option);
+  /* before and after the simplification of the parse tree (see simplify.h). */
+  option.simplify(false);
+  regen::Regex o(regex, option);
+  option.simplify(true);
+  regen::Regex r(regex, option);
 
   if (n) {
-    printf("NFA state num:  %\n", r.state_exprs().size());
+    printf("NFA state num:  %" PRIuS " (%" PRIuS " unsimplified)\n", r.state_exprs().size(), o.state_exprs().size());
   }
   if (d) {
+    o.Compile(Regen::Options::O0);
     r.Compile(Regen::Options::O0);
-    if (m) r.MinimizeDFA();
-    printf("DFA state num: %\n", r.dfa().size());
+    if (m) {
+      o.MinimizeDFA();
+      r.MinimizeDFA();
+    }
+    printf("DFA state num: %" PRIuS " (%" PRIuS " unsimplified)\n", r.dfa().size(), o.dfa().size());
   }
   if (s) {
 #ifdef REGEN_ENABLE_PARALLEL
     r.Compile(Regen::Options::O0);
     if (m) r.MinimizeDFA();
     regen::SFA sfa(r.dfa());
-    printf("SFA(from DFA) state num: %"PRIuS"\n", sfa.size());
+    printf("SFA(from DFA) state num: %" PRIuS "\n", sfa.size());
 #else
     exitmsg("SFA is not supported.\n");
 #endif
@@ -0,0 +1,296 @@
+#include "bitparallel.h"
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace regen {
+
+static const std::size_t MAX_POSITIONS = 256;
+
+/* N words of positions, position i is bit i % 64 of word i / 64. */
+template<std::size_t N>
+struct Bits {
+  uint64_t w[N];
+  void clear() { for (std::size_t i = 0; i < N; i++) w[i] = 0; }
+  void set(std::size_t i) { w[i / 64] |= (uint64_t)1 << (i % 64); }
+  bool test(std::size_t i) const { return (w[i / 64] >> (i % 64) & 1) != 0; }
+  /* positions 8k .. 8k+7. */
+  unsigned char byte(std::size_t k) const { return (unsigned char)(w[k / 8] >> (k % 8 * 8)); }
+};
+
+template<std::size_t N>
+inline void Or(Bits<N> *dst, const Bits<N> &src)
+{
+  for (std::size_t i = 0; i < N; i++) dst->w[i] |= src.w[i];
+}
+
+template<std::size_t N>
+inline void And(Bits<N> *dst, const Bits<N> &lhs, const Bits<N> &rhs)
+{
+  for (std::size_t i = 0; i < N; i++) dst->w[i] = lhs.w[i] & rhs.w[i];
+}
+
+template<std::size_t N>
+inline void AndNot(Bits<N> *dst, const Bits<N> &src)
+{
+  for (std::size_t i = 0; i < N; i++) dst->w[i] &= ~src.w[i];
+}
+
+template<std::size_t N>
+inline bool Any(const Bits<N> &bits)
+{
+  uint64_t any = 0;
+  for (std::size_t i = 0; i < N; i++) any |= bits.w[i];
+  return any != 0;
+}
+
+/* 128 and 256 positions in one register, if the compiler targets SSE2 or AVX2.
+ * (the words are loaded unaligned, vectors of Bits are not aligned to the registers.) */
+#ifdef __SSE2__
+template<>
+inline void Or(Bits<2> *dst, const Bits<2> &src)
+{
+  __m128i *d = reinterpret_cast<__m128i*>(dst->w);
+  _mm_storeu_si128(d, _mm_or_si128(_mm_loadu_si128(d), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src.w))));
+}
+
+template<>
+inline void And(Bits<2> *dst, const Bits<2> &lhs, const Bits<2> &rhs)
+{
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst->w),
+                   _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs.w)),
+                                 _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs.w))));
+}
+#endif
+
+#ifdef __AVX2__
+template<>
+inline void Or(Bits<4> *dst, const Bits<4> &src)
+{
+  __m256i *d = reinterpret_cast<__m256i*>(dst->w);
+  _mm256_storeu_si256(d, _mm256_or_si256(_mm256_loadu_si256(d), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src.w))));
+}
+
+template<>
+inline void And(Bits<4> *dst, const Bits<4> &lhs, const Bits<4> &rhs)
+{
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst->w),
+                      _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(lhs.w)),
+                                       _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs.w))));
+}
+
+template<>
+inline bool Any(const Bits<4> &bits)
+{
+  const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bits.w));
+  return !_mm256_testz_si256(v, v);
+}
+#endif
+
+template<std::size_t N>
+class BitParallel: public BitParallelMatcher {
+public:
+  BitParallel(const Regen::Options &flag, const Graph &graph);
+  bool Match(const Regen::StringPiece& string, Regen::StringPiece* result = NULL) const;
+  std::size_t width() const { return N * 64; }
+private:
+  void Step(const Bits<N> &current, unsigned char c, Bits<N> *next) const;
+  /* an accepting set drops the .*? and what it has just entered (no match begins after it). */
+  bool Accept(Bits<N> *states) const;
+  std::vector<Bits<N> > reach_;
+  /* follow_[256k + v]: union of the follows of the positions 8k+j for the bits j of v. */
+  std::vector<Bits<N> > follow_;
+  std::size_t chunk_num_;
+  Bits<N> first_;
+  Bits<N> non_greedy_;
+  std::size_t eop_;
+};
+
+template<std::size_t N>
+BitParallel<N>::BitParallel(const Regen::Options &flag, const Graph &graph):
+    BitParallelMatcher(flag, graph.follow.size()), chunk_num_((graph.follow.size() + 7) / 8), eop_(graph.eop)
+{
+  const std::size_t n = position_num_;
+  Bits<N> zero;
+  zero.clear();
+  reach_.assign(256, zero);
+  for (std::size_t i = 0; i < n; i++) {
+    for (std::size_t c = 0; c < 256; c++) {
+      if (graph.reach[i][c]) reach_[c].set(i);
+    }
+  }
+  std::vector<Bits<N> > follow(n, zero);
+  for (std::size_t i = 0; i < n; i++) {
+    for (std::size_t j = 0; j < graph.follow[i].size(); j++) follow[i].set(graph.follow[i][j]);
+  }
+  follow_.assign(chunk_num_ * 256, zero);
+  for (std::size_t k = 0; k < chunk_num_; k++) {
+    Bits<N> *table = &follow_[k * 256];
+    for (std::size_t v = 1; v < 256; v++) {
+      /* v is v without its lowest bit, and the lowest bit. */
+      std::size_t j = 0;
+      while (!(v >> j & 1)) j++;
+      table[v] = table[v & (v - 1)];
+      if (8 * k + j < n) Or(&table[v], follow[8 * k + j]);
+    }
+  }
+  first_.clear();
+  for (std::size_t i = 0; i < graph.first.size(); i++) first_.set(graph.first[i]);
+  non_greedy_.clear();
+  for (std::size_t i = 0; i < graph.non_greedy.size(); i++) non_greedy_.set(graph.non_greedy[i]);
+}
+
+template<std::size_t N>
+void BitParallel<N>::Step(const Bits<N> &current, unsigned char c, Bits<N> *next) const
+{
+  Bits<N> read;
+  And(&read, current, reach_[c]);
+  next->clear();
+  for (std::size_t i = 0; i < N; i++) {
+    if (read.w[i] == 0) continue;
+    for (std::size_t k = 8 * i; k < 8 * i + 8 && k < chunk_num_; k++) {
+      const unsigned char v = read.byte(k);
+      if (v != 0) Or(next, follow_[k * 256 + v]);
+    }
+  }
+}
+
+template<std::size_t N>
+bool BitParallel<N>::Accept(Bits<N> *states) const
+{
+  if (!states->test(eop_)) return false;
+  if (!flag_.suffix_match()) AndNot(states, non_greedy_);
+  return true;
+}
+
+/* walks as the DFA does: the set of positions stands for its state, and
+ * the empty set for REJECT. */
+template<std::size_t N>
+bool BitParallel<N>::Match(const Regen::StringPiece &string, Regen::StringPiece *result) const
+{
+  const unsigned char *p = string.ubegin(), *end = string.uend(), *matchptr = NULL;
+  const bool early = result == NULL && !flag_.suffix_match();
+  const bool shortest = !flag_.suffix_match() && flag_.shortest_match();
+  Bits<N> states = first_, next;
+  bool accept = Accept(&states);
+  if (accept) {
+    if (early) return true;
+    matchptr = p;
+  }
+  while (p != end) {
+    /* the DFA of shortest matching rejects after an acceptance. */
+    if (shortest && accept) {
+      states.clear();
+      break;
+    }
+    Step(states, *p, &next);
+    if (!Any(next)) {
+      states.clear();
+      break;
+    }
+    states = next;
+    p++;
+    if ((accept = Accept(&states))) {
+      if (early) return true;
+      matchptr = p;
+    }
+  }
+
+  accept = p == end && states.test(eop_);
+  if (flag_.suffix_match()) {
+    if (accept && result != NULL) result->set_end(string.end());
+    return accept;
+  }
+  if (matchptr == NULL) return false;
+  if (result != NULL) result->set_uend(matchptr);
+  return true;
+}
+
+/* index of f in states, through the non-greedy copy the DFA may have put in its place. */
+static bool PositionIndex(const std::vector<StateExpr*> &states, StateExpr *f, std::size_t *index)
+{
+  if (f->non_greedy() && !f->root_non_greedy() && f->near_root_non_greedy_pair() != NULL) {
+    f = f->near_root_non_greedy_pair();
+  }
+  *index = f->state_id();
+  return *index < states.size() && states[*index] == f;
+}
+
+BitParallelMatcher* BitParallelMatcher::Plan(const Regex &regex, const Regen::Options &flag)
+{
+  const std::vector<StateExpr*> &states = regex.state_exprs();
+  const std::size_t n = states.size();
+  if (regex.expr_root() == NULL || n == 0 || n > MAX_POSITIONS || flag.reverse_match()) return NULL;
+  const unsigned char delimiter = flag.delimiter();
+  Graph graph;
+  graph.reach.resize(n);
+  graph.follow.resize(n);
+  graph.eop = n;
+  for (std::size_t i = 0; i < n; i++) {
+    StateExpr *s = states[i];
+    /* bytes are read as DFA::FillTransition does. */
+    std::bitset<256> &reach = graph.reach[i];
+    switch (s->type()) {
+      case Expr::kLiteral:
+        reach.set(static_cast<Literal*>(s)->literal());
+        if (!flag.one_line()) reach.reset(delimiter);
+        break;
+      case Expr::kCharClass:
+        for (std::size_t c = 0; c < 256; c++) reach[c] = static_cast<CharClass*>(s)->Match(c);
+        if (!flag.one_line()) reach.reset(delimiter);
+        break;
+      case Expr::kDot:
+        reach.set();
+        if (!flag.one_line() && !static_cast<Dot*>(s)->match_delimiter()) reach.reset(delimiter);
+        break;
+      case Expr::kEOP:
+        if (graph.eop != n) return NULL;
+        graph.eop = i;
+        break;
+      default:
+        return NULL;
+    }
+    if (s->non_greedy()) {
+      if (!s->root_non_greedy()) return NULL;
+      graph.non_greedy.push_back(i);
+    }
+    PositionSet &follow = s->transition().follow;
+    for (PositionSet::iterator iter = follow.begin(); iter != follow.end(); ++iter) {
+      std::size_t index;
+      if (!PositionIndex(states, *iter, &index)) return NULL;
+      graph.follow[i].push_back(index);
+    }
+  }
+  if (graph.eop == n) return NULL;
+  /* the .*? enters the pattern through non-greedy copies of its first
+   * positions, which the DFA drops with the .*? on acceptance (threads
+   * begun before are kept). the copies are positions of their own here. */
+  std::map<std::size_t, std::size_t> copies;
+  for (std::size_t i = 0, size = graph.non_greedy.size(); i < size; i++) {
+    const std::size_t s = graph.non_greedy[i];
+    for (std::size_t j = 0; j < graph.follow[s].size(); j++) {
+      const std::size_t f = graph.follow[s][j];
+      if (states[f]->non_greedy() || f == graph.eop) continue;
+      if (copies.find(f) == copies.end()) {
+        copies[f] = graph.follow.size();
+        graph.non_greedy.push_back(graph.follow.size());
+        graph.reach.push_back(graph.reach[f]);
+        graph.follow.push_back(graph.follow[f]);
+      }
+      graph.follow[s][j] = copies[f];
+    }
+  }
+  if (graph.follow.size() > MAX_POSITIONS) return NULL;
+  PositionSet &first = regex.expr_root()->transition().first;
+  for (PositionSet::iterator iter = first.begin(); iter != first.end(); ++iter) {
+    std::size_t index;
+    if (!PositionIndex(states, *iter, &index)) return NULL;
+    graph.first.push_back(index);
+  }
+
+  if (graph.follow.size() <= 64) return new BitParallel<1>(flag, graph);
+  if (graph.follow.size() <= 128) return new BitParallel<2>(flag, graph);
+  return new BitParallel<4>(flag, graph);
+}
+
+} // namespace regen
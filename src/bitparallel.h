@@ -0,0 +1,42 @@
+#ifndef REGEN_BITPARALLEL_H_
+#define  REGEN_BITPARALLEL_H_
+#include "regen.h"
+#include "util.h"
+#include "regex.h"
+
+namespace regen {
+
+/* Bit-parallel simulation of the Glushkov automaton of a Regex.
+ * the set of positions to be read next is a bit vector of 64, 128 or 256
+ * bits (one uint64_t, or SSE2/AVX2 registers where the compiler targets
+ * them), and a byte c moves it to follow(S & reach[c]), where follow of a
+ * set is the union of per-byte tables of the follow masks. no state is
+ * built ahead, so it stands in for the DFA when the DFA exceeds its limit. */
+class BitParallelMatcher {
+public:
+  /* returns NULL if regex has more positions than 256, or positions which
+   * bits can't follow (anchors, operators, non-greedy loops). */
+  static BitParallelMatcher* Plan(const Regex &regex, const Regen::Options &flag);
+  virtual ~BitParallelMatcher() {}
+  /* same match/result semantics as the DFA. */
+  virtual bool Match(const Regen::StringPiece& string, Regen::StringPiece* result = NULL) const = 0;
+  /* bits of a set of positions. */
+  virtual std::size_t width() const = 0;
+  std::size_t position_num() const { return position_num_; }
+protected:
+  struct Graph {
+    std::vector<std::bitset<256> > reach; // positions which read each byte
+    std::vector<std::vector<std::size_t> > follow;
+    std::vector<std::size_t> first;
+    std::size_t eop;
+    std::vector<std::size_t> non_greedy; // the .*? of partial matching (and what it enters), dropped on acceptance
+  };
+  BitParallelMatcher(const Regen::Options &flag, std::size_t position_num): flag_(flag), position_num_(position_num) {}
+  Regen::Options flag_;
+  std::size_t position_num_;
+private:
+  DISALLOW_COPY_AND_ASSIGN(BitParallelMatcher);
+};
+
+} // namespace regen
+#endif // REGEN_BITPARALLEL_H_
@@ -0,0 +1,108 @@
+#include "cache.h"
+
+namespace regen {
+
+#ifdef REGEN_ENABLE_PARALLEL
+#define REGEN_CACHE_LOCK boost::mutex::scoped_lock lock(mutex_)
+#else
+#define REGEN_CACHE_LOCK
+#endif
+
+static RegenCache shared_cache;
+
+RegenCache& RegenCache::Shared()
+{
+  return shared_cache;
+}
+
+/* every field of Options is a part of the key, as any of them may change
+ * the compiled pattern (simplify and product_dfa change the automaton). */
+std::string RegenCache::Key(const Regen::StringPiece &pattern, const Regen::Options &opt, Regen::Options::CompileFlag olevel)
+{
+  const bool flags[] = {
+    opt.shortest_match(), opt.ignore_case(), opt.one_line(), opt.reverse_regex(), opt.reverse_match(),
+    opt.prefix_match(), opt.suffix_match(), opt.parallel_match(), opt.captured_match(), opt.filtered_match(),
+    opt.complement_ext(), opt.intersection_ext(), opt.recursion_ext(), opt.xor_ext(), opt.shuffle_ext(),
+    opt.permutation_ext(), opt.reverse_ext(), opt.weakbackref_ext(), opt.encoding_utf8(), opt.non_nullable(),
+    opt.simplify(), opt.product_dfa()
+  };
+  std::string key;
+  for (std::size_t i = 0; i < sizeof(flags) / sizeof(bool); i++) {
+    key += flags[i] ? '1' : '0';
+  }
+  key += (char)opt.delimiter();
+  key += (char)('0' + olevel + 1);
+  key.append(pattern.begin(), pattern.size());
+  return key;
+}
+
+RegenCache::Entry* RegenCache::Acquire(const Regen::StringPiece &pattern, const Regen::Options &opt, Regen::Options::CompileFlag olevel)
+{
+  std::string key = Key(pattern, opt, olevel);
+  {
+    REGEN_CACHE_LOCK;
+    std::map<std::string, List::iterator>::iterator iter = index_.find(key);
+    if (iter != index_.end()) {
+      hits_++;
+      lru_.splice(lru_.begin(), lru_, iter->second);
+      lru_.front()->refs++;
+      return lru_.front();
+    }
+    misses_++;
+  }
+
+  /* parsing and compilation are done without the lock. */
+  Entry *entry = new Entry(key, new Regen(pattern.as_string(), opt));
+  entry->regen->Compile(olevel);
+  /* On-The-Fly DFA grows while matching, so it can't be shared. */
+  if (!entry->regen->Complete()) return entry;
+
+  REGEN_CACHE_LOCK;
+  if (capacity_ == 0) return entry;
+  std::map<std::string, List::iterator>::iterator iter = index_.find(key);
+  if (iter != index_.end()) {
+    /* compiled by another thread meanwhile. */
+    delete entry;
+    lru_.splice(lru_.begin(), lru_, iter->second);
+    lru_.front()->refs++;
+    return lru_.front();
+  }
+  entry->cached = true;
+  lru_.push_front(entry);
+  index_[key] = lru_.begin();
+  Evict(capacity_);
+  return entry;
+}
+
+void RegenCache::Release(Entry *entry)
+{
+  REGEN_CACHE_LOCK;
+  if (--entry->refs == 0 && !entry->cached) delete entry;
+}
+
+/* must be called with the lock. */
+void RegenCache::Evict(std::size_t capacity)
+{
+  while (lru_.size() > capacity) {
+    Entry *entry = lru_.back();
+    lru_.pop_back();
+    index_.erase(entry->key);
+    entry->cached = false;
+    if (entry->refs == 0) delete entry;
+  }
+}
+
+void RegenCache::Clear()
+{
+  REGEN_CACHE_LOCK;
+  Evict(0);
+}
+
+void RegenCache::set_capacity(std::size_t capacity)
+{
+  REGEN_CACHE_LOCK;
+  capacity_ = capacity;
+  Evict(capacity_);
+}
+
+} // namespace regen
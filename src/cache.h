@@ -0,0 +1,53 @@
+#ifndef REGEN_CACHE_H_
+#define  REGEN_CACHE_H_
+#include "regen.h"
+#include "util.h"
+#include <list>
+#ifdef REGEN_ENABLE_PARALLEL
+#include <boost/thread/mutex.hpp>
+#endif
+
+namespace regen {
+
+/* LRU cache of compiled patterns, keyed by pattern, options and olevel.
+ * entries are reference counted, so an entry evicted while another thread
+ * is matching with it is deleted on its last Release. */
+class RegenCache {
+public:
+  struct Entry {
+    Entry(const std::string &key_, Regen *regen_): key(key_), regen(regen_), refs(1), cached(false) {}
+    ~Entry() { delete regen; }
+    std::string key;
+    Regen *regen;
+    std::size_t refs;
+    bool cached;
+  };
+  RegenCache(std::size_t capacity = 64): capacity_(capacity), hits_(0), misses_(0) {}
+  ~RegenCache() { Clear(); }
+  /* the cache behind the static matchers and Matcher. */
+  static RegenCache& Shared();
+  /* returns the compiled pattern, which must be passed to Release after matching. */
+  Entry* Acquire(const Regen::StringPiece& pattern, const Regen::Options& opt, Regen::Options::CompileFlag olevel);
+  void Release(Entry *entry);
+  void Clear();
+  void set_capacity(std::size_t capacity);
+  std::size_t capacity() const { return capacity_; }
+  std::size_t hits() const { return hits_; }
+  std::size_t misses() const { return misses_; }
+private:
+  static std::string Key(const Regen::StringPiece& pattern, const Regen::Options& opt, Regen::Options::CompileFlag olevel);
+  void Evict(std::size_t capacity);
+  typedef std::list<Entry*> List;
+  List lru_; // most recently used first
+  std::map<std::string, List::iterator> index_;
+  std::size_t capacity_;
+  std::size_t hits_;
+  std::size_t misses_;
+#ifdef REGEN_ENABLE_PARALLEL
+  boost::mutex mutex_;
+#endif
+  DISALLOW_COPY_AND_ASSIGN(RegenCache);
+};
+
+} // namespace regen
+#endif // REGEN_CACHE_H_
@@ -0,0 +1,286 @@
+#include "capture.h"
+#include <algorithm>
+
+namespace regen {
+
+static void Append(std::vector<std::size_t> *dst, const std::vector<std::size_t> &src)
+{
+  dst->insert(dst->end(), src.begin(), src.end());
+}
+
+void Capture::Defer(Ends *ends)
+{
+  for (std::size_t i = 0; i < ends->size(); i++) {
+    (*ends)[i].deferred = true;
+  }
+}
+
+Capture* Capture::Plan(Expr *root, const std::vector<Expr*> &groups, const Regen::Options &flag)
+{
+  if (root == NULL || groups.empty() || flag.reverse_regex() || flag.reverse_match()) return NULL;
+  Capture *capture = new Capture(groups.size(), flag);
+  for (std::size_t i = 0; i < groups.size(); i++) {
+    capture->group_ids_[groups[i]].push_back(i);
+  }
+  Fragment f;
+  if (!capture->Build(root, &f)) {
+    delete capture;
+    return NULL;
+  }
+  for (std::size_t i = 0; i < f.first.size(); i++) {
+    capture->start_.push_back(Arc(f.first[i].pos, f.first[i].tags, f.first[i].deferred));
+  }
+  Sort(&capture->start_);
+  capture->final_.assign(capture->positions_.size(), false);
+  capture->accept_.resize(capture->positions_.size());
+  for (std::size_t i = 0; i < f.last.size(); i++) {
+    capture->final_[f.last[i].pos] = true;
+    capture->accept_[f.last[i].pos] = f.last[i].tags;
+  }
+  capture->nullable_ = root->nullable();
+  capture->empty_ = f.empty;
+  for (std::size_t p = 0; p < capture->arcs_.size(); p++) {
+    Sort(&capture->arcs_[p]);
+  }
+  return capture;
+}
+
+/* deferred arcs go after the others (stable). */
+void Capture::Sort(std::vector<Arc> *arcs)
+{
+  std::vector<Arc> sorted;
+  for (int deferred = 0; deferred <= 1; deferred++) {
+    for (std::size_t i = 0; i < arcs->size(); i++) {
+      if ((*arcs)[i].deferred == (deferred != 0)) sorted.push_back((*arcs)[i]);
+    }
+  }
+  arcs->swap(sorted);
+}
+
+void Capture::Link(const Ends &last, const Ends &first, bool deferred)
+{
+  for (std::size_t i = 0; i < last.size(); i++) {
+    for (std::size_t j = 0; j < first.size(); j++) {
+      Tags tags(last[i].tags);
+      Append(&tags, first[j].tags);
+      arcs_[last[i].pos].push_back(Arc(first[j].pos, tags, deferred || first[j].deferred));
+    }
+  }
+}
+
+/* f followed by rhs. */
+void Capture::Concatenate(Fragment *f, const Fragment &rhs)
+{
+  Link(f->last, rhs.first, false);
+  if (f->nullable) {
+    for (std::size_t i = 0; i < rhs.first.size(); i++) {
+      Tags tags(f->empty);
+      Append(&tags, rhs.first[i].tags);
+      f->first.push_back(End(rhs.first[i].pos, tags, rhs.first[i].deferred));
+    }
+  }
+  Ends last(rhs.last);
+  if (rhs.nullable) {
+    for (std::size_t i = 0; i < f->last.size(); i++) {
+      Tags tags(f->last[i].tags);
+      Append(&tags, rhs.empty);
+      last.push_back(End(f->last[i].pos, tags));
+    }
+  }
+  f->last.swap(last);
+  f->nullable = f->nullable && rhs.nullable;
+  Append(&f->empty, rhs.empty);
+}
+
+void Capture::Optional(Fragment *f, bool non_greedy)
+{
+  /* greedy ? tries the subexpression first, even for the empty string. */
+  if (!f->nullable || non_greedy) f->empty.clear();
+  f->nullable = true;
+  /* non-greedy ? prefers to skip the subexpression. */
+  if (non_greedy) Defer(&f->first);
+}
+
+/* f* (star) or f+. */
+void Capture::Loop(Fragment *f, bool star, bool non_greedy)
+{
+  Link(f->last, f->first, non_greedy);
+  if (star) {
+    f->nullable = true;
+    f->empty.clear();
+    if (non_greedy) Defer(&f->first);
+  }
+}
+
+bool Capture::Build(Expr *e, Fragment *f)
+{
+  switch (e->type()) {
+    case Expr::kLiteral: case Expr::kCharClass: case Expr::kDot: {
+      std::bitset<256> bytes;
+      for (std::size_t c = 0; c < 256; c++) {
+        if (c == flag_.delimiter() && !flag_.one_line()
+            && !(e->type() == Expr::kDot && static_cast<Dot*>(e)->match_delimiter())) continue;
+        switch (e->type()) {
+          case Expr::kLiteral: bytes[c] = static_cast<Literal*>(e)->literal() == c; break;
+          case Expr::kCharClass: bytes[c] = static_cast<CharClass*>(e)->Involve(c); break;
+          default: bytes[c] = true; break;
+        }
+      }
+      std::size_t id = positions_.size();
+      positions_.push_back(bytes);
+      arcs_.push_back(std::vector<Arc>());
+      f->first.push_back(End(id, Tags()));
+      f->last.push_back(End(id, Tags()));
+      break;
+    }
+    case Expr::kEpsilon:
+      f->nullable = true;
+      break;
+    case Expr::kNone:
+      break;
+    case Expr::kConcat: case Expr::kUnion: {
+      BinaryExpr *b = static_cast<BinaryExpr*>(e);
+      Fragment rhs;
+      if (!Build(b->lhs(), f) || !Build(b->rhs(), &rhs)) return false;
+      if (e->type() == Expr::kConcat) {
+        Concatenate(f, rhs);
+      } else {
+        f->first.insert(f->first.end(), rhs.first.begin(), rhs.first.end());
+        f->last.insert(f->last.end(), rhs.last.begin(), rhs.last.end());
+        if (!f->nullable) f->empty = rhs.empty;
+        f->nullable = f->nullable || rhs.nullable;
+      }
+      break;
+    }
+    case Expr::kQmark: {
+      Qmark *q = static_cast<Qmark*>(e);
+      if (!Build(q->lhs(), f)) return false;
+      Optional(f, q->non_greedy());
+      break;
+    }
+    case Expr::kStar: case Expr::kPlus: {
+      UnaryExpr *u = static_cast<UnaryExpr*>(e);
+      if (!Build(u->lhs(), f)) return false;
+      Loop(f, e->type() == Expr::kStar, e->type() == Expr::kStar && static_cast<Star*>(e)->non_greedy());
+      break;
+    }
+    case Expr::kRepetition: {
+      /* R..R R?..R? or R..R R*, as Repetition::Expand builds it, but
+       * every copy from R itself: each is tagged, and a later iteration
+       * overwrites the groups of the earlier ones. */
+      Repetition *r = static_cast<Repetition*>(e);
+      const int min = r->min(), max = r->max();
+      f->nullable = true;
+      for (int i = 0; i < (max == -1 ? min + 1 : max); i++) {
+        Fragment copy;
+        if (!Build(r->lhs(), &copy)) return false;
+        if (i == min && max == -1) {
+          Loop(&copy, true, r->non_greedy());
+        } else if (i >= min) {
+          Optional(&copy, r->non_greedy());
+        }
+        Concatenate(f, copy);
+      }
+      break;
+    }
+    default:
+      return false;
+  }
+
+  std::map<Expr*, std::vector<std::size_t> >::iterator iter = group_ids_.find(e);
+  if (iter != group_ids_.end()) {
+    const std::vector<std::size_t> &ids = iter->second;
+    for (std::size_t i = 0; i < ids.size(); i++) {
+      for (std::size_t j = 0; j < f->first.size(); j++) {
+        f->first[j].tags.insert(f->first[j].tags.begin(), 2 * ids[i]);
+      }
+      for (std::size_t j = 0; j < f->last.size(); j++) {
+        f->last[j].tags.push_back(2 * ids[i] + 1);
+      }
+      if (f->nullable) {
+        f->empty.insert(f->empty.begin(), 2 * ids[i]);
+        f->empty.push_back(2 * ids[i] + 1);
+      }
+    }
+  }
+  return true;
+}
+
+void Capture::Apply(const Tags &tags, const char *p, const char **values)
+{
+  for (std::size_t i = 0; i < tags.size(); i++) {
+    values[tags[i]] = p;
+  }
+}
+
+/* the buffers of a call are allocated once, up front: tag values of the
+ * threads (two tables of n rows, swapped on each byte) and their order.
+ * they are not kept in the Capture, which is shared between threads. */
+bool Capture::Match(const Regen::StringPiece &string, std::vector<Regen::StringPiece> *groups) const
+{
+  const std::size_t n = positions_.size(), width = 2 * group_num_;
+  const char *begin = string.begin(), *end = string.end();
+  /* rows of threads, next threads, and the values of the match. */
+  std::vector<const char*> buffer((2 * n + 1) * width, NULL);
+  const char **threads = &buffer[0], **next_threads = threads + n * width, **values = next_threads + n * width;
+  /* order: positions of the threads in priority order,
+   * alive[q]: 1 + index of the last byte which entered q. */
+  std::vector<std::size_t> work(3 * n + 1, 0);
+  std::size_t *order = &work[0], *next_order = order + n, *alive = next_order + n;
+  std::size_t order_num = 0;
+  bool match = false;
+
+  if (begin == end) {
+    if (nullable_) {
+      Apply(empty_, begin, values);
+      match = true;
+    }
+  } else {
+    const unsigned char c = *begin;
+    for (std::size_t i = 0; i < start_.size(); i++) {
+      std::size_t q = start_[i].to;
+      if (alive[q] == 1 || !positions_[q][c]) continue;
+      alive[q] = 1;
+      Apply(start_[i].tags, begin, threads + q * width);
+      order[order_num++] = q;
+    }
+    for (const char *s = begin + 1; s < end && order_num > 0; s++) {
+      const unsigned char c = *s;
+      const std::size_t step = s - begin + 1;
+      std::size_t next_num = 0;
+      for (std::size_t i = 0; i < order_num; i++) {
+        const std::vector<Arc> &arcs = arcs_[order[i]];
+        for (std::size_t j = 0; j < arcs.size(); j++) {
+          std::size_t q = arcs[j].to;
+          if (alive[q] == step || !positions_[q][c]) continue;
+          alive[q] = step;
+          std::copy(threads + order[i] * width, threads + (order[i] + 1) * width, next_threads + q * width);
+          Apply(arcs[j].tags, s, next_threads + q * width);
+          next_order[next_num++] = q;
+        }
+      }
+      std::swap(order, next_order);
+      std::swap(threads, next_threads);
+      order_num = next_num;
+    }
+    for (std::size_t i = 0; i < order_num; i++) {
+      if (final_[order[i]]) {
+        std::copy(threads + order[i] * width, threads + (order[i] + 1) * width, values);
+        Apply(accept_[order[i]], end, values);
+        match = true;
+        break;
+      }
+    }
+  }
+  if (!match) return false;
+
+  groups->assign(group_num_ + 1, Regen::StringPiece());
+  (*groups)[0] = string;
+  for (std::size_t i = 0; i < group_num_; i++) {
+    const char *open = values[2 * i], *close = values[2 * i + 1];
+    if (open != NULL && close != NULL && open <= close) (*groups)[i + 1].set(open, close);
+  }
+  return true;
+}
+
+} // namespace regen
@@ -0,0 +1,75 @@
+#ifndef REGEN_CAPTURE_H_
+#define  REGEN_CAPTURE_H_
+#include "regen.h"
+#include "util.h"
+#include "expr.h"
+
+namespace regen {
+
+/* Submatch extraction by a tagged Glushkov automaton.
+ * each transition between positions carries the tags (open/close of groups)
+ * it passes through. once the DFA has fixed the bounds of a match, positions
+ * are simulated over it in lockstep, one thread (with its tag values) per
+ * position. threads are kept in priority order (left alternatives and greedy
+ * loops first), so submatches are those a backtracking matcher would report,
+ * in one pass without backtracking.
+ * this is an NFA simulation, not a tagged (or one-pass) DFA: no states are
+ * built ahead, and a byte costs up to the number of positions (times the
+ * groups copied). a counted repetition is one copy per iteration, so it's
+ * planned by Regen on the first submatch request, not with the pattern. */
+class Capture {
+public:
+  /* returns NULL if the regex has no groups, or contains zero-width
+   * operators (anchors, back-references, intersection, ...) tags can't follow. */
+  static Capture* Plan(Expr *root, const std::vector<Expr*> &groups, const Regen::Options &flag);
+  /* string must be a whole match. (*groups)[0] is string, (*groups)[i] is
+   * the last match of the i-th group (cleared if it didn't participate). */
+  bool Match(const Regen::StringPiece& string, std::vector<Regen::StringPiece>* groups) const;
+  std::size_t group_num() const { return group_num_; }
+private:
+  typedef std::vector<std::size_t> Tags; // 2*i: open the i-th group, 2*i+1: close it
+  struct Arc {
+    Arc(std::size_t to_, const Tags &tags_, bool deferred_): to(to_), tags(tags_), deferred(deferred_) {}
+    std::size_t to;
+    Tags tags;
+    bool deferred; // into a non-greedy loop, tried after the others
+  };
+  struct End {
+    End(std::size_t pos_, const Tags &tags_, bool deferred_ = false): pos(pos_), tags(tags_), deferred(deferred_) {}
+    std::size_t pos;
+    Tags tags;
+    bool deferred;
+  };
+  typedef std::vector<End> Ends;
+  /* positions a subexpression is entered at (first) and left from (last),
+   * with the tags passed on the way. */
+  struct Fragment {
+    Fragment(): nullable(false) {}
+    Ends first, last;
+    bool nullable;
+    Tags empty; // tags passed when it matches the empty string
+  };
+  Capture(std::size_t group_num, const Regen::Options &flag): group_num_(group_num), flag_(flag), nullable_(false) {}
+  bool Build(Expr *e, Fragment *f);
+  void Concatenate(Fragment *f, const Fragment &rhs);
+  static void Optional(Fragment *f, bool non_greedy);
+  void Loop(Fragment *f, bool star, bool non_greedy);
+  void Link(const Ends &last, const Ends &first, bool deferred);
+  static void Defer(Ends *ends);
+  static void Sort(std::vector<Arc> *arcs);
+  static void Apply(const Tags &tags, const char *p, const char **values);
+  std::size_t group_num_;
+  Regen::Options flag_;
+  std::map<Expr*, std::vector<std::size_t> > group_ids_;
+  std::vector<std::bitset<256> > positions_; // bytes accepted by each position
+  std::vector<std::vector<Arc> > arcs_; // arcs_[p]: transitions from p in priority order
+  std::vector<Arc> start_;
+  std::vector<bool> final_;
+  std::vector<Tags> accept_; // tags passed on leaving a final position
+  bool nullable_;
+  Tags empty_;
+  DISALLOW_COPY_AND_ASSIGN(Capture);
+};
+
+} // namespace regen
+#endif // REGEN_CAPTURE_H_
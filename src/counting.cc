@@ -0,0 +1,242 @@
+#include "counting.h"
+#include <algorithm>
+
+namespace regen {
+
+CountingMatcher* CountingMatcher::Plan(Expr *root, const Regen::Options &flag)
+{
+  if (root == NULL || flag.reverse_regex() || flag.reverse_match()) return NULL;
+  CountingMatcher *counting = new CountingMatcher(flag);
+  Fragment f;
+  if (!counting->Build(root, &f) || counting->counter_num_ == 0) {
+    delete counting;
+    return NULL;
+  }
+  counting->start_ = f.first;
+  counting->final_.assign(counting->positions_.size(), false);
+  for (std::size_t i = 0; i < f.last.size(); i++) {
+    counting->final_[f.last[i]] = true;
+  }
+  counting->nullable_ = f.nullable && !flag.non_nullable();
+  for (std::size_t p = 0; p < counting->positions_.size(); p++) {
+    std::vector<std::size_t> &follow = counting->positions_[p].follow;
+    std::sort(follow.begin(), follow.end());
+    follow.erase(std::unique(follow.begin(), follow.end()), follow.end());
+  }
+  return counting;
+}
+
+/* bytes of e if e matches exactly one byte (a character class, or a union of them). */
+bool CountingMatcher::Bytes(Expr *e, std::bitset<256> *bytes) const
+{
+  switch (e->type()) {
+    case Expr::kLiteral: case Expr::kCharClass: case Expr::kDot:
+      for (std::size_t c = 0; c < 256; c++) {
+        if (c == flag_.delimiter() && !flag_.one_line()
+            && !(e->type() == Expr::kDot && static_cast<Dot*>(e)->match_delimiter())) continue;
+        switch (e->type()) {
+          case Expr::kLiteral: (*bytes)[c] = (*bytes)[c] || static_cast<Literal*>(e)->literal() == c; break;
+          case Expr::kCharClass: (*bytes)[c] = (*bytes)[c] || static_cast<CharClass*>(e)->Involve(c); break;
+          default: (*bytes)[c] = true; break;
+        }
+      }
+      return true;
+    case Expr::kUnion:
+      return Bytes(static_cast<Union*>(e)->lhs(), bytes) && Bytes(static_cast<Union*>(e)->rhs(), bytes);
+    default:
+      return false;
+  }
+}
+
+std::size_t CountingMatcher::NewPosition(const std::bitset<256> &bytes)
+{
+  Position p;
+  p.bytes = bytes;
+  positions_.push_back(p);
+  return positions_.size() - 1;
+}
+
+void CountingMatcher::Link(const std::vector<std::size_t> &last, const std::vector<std::size_t> &first)
+{
+  for (std::size_t i = 0; i < last.size(); i++) {
+    std::vector<std::size_t> &follow = positions_[last[i]].follow;
+    follow.insert(follow.end(), first.begin(), first.end());
+  }
+}
+
+bool CountingMatcher::Build(Expr *e, Fragment *f)
+{
+  switch (e->type()) {
+    case Expr::kLiteral: case Expr::kCharClass: case Expr::kDot: {
+      std::bitset<256> bytes;
+      Bytes(e, &bytes);
+      std::size_t id = NewPosition(bytes);
+      f->first.push_back(id);
+      f->last.push_back(id);
+      break;
+    }
+    case Expr::kEpsilon:
+      f->nullable = true;
+      break;
+    case Expr::kNone:
+      break;
+    case Expr::kConcat: case Expr::kUnion: {
+      BinaryExpr *b = static_cast<BinaryExpr*>(e);
+      Fragment lhs, rhs;
+      if (!Build(b->lhs(), &lhs) || !Build(b->rhs(), &rhs)) return false;
+      if (e->type() == Expr::kConcat) {
+        Link(lhs.last, rhs.first);
+        f->first = lhs.first;
+        if (lhs.nullable) f->first.insert(f->first.end(), rhs.first.begin(), rhs.first.end());
+        f->last = rhs.last;
+        if (rhs.nullable) f->last.insert(f->last.end(), lhs.last.begin(), lhs.last.end());
+        f->nullable = lhs.nullable && rhs.nullable;
+      } else {
+        f->first = lhs.first;
+        f->first.insert(f->first.end(), rhs.first.begin(), rhs.first.end());
+        f->last = lhs.last;
+        f->last.insert(f->last.end(), rhs.last.begin(), rhs.last.end());
+        f->nullable = lhs.nullable || rhs.nullable;
+      }
+      break;
+    }
+    case Expr::kQmark: {
+      Qmark *q = static_cast<Qmark*>(e);
+      if (q->non_greedy() || !Build(q->lhs(), f)) return false;
+      f->nullable = true;
+      break;
+    }
+    case Expr::kStar: case Expr::kPlus: {
+      UnaryExpr *u = static_cast<UnaryExpr*>(e);
+      if (e->type() == Expr::kStar && static_cast<Star*>(e)->non_greedy()) return false;
+      if (!Build(u->lhs(), f)) return false;
+      Link(f->last, f->first);
+      if (e->type() == Expr::kStar) f->nullable = true;
+      break;
+    }
+    case Expr::kRepetition: {
+      Repetition *r = static_cast<Repetition*>(e);
+      if (r->non_greedy()) return false;
+      std::bitset<256> bytes;
+      if (!Bytes(r->lhs(), &bytes) || (r->max() != -1 && r->max() <= 1)) {
+        return Build(r->expanded(), f);
+      }
+      std::size_t id = NewPosition(bytes);
+      Position &p = positions_[id];
+      p.min = r->min();
+      p.unbounded = r->max() == -1;
+      p.width = p.unbounded ? std::max(r->min(), 1) : r->max();
+      p.offset = word_num_;
+      word_num_ += (p.width + 63) / 64;
+      counter_num_++;
+      f->first.push_back(id);
+      f->last.push_back(id);
+      f->nullable = r->min() == 0;
+      break;
+    }
+    default:
+      return false;
+  }
+  return true;
+}
+
+/* true if the thread at p can go on to the follow of p. */
+bool CountingMatcher::Leave(std::size_t p, const std::vector<uint64_t> &counters, const std::vector<bool> &alive) const
+{
+  if (!alive[p]) return false;
+  const Position &pos = positions_[p];
+  if (pos.width == 0) return true;
+  /* some live value is at least min (bit min-1 or above). */
+  const std::size_t from = pos.min == 0 ? 0 : pos.min - 1;
+  const std::size_t words = (pos.width + 63) / 64;
+  for (std::size_t i = from / 64; i < words; i++) {
+    uint64_t bits = counters[pos.offset + i];
+    if (i == from / 64) bits &= ~(uint64_t)0 << (from % 64);
+    if (bits != 0) return true;
+  }
+  return false;
+}
+
+bool CountingMatcher::Match(const Regen::StringPiece &string, Regen::StringPiece *result) const
+{
+  const std::size_t n = positions_.size();
+  const unsigned char *begin = string.ubegin(), *end = string.uend(), *p = begin;
+  const unsigned char *matchptr = nullable_ ? begin : NULL;
+  const bool search = !flag_.prefix_match(), shortest = !flag_.suffix_match() && flag_.shortest_match();
+  std::vector<bool> alive(n, false), next_alive(n, false), entered(n, false);
+  std::vector<uint64_t> counters(word_num_, 0), next_counters(word_num_, 0);
+  bool accept = nullable_, live = false;
+
+  if (matchptr != NULL && result == NULL && !flag_.suffix_match()) return true;
+  for (; p != end; p++) {
+    if (shortest && matchptr != NULL) break;
+    /* a match is tried from each byte (partial matching) until one is found,
+     * as the DFA trims its .*? then. */
+    const bool restart = p == begin || (search && (matchptr == NULL || flag_.suffix_match()));
+    if (!restart && !live) break;
+
+    entered.assign(n, false);
+    if (restart) {
+      for (std::size_t i = 0; i < start_.size(); i++) entered[start_[i]] = true;
+    }
+    for (std::size_t q = 0; q < n; q++) {
+      if (!Leave(q, counters, alive)) continue;
+      const std::vector<std::size_t> &follow = positions_[q].follow;
+      for (std::size_t i = 0; i < follow.size(); i++) entered[follow[i]] = true;
+    }
+
+    const unsigned char c = *p;
+    live = accept = false;
+    for (std::size_t q = 0; q < n; q++) {
+      const Position &pos = positions_[q];
+      if (pos.width == 0) {
+        next_alive[q] = entered[q] && pos.bytes[c];
+      } else {
+        const uint64_t *src = &counters[pos.offset];
+        uint64_t *dst = &next_counters[pos.offset];
+        const std::size_t words = (pos.width + 63) / 64;
+        bool any = false;
+        if (pos.bytes[c]) {
+          /* each live value is incremented, and 1 is added on entering. */
+          const std::size_t top = pos.width - 1;
+          const bool saturate = pos.unbounded && (src[top / 64] >> (top % 64) & 1);
+          uint64_t carry = entered[q] ? 1 : 0;
+          for (std::size_t i = 0; i < words; i++) {
+            dst[i] = src[i] << 1 | carry;
+            carry = src[i] >> 63;
+          }
+          if (pos.width % 64 != 0) dst[words-1] &= ((uint64_t)1 << (pos.width % 64)) - 1;
+          if (saturate) dst[top / 64] |= (uint64_t)1 << (top % 64);
+          for (std::size_t i = 0; i < words; i++) any |= dst[i] != 0;
+        } else {
+          std::fill(dst, dst + words, 0);
+        }
+        next_alive[q] = any;
+      }
+      live |= next_alive[q];
+    }
+    alive.swap(next_alive);
+    counters.swap(next_counters);
+
+    for (std::size_t q = 0; q < n && !accept; q++) {
+      accept = final_[q] && Leave(q, counters, alive);
+    }
+    if (accept) {
+      if (result == NULL && !flag_.suffix_match()) return true;
+      matchptr = p + 1;
+    }
+  }
+
+  if (flag_.suffix_match()) {
+    /* empty match at the end. */
+    if (search && nullable_) accept = true;
+    accept &= p == end;
+    if (accept && result != NULL) result->set_end(string.end());
+    return accept;
+  }
+  if (matchptr == NULL) return false;
+  if (result != NULL) result->set_uend(matchptr);
+  return true;
+}
+
+} // namespace regen
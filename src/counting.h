@@ -0,0 +1,55 @@
+#ifndef REGEN_COUNTING_H_
+#define  REGEN_COUNTING_H_
+#include "regen.h"
+#include "util.h"
+#include "expr.h"
+
+namespace regen {
+
+/* Counting-set automaton for bounded repetitions.
+ * X{n,m} of a single character class X (or a union of them) is one position
+ * holding the set of live counter values, instead of m positions: the set is
+ * a bit vector (bit k-1: X has been repeated k times) which is shifted by one
+ * on each byte X accepts. subset DFA of such patterns (.*a.{m}) grows exponentially
+ * in m, so it stands in for the DFA when the DFA exceeds its limit. */
+class CountingMatcher {
+public:
+  /* returns NULL if the regex has no counted repetition of a character class,
+   * or contains what counters can't follow (anchors, operators, non-greedy loops, ...). */
+  static CountingMatcher* Plan(Expr *root, const Regen::Options &flag);
+  /* same match/result semantics as the DFA. */
+  bool Match(const Regen::StringPiece& string, Regen::StringPiece* result = NULL) const;
+  std::size_t counter_num() const { return counter_num_; }
+private:
+  struct Position {
+    Position(): min(0), width(0), unbounded(false), offset(0) {}
+    std::bitset<256> bytes;
+    std::size_t min; // counter values (>= 1) which can leave the repetition
+    std::size_t width; // bits of the counter set (0: plain position)
+    bool unbounded; // X{n,}: values over n are merged into n
+    std::size_t offset; // of the counter set in the words of a state
+    std::vector<std::size_t> follow;
+  };
+  struct Fragment {
+    Fragment(): nullable(false) {}
+    std::vector<std::size_t> first, last;
+    bool nullable;
+  };
+  CountingMatcher(const Regen::Options &flag): flag_(flag), counter_num_(0), word_num_(0), nullable_(false) {}
+  bool Build(Expr *e, Fragment *f);
+  bool Bytes(Expr *e, std::bitset<256> *bytes) const;
+  std::size_t NewPosition(const std::bitset<256> &bytes);
+  void Link(const std::vector<std::size_t> &last, const std::vector<std::size_t> &first);
+  bool Leave(std::size_t p, const std::vector<uint64_t> &counters, const std::vector<bool> &alive) const;
+  Regen::Options flag_;
+  std::vector<Position> positions_;
+  std::vector<std::size_t> start_;
+  std::vector<bool> final_;
+  std::size_t counter_num_;
+  std::size_t word_num_; // words of all counter sets
+  bool nullable_;
+  DISALLOW_COPY_AND_ASSIGN(CountingMatcher);
+};
+
+} // namespace regen
+#endif // REGEN_COUNTING_H_
@@ -30,6 +30,15 @@ bool DFA::ContainAcceptState(const Subset &states) const
   return false;
 }
 
+void DFA::FillAcceptIDs(const Subset &states, std::set<std::size_t> *ids) const
+{
+  for (Subset::iterator iter = states.begin(); iter != states.end(); ++iter) {
+    if ((*iter)->type() == Expr::kEOP) {
+      ids->insert(static_cast<EOP*>(*iter)->id());
+    }
+  }
+}
+
 void DFA::ExpandStates(Subset* states, bool begline, bool endline) const
 {
   std::set<Operator*> intersections;
@@ -107,12 +116,15 @@ entry:
 void DFA::FillTransition(StateExpr* state, std::vector<Subset>* transition) const
 {
   if (state->non_greedy()) MakeNonGreedy(state);
+  /* the follow is collected once for all the bytes which read it,
+   * instead of walking its tree for each of them. */
+  std::vector<StateExpr*> follow(state->follow().begin(), state->follow().end());
   switch (state->type()) {
     case Expr::kLiteral: {
       Literal *lit = static_cast<Literal*>(state);
       unsigned char index = lit->literal();
       if (index == flag_.delimiter() && !flag_.one_line()) break;
-      (*transition)[index].insert(lit->follow().begin(), lit->follow().end());
+      (*transition)[index].insert(follow.begin(), follow.end());
       break;
     }
     case Expr::kCharClass: {
@@ -120,7 +132,7 @@ void DFA::FillTransition(StateExpr* state, std::vector<Subset>* transition) cons
       for (std::size_t c = 0; c < 256; c++) {
         if (c == flag_.delimiter() && !flag_.one_line()) continue;
         if (cc->Match(c)) {
-          (*transition)[c].insert(cc->follow().begin(), cc->follow().end());
+          (*transition)[c].insert(follow.begin(), follow.end());
         }
       }
       break;
@@ -130,14 +142,13 @@ void DFA::FillTransition(StateExpr* state, std::vector<Subset>* transition) cons
       for (std::size_t c = 0; c < 256; c++) {
         if (c == flag_.delimiter() && !flag_.one_line()
             && !dot->match_delimiter()) continue;
-        (*transition)[c].insert(dot->follow().begin(), dot->follow().end());
+        (*transition)[c].insert(follow.begin(), follow.end());
       }
       break;
     }
     case Expr::kAnchor:
       if (!flag_.one_line()) {
-      Anchor* an = static_cast<Anchor*>(state);
-      (*transition)[flag_.delimiter()].insert(an->follow().begin(), an->follow().end());
+      (*transition)[flag_.delimiter()].insert(follow.begin(), follow.end());
       }
       break;
     default: break;
@@ -148,7 +159,7 @@ void DFA::MakeNonGreedy(StateExpr* state) const {
   if (state->complete_non_greedy()) return;
   Subset follow_;
 
-  for (Subset::iterator iter = state->follow().begin(); iter != state->follow().end(); ++iter) {
+  for (PositionSet::iterator iter = state->follow().begin(); iter != state->follow().end(); ++iter) {
     StateExpr* next = *iter;
     if (!next->non_greedy() && next->type() != Expr::kEOP) {
       if (state->root_non_greedy()) {
@@ -178,11 +189,32 @@ void DFA::MakeNonGreedy(StateExpr* state) const {
       follow_.insert(next);
     }
   }
-  state->follow() = follow_;
+  state->follow().assign(follow_.begin(), follow_.end(), &pool_);
   state->set_complete_non_greedy(true);
 }
 
+/* MakeNonGreedy of every non-greedy position, and of the pairs it makes.
+ * after that, matching only reads the expressions, so On-The-Fly DFAs of
+ * other threads may share them. */
+void DFA::CompleteNonGreedy(const std::vector<StateExpr*> &states) const {
+  std::vector<StateExpr*> stack;
+  for (std::size_t i = 0; i < states.size(); i++) {
+    if (states[i]->non_greedy()) stack.push_back(states[i]);
+  }
+  while (!stack.empty()) {
+    StateExpr *state = stack.back();
+    stack.pop_back();
+    if (state->complete_non_greedy()) continue;
+    MakeNonGreedy(state);
+    for (PositionSet::iterator iter = state->follow().begin(); iter != state->follow().end(); ++iter) {
+      if ((*iter)->non_greedy() && !(*iter)->complete_non_greedy()) stack.push_back(*iter);
+    }
+  }
+}
+
 void DFA::TrimNonGreedy(Subset* states) const {
+  /* Suffix matching must be able to restart after an acceptance. */
+  if (flag_.suffix_match()) return;
   Subset trim;
   for (Subset::iterator iter = states->begin(); iter != states->end(); ++iter) {
     if ((*iter)->non_greedy()) trim.insert(*iter);
@@ -197,13 +229,15 @@ void DFA::TrimNonGreedy(Subset* states) const {
 bool DFA::Construct(std::size_t limit)
 {
   if (expr_info_.expr_root == NULL) return false;
-  
+  /* states built on-the-fly by earlier matches are numbered differently. */
+  if (!states_.empty()) Clear();
+
   std::queue<Subset> queue;
   std::vector<Subset> transition(256);
 
   state_t dfa_id = 0;
   bool limit_over = false, begline = true;
-  Subset states = expr_info_.expr_root->first();
+  Subset states(expr_info_.expr_root->first().begin(), expr_info_.expr_root->first().end());
 
   ExpandStates(&states, begline);
   if (ContainAcceptState(states)) TrimNonGreedy(&states);
@@ -224,6 +258,7 @@ bool DFA::Construct(std::size_t limit)
     State &state = get_new_state();
     Transition &trans = transition_[state.id];
     state.accept = ContainAcceptState(states);
+    if (state.accept) FillAcceptIDs(states, &state.accept_ids);
 
     if (!flag_.suffix_match() && flag_.shortest_match()) {
       /* Leftmost-Shortest matching
@@ -268,6 +303,8 @@ bool DFA::Construct(std::size_t limit)
   }
 
   if (limit_over) {
+    /* drop the partial DFA, On-The-Fly DFA will be built from scratch. */
+    Clear();
     return false;
   } else {
     Finalize();
@@ -279,11 +316,14 @@ bool DFA::Construct(const NFA &nfa, size_t limit)
 {
   state_t dfa_id = 0;
 
-  typedef std::set<NFA::state_t> Subset_;
+  /* subsets are sorted vectors of NFA states, and each DFA state is built
+   * from the byte-range edges of its subset: the bytes are cut at the
+   * bounds of the ranges, and each piece is one union of target sets. */
+  typedef NFA::Targets Subset_;
 
-  std::map<std::set<NFA::state_t>, state_t> dfa_map;
+  std::map<Subset_, state_t> dfa_map;
   std::queue<Subset_> queue;
-  const Subset_ &start_states = nfa.start_states();
+  const Subset_ start_states(nfa.start_states().begin(), nfa.start_states().end());
 
   dfa_map[start_states] = dfa_id++;
   queue.push(start_states);
@@ -291,40 +331,58 @@ bool DFA::Construct(const NFA &nfa, size_t limit)
   while (!queue.empty()) {
     Subset_ nfa_states = queue.front();
     queue.pop();
-    std::vector<Subset_> transition(256);
+    std::vector<NFA::edge_iterator> edges;
+    std::bitset<257> bounds;
     bool accept = false;
 
     for (Subset_::iterator iter = nfa_states.begin(); iter != nfa_states.end(); ++iter) {
-      const NFA::State &state = nfa[*iter];
-      for (std::size_t i = 0; i < 256; i++) {
-        transition[i].insert(state.transition[i].begin(), state.transition[i].end());
+      for (NFA::edge_iterator e = nfa.edge_begin(*iter); e != nfa.edge_end(*iter); ++e) {
+        edges.push_back(e);
+        bounds.set(e->lo);
+        bounds.set(e->hi + 1);
       }
-      accept |= state.accept;
+      accept |= nfa[*iter].accept;
     }
 
     State &state = get_new_state();
     Transition &trans = transition_[state.id];
     state.accept = accept;
+    if (accept) state.accept_ids.insert(0);
     //Leftmost-Shortest matching
     if (!flag_.suffix_match() && flag_.shortest_match() && accept) {
       trans.fill(REJECT);
       state.dst_states.insert(REJECT);
       continue;
     }
-    
-    for (state_t i = 0; i < 256; i++) {
-      Subset_ &next = transition[i];
-      if (next.empty()) {
-        trans[i] = REJECT;
-        state.dst_states.insert(REJECT);
-        continue;
+
+    for (std::size_t lo = 0; lo < 256; ) {
+      std::size_t hi = lo + 1;
+      while (hi < 256 && !bounds[hi]) hi++;
+      Subset_ next;
+      for (std::size_t i = 0; i < edges.size(); i++) {
+        if (edges[i]->lo <= lo && lo <= edges[i]->hi) {
+          const NFA::Targets &targets = nfa.targets(edges[i]->targets);
+          next.insert(next.end(), targets.begin(), targets.end());
+        }
       }
-      if (dfa_map.find(next) == dfa_map.end()) {
-        dfa_map[next] = dfa_id++;
-        queue.push(next);
+      state_t dst = REJECT;
+      if (!next.empty()) {
+        std::sort(next.begin(), next.end());
+        next.erase(std::unique(next.begin(), next.end()), next.end());
+        std::map<Subset_, state_t>::iterator found = dfa_map.find(next);
+        if (found == dfa_map.end()) {
+          if (dfa_id >= limit) {
+            Clear();
+            return false;
+          }
+          found = dfa_map.insert(std::make_pair(next, dfa_id++)).first;
+          queue.push(next);
+        }
+        dst = found->second;
       }
-      trans[i] = dfa_map[next];
-      state.dst_states.insert(dfa_map[next]);
+      for (std::size_t c = lo; c < hi; c++) trans[c] = dst;
+      state.dst_states.insert(dst);
+      lo = hi;
     }
   }
 
@@ -347,6 +405,15 @@ void DFA::Finalize()
   complete_ = true;
 }
 
+void DFA::Clear()
+{
+  transition_.clear();
+  states_.clear();
+  dfa_map_.clear();
+  nfa_map_.clear();
+  complete_ = minimum_ = false;
+}
+
 DFA::State& DFA::get_new_state() const
 {
   transition_.resize(states_.size()+1);
@@ -378,7 +445,8 @@ bool DFA::Minimize()
   for (state_t i = 0; i < size()-1; i++) {
     distinction_table[i].resize(size()-i-1);
     for (state_t j = i+1; j < size(); j++) {
-      distinction_table[i][size()-j-1] = states_[i].accept != states_[j].accept;
+      distinction_table[i][size()-j-1] = states_[i].accept != states_[j].accept
+          || states_[i].accept_ids != states_[j].accept_ids;
     }
   }
 
@@ -881,35 +949,40 @@ bool DFA::Match(const Regen::StringPiece &string, Regen::StringPiece *result) co
     const unsigned char **arg1 = string_._udata();
     state = CompiledMatch(arg1, &matchptr, state);
   } else {
-    if (result == NULL) {
-      while (!string_.empty() && (state = transition_[state][*string_.udata()]) != DFA::REJECT) {
-        string_.consume(sign);
+    /* reversed string_ is [end-1, begin-1), so walk until the pointers meet. */
+    const unsigned char *p = string_.ubegin(), *end = string_.uend();
+    if (result == NULL && flag_.suffix_match()) {
+      while (p != end && (state = transition_[state][*p]) != DFA::REJECT) {
+        p += sign;
       }
     } else {
-      if (IsAcceptState(state)) matchptr = string_.udata();
-      while (!string_.empty() && (state = transition_[state][*string_.udata()]) != DFA::REJECT) {
-        if (IsAcceptState(state)) matchptr = string_.udata();
-        string_.consume(sign);
+      if (IsAcceptState(state)) matchptr = p;
+      while (p != end && (state = transition_[state][*p]) != DFA::REJECT) {
+        p += sign;
+        if (IsAcceptState(state)) matchptr = p;
       }
     }
+    string_.set_ubegin(p);
   }
 
   accept = IsAcceptState(state);
-  if (!accept && state != REJECT && string_.empty()) {
-    Subset endstates = nfa_map_[state];
-    ExpandStates(&endstates, string.empty(), true);
-    accept = ContainAcceptState(endstates);
+  if (!accept && string_.begin() == string_.end()) {
+    accept = IsAcceptAtEnd(state, string.empty());
+    /* accepted by $ at the end of string. */
+    if (accept) matchptr = string_.udata();
   }
   if (result == NULL) {
-    return accept;
+    return accept || (!flag_.suffix_match() && matchptr != NULL);
   } else {
-    if (flag_.suffix_match() && accept) {
-      if (flag_.reverse_match()) {
-        result->set_begin(string.begin());
-      } else {
-        result->set_end(string.end());
+    if (flag_.suffix_match()) {
+      if (accept) {
+        if (flag_.reverse_match()) {
+          result->set_begin(string.begin());
+        } else {
+          result->set_end(string.end());
+        }
       }
-      return true;
+      return accept;
     } else {
       if (accept |= matchptr != NULL) {
         if (flag_.reverse_match()) {
@@ -923,18 +996,77 @@ bool DFA::Match(const Regen::StringPiece &string, Regen::StringPiece *result) co
   }
 }
 
-bool DFA::OnTheFlyMatch(const Regen::StringPiece& string, Regen::StringPiece* result) const
+DFA::state_t DFA::OnTheFlyInit() const
 {
   if (empty()) {
-    Subset states = expr_info_.expr_root->first();
+    Subset states(expr_info_.expr_root->first().begin(), expr_info_.expr_root->first().end());
     ExpandStates(&states, true);
-    bool accept = ContainAcceptState(states);
+    if (ContainAcceptState(states)) TrimNonGreedy(&states);
     State& s = get_new_state();
     dfa_map_[states] = s.id;
     nfa_map_[s.id] = states;
-    s.accept = accept;
+    s.accept = ContainAcceptState(states);
+    if (s.accept) FillAcceptIDs(states, &s.accept_ids);
+  }
+  return 0;
+}
+
+/* construct (and memoize) a transition of On-The-Fly DFA. */
+DFA::state_t DFA::OnTheFlyTransition(state_t state, unsigned char c) const
+{
+  if (!flag_.suffix_match() && flag_.shortest_match() && states_[state].accept) {
+    return transition_[state][c] = REJECT;
+  }
+
+  Subset& states = nfa_map_[state];
+  Subset nexts;
+
+  for (Subset::iterator iter = states.begin(); iter != states.end(); ++iter) {
+    StateExpr *s = *iter;
+    if (s->non_greedy()) MakeNonGreedy(s);
+    switch (s->type()) {
+      case Expr::kLiteral: case Expr::kCharClass:
+        if (c == flag_.delimiter() && !flag_.one_line()) continue;
+        break;
+      case Expr::kDot:
+        if (c == flag_.delimiter() && !flag_.one_line()
+            && !static_cast<Dot*>(s)->match_delimiter()) continue;
+        break;
+      case Expr::kAnchor:
+        if (c == flag_.delimiter() && !flag_.one_line()) {
+          nexts.insert(s->follow().begin(), s->follow().end());
+        }
+        continue;
+      default:
+        continue;
+    }
+    if (s->Match(c)) {
+      nexts.insert(s->follow().begin(), s->follow().end());
+    }
+  }
+
+  if (nexts.empty()) return transition_[state][c] = REJECT;
+
+  ExpandStates(&nexts);
+  if (ContainAcceptState(nexts)) TrimNonGreedy(&nexts);
+
+  state_t next;
+  std::map<Subset, state_t>::iterator iter = dfa_map_.find(nexts);
+  if (iter == dfa_map_.end()) {
+    State& s = get_new_state();
+    dfa_map_[nexts] = s.id;
+    nfa_map_[s.id] = nexts;
+    s.accept = ContainAcceptState(nexts);
+    if (s.accept) FillAcceptIDs(nexts, &s.accept_ids);
+    next = s.id;
+  } else {
+    next = iter->second;
   }
+  return transition_[state][c] = next;
+}
 
+bool DFA::OnTheFlyMatch(const Regen::StringPiece& string, Regen::StringPiece* result) const
+{
   int dir = 1;  
   const unsigned char* str = string.ubegin();
   const unsigned char* end = string.uend();
@@ -943,51 +1075,130 @@ bool DFA::OnTheFlyMatch(const Regen::StringPiece& string, Regen::StringPiece* re
     std::swap(str, end);
   }
   
-  state_t state = 0, next = UNDEF;
+  state_t state = OnTheFlyInit(), next = UNDEF;
+  const unsigned char* matchptr = NULL;
+  if (IsAcceptState(state)) matchptr = str;
   
   while (str != end) {
     next = transition_[state][*str];
-    if (next >= UNDEF) {
-      if (next == REJECT) return false;
-      do { // do matching with on-the-fly construction.
-        Subset& states = nfa_map_[state];
-        Subset nexts;
-
-        for (Subset::iterator iter = states.begin(); iter != states.end(); ++iter) {
-          if ((*iter)->Match(*str)) {
-            nexts.insert((*iter)->follow().begin(), (*iter)->follow().end());
-          }
-        }
-        ExpandStates(&nexts);
-
-        if (nexts.empty()) {
-          next = transition_[state][*str] = REJECT;
-        } else if (dfa_map_.find(nexts) == dfa_map_.end()) {
-          bool accept = ContainAcceptState(nexts);
-          State& s = get_new_state();
-          dfa_map_[nexts] = s.id;
-          nfa_map_[s.id] = nexts;
-          s.accept = accept;
-          next = transition_[state][*str] = s.id;
-        } else {
-          next = dfa_map_[nexts];
-        }
-        str += dir;
-        state = next;
-      } while (str != end && transition_[state][*str] == UNDEF);
-    } else {
-      str += dir;
+    if (next == UNDEF) next = OnTheFlyTransition(state, *str);
+    if (next == REJECT) break;
+    str += dir;
+    state = next;
+    if (IsAcceptState(state)) matchptr = str;
+  }
+
+  bool accept = false;
+  if (str == end) accept = IsAcceptAtEnd(state, str == string.ubegin());
+  if (result == NULL || flag_.suffix_match()) {
+    if (accept && result != NULL) {
+      if (flag_.reverse_match()) {
+        result->set_begin(string.begin());
+      } else {
+        result->set_end(string.end());
+      }
+    }
+    return accept || (!flag_.suffix_match() && matchptr != NULL);
+  }
+  if (!accept && matchptr == NULL) return false;
+  if (accept) matchptr = str;
+  if (flag_.reverse_match()) {
+    result->set_ubegin(matchptr+1);
+  } else {
+    result->set_uend(matchptr);
+  }
+  return true;
+}
+
+DFA::state_t DFA::Resume(state_t state, const Regen::StringPiece &string, const unsigned char **matchptr) const
+{
+  *matchptr = NULL;
+  if (state == REJECT) return REJECT;
+  if (!complete_) OnTheFlyInit();
+#if REGEN_ENABLE_JIT
+  /* JITed code takes the start state, but the keyword filter rejects
+   * when fewer bytes than the keyword are left. */
+  if (olevel_ >= Regen::Options::O1 && !flag_.filtered_match()) {
+    Regen::StringPiece string_(string);
+    return CompiledMatch(string_._udata(), matchptr, state);
+  }
+#endif
+  const bool shortest = !flag_.suffix_match() && flag_.shortest_match();
+  for (const unsigned char *p = string.ubegin(); p != string.uend(); ) {
+    state_t next = transition_[state][*p++];
+    if (next == UNDEF) next = OnTheFlyTransition(state, *(p-1));
+    if (next == REJECT) return REJECT;
+    state = next;
+    if (IsAcceptState(state)) {
+      *matchptr = p;
+      if (shortest) break;
+    }
+  }
+  return state;
+}
+
+/* run DFA over the whole string (or until rejected), returns the last state. */
+DFA::state_t DFA::Run(const Regen::StringPiece& string) const
+{
+  Regen::StringPiece string_(string);
+  int sign = 1;
+  if (flag_.reverse_match()) {
+    sign = -1;
+    string_.reverse();
+  }
+  state_t state = 0;
+
+  if (complete_ && olevel_ >= Regen::Options::O1) {
+    /* JITed matching */
+    const unsigned char *matchptr = NULL;
+    state = CompiledMatch(string_._udata(), &matchptr, state);
+  } else if (complete_) {
+    while (!string_.empty() && (state = transition_[state][*string_.udata()]) != DFA::REJECT) {
+      string_.consume(sign);
+    }
+  } else {
+    state = OnTheFlyInit();
+    while (!string_.empty()) {
+      state_t next = transition_[state][*string_.udata()];
+      if (next == UNDEF) next = OnTheFlyTransition(state, *string_.udata());
       state = next;
+      if (state == REJECT) break;
+      string_.consume(sign);
     }
   }
 
-  if (IsAcceptState(state)) return true;
-  if (str == end && state != REJECT) {
-    Subset endstates = nfa_map_[state];
-    ExpandStates(&endstates, str == string.ubegin(), true);
-    return ContainAcceptState(endstates);
+  return state;
+}
+
+/* ids of accepted patterns (EOP ids) are stored into ids in ascending order. */
+bool DFA::MultiMatch(const Regen::StringPiece& string, std::vector<std::size_t>* ids) const
+{
+  state_t state = Run(string);
+  if (state == REJECT) return false;
+
+  std::set<std::size_t> accept_ids = states_[state].accept_ids;
+  std::map<state_t, Subset>::const_iterator iter = nfa_map_.find(state);
+  if (iter != nfa_map_.end()) {
+    /* $ is satisfied at the end of input. */
+    Subset endstates = iter->second;
+    ExpandStates(&endstates, string.empty(), true);
+    FillAcceptIDs(endstates, &accept_ids);
   }
-  return false;
+  if (ids != NULL) ids->assign(accept_ids.begin(), accept_ids.end());
+  return !accept_ids.empty();
+}
+
+/* accept or not, when input was terminated at the state.
+ * ($ is satisfied at the end of input.) */
+bool DFA::IsAcceptAtEnd(state_t state, bool begline) const
+{
+  if (state == REJECT) return false;
+  if (IsAcceptState(state)) return true;
+  std::map<state_t, Subset>::const_iterator iter = nfa_map_.find(state);
+  if (iter == nfa_map_.end()) return false;
+  Subset endstates = iter->second;
+  ExpandStates(&endstates, begline, true);
+  return ContainAcceptState(endstates);
 }
 
 } // namespace regen
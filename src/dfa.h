@@ -66,6 +66,7 @@ public:
     bool accept;
     bool endline;
     state_t id;
+    std::set<std::size_t> accept_ids;
     std::set<state_t> dst_states;
     std::set<state_t> src_states;
     AlterTrans alter_transition;
@@ -107,11 +108,14 @@ public:
   bool IsAcceptState(std::size_t state) const { return state == REJECT ? false : states_[state].accept; }
   bool IsEndlineState(std::size_t state) const { return state == REJECT ? false : states_[state].endline; }
   bool IsAcceptOrEndlineState(std::size_t state)  const { return IsAcceptState(state) | IsEndlineState(state); }
+  bool IsAcceptAtEnd(state_t state, bool begline = false) const;
 
   bool ContainAcceptState(const Subset&) const;
+  void FillAcceptIDs(const Subset&, std::set<std::size_t>*) const;
   void ExpandStates(Subset*, bool begline = false, bool endline = false) const;
   void FillTransition(StateExpr*, std::vector<Subset>*) const;
   void MakeNonGreedy(StateExpr*) const;
+  void CompleteNonGreedy(const std::vector<StateExpr*> &states) const;
   void TrimNonGreedy(Subset*) const;
 
   void Complementify();
@@ -119,6 +123,11 @@ public:
   bool Compile(Regen::Options::CompileFlag olevel = Regen::Options::O2);
   virtual bool OnTheFlyMatch(const Regen::StringPiece& string, Regen::StringPiece* result = NULL) const;
   virtual bool Match(const Regen::StringPiece& string, Regen::StringPiece* result = NULL) const;
+  bool MultiMatch(const Regen::StringPiece& string, std::vector<std::size_t>* ids = NULL) const;
+  state_t Run(const Regen::StringPiece& string) const;
+  /* resumable matching for chunked input: runs from state over string,
+   * *matchptr receives the end of the last acceptance in string (or NULL). */
+  state_t Resume(state_t state, const Regen::StringPiece& string, const unsigned char** matchptr) const;
   void state2label(state_t state, char* labelbuf) const;
 
   bool Construct(std::size_t limit = std::numeric_limits<size_t>::max());
@@ -142,6 +151,9 @@ protected:
   bool minimum_;
   Regen::Options flag_;
   void Finalize();
+  void Clear();
+  state_t OnTheFlyInit() const;
+  state_t OnTheFlyTransition(state_t state, unsigned char c) const;
   state_t (*CompiledMatch)(const unsigned char**, const unsigned char**, state_t);
   bool EliminateBranch();
   bool Reduce();
@@ -9,7 +9,8 @@ const char* Expr::TypeString(Expr::Type type)
     "Anchor", "EOP", "Operator",
     "Concat", "Union", "Intersection", "XOR",
     "Qmark", "Star", "Plus",
-    "Epsilon", "None"
+    "Epsilon", "None", "Repetition",
+    "Interleave", "Permute"
   };
 
   return type_strings[type];
@@ -31,22 +32,460 @@ Expr::SuperType Expr::SuperTypeOf(Expr *e)
     case kAnchor: case kEOP: case kOperator:
     case kEpsilon: case kNone:
       return kStateExpr;
-    case kConcat: case kUnion: case kIntersection: case kXOR:
+    case kConcat: case kUnion: case kIntersection: case kXOR: case kInterleave:
       return kBinaryExpr;
     default: case kQmark: case kStar: case kPlus:
       return kUnaryExpr;
   }
 }
 
-void Expr::Connect(std::set<StateExpr*> &src, std::set<StateExpr*> &dst)
+/* nodes larger than a quarter of a chunk get their own chunk. */
+static const std::size_t EXPR_CHUNK_SIZE = 64 * 1024;
+
+static std::size_t Aligned(std::size_t size)
+{
+  static const std::size_t align = 2 * sizeof(void*);
+  return (size + align - 1) & ~(align - 1);
+}
+
+void* ExprPool::allocate(std::size_t size)
+{
+  size = Aligned(size);
+  if (size > EXPR_CHUNK_SIZE / 4) {
+    char *chunk = new char[size];
+    chunks_.push_back(chunk);
+    return chunk;
+  }
+  if ((std::size_t)(end_ - ptr_) < size) {
+    ptr_ = new char[EXPR_CHUNK_SIZE];
+    end_ = ptr_ + EXPR_CHUNK_SIZE;
+    chunks_.push_back(ptr_);
+  }
+  void *p = ptr_;
+  ptr_ += size;
+  return p;
+}
+
+template<class T> static void AppendKey(std::string *key, T value)
+{
+  key->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+/* type, attributes and children of e, false if e must stay distinct
+ * (EOP and Operators are told apart by address, Intersections, XORs and
+ * products hold Operators or positions of their own). */
+static bool ShareKey(Expr *e, std::string *key)
+{
+  AppendKey(key, e->type());
+  if (Expr::SuperTypeOf(e) == Expr::kStateExpr) {
+    AppendKey(key, static_cast<StateExpr*>(e)->non_greedy());
+  } else if (Expr::SuperTypeOf(e) == Expr::kUnaryExpr) {
+    AppendKey(key, static_cast<UnaryExpr*>(e)->lhs());
+    AppendKey(key, static_cast<UnaryExpr*>(e)->probability());
+  }
+  switch (e->type()) {
+    case Expr::kLiteral: AppendKey(key, static_cast<Literal*>(e)->literal()); break;
+    case Expr::kCharClass: {
+      CharClass *cc = static_cast<CharClass*>(e);
+      AppendKey(key, cc->negative());
+      for (std::size_t c = 0; c < 256; c++) key->push_back(cc->table()[c] ? '1' : '0');
+      break;
+    }
+    case Expr::kDot: AppendKey(key, static_cast<Dot*>(e)->match_delimiter()); break;
+    case Expr::kAnchor: AppendKey(key, static_cast<Anchor*>(e)->atype()); break;
+    case Expr::kEpsilon: case Expr::kNone: break;
+    case Expr::kConcat: case Expr::kUnion:
+      AppendKey(key, static_cast<BinaryExpr*>(e)->lhs());
+      AppendKey(key, static_cast<BinaryExpr*>(e)->rhs());
+      break;
+    case Expr::kQmark: AppendKey(key, static_cast<Qmark*>(e)->non_greedy()); break;
+    case Expr::kStar: AppendKey(key, static_cast<Star*>(e)->non_greedy()); break;
+    case Expr::kPlus: break;
+    case Expr::kRepetition: {
+      Repetition *r = static_cast<Repetition*>(e);
+      AppendKey(key, r->min());
+      AppendKey(key, r->max());
+      AppendKey(key, r->non_greedy());
+      AppendKey(key, r->reverse());
+      break;
+    }
+    default: return false;
+  }
+  return true;
+}
+
+/* e was just allocated: if an equal node exists, e is destructed (and its
+ * space given back) in favor of it. */
+Expr* ExprPool::Share(Expr *e, std::size_t size)
+{
+  std::string key;
+  if (!ShareKey(e, &key)) return e;
+  std::pair<std::map<std::string, Expr*>::iterator, bool> found = shared_.insert(std::make_pair(key, e));
+  if (found.second) return e;
+  Expr *shared = found.first->second, *children[2];
+  std::size_t n = 0;
+  if (Expr::SuperTypeOf(e) == Expr::kBinaryExpr) {
+    children[n++] = static_cast<BinaryExpr*>(e)->lhs();
+    children[n++] = static_cast<BinaryExpr*>(e)->rhs();
+  } else if (Expr::SuperTypeOf(e) == Expr::kUnaryExpr) {
+    children[n++] = static_cast<UnaryExpr*>(e)->lhs();
+  }
+  for (std::size_t i = 0; i < n; i++) children[i]->set_parent(shared);
+  if (nodes_.back() == e && ptr_ == reinterpret_cast<char*>(e) + Aligned(size)) {
+    nodes_.pop_back();
+    e->~Expr();
+    ptr_ = reinterpret_cast<char*>(e);
+  }
+  return shared;
+}
+
+void ExprPool::drain(ExprPool *p)
+{
+  nodes_.insert(nodes_.end(), p->nodes_.begin(), p->nodes_.end());
+  chunks_.insert(chunks_.end(), p->chunks_.begin(), p->chunks_.end());
+  shared_.insert(p->shared_.begin(), p->shared_.end());
+  p->nodes_.clear();
+  p->chunks_.clear();
+  p->shared_.clear();
+  p->ptr_ = p->end_ = NULL;
+}
+
+void ExprPool::clear()
+{
+  for (std::size_t i = nodes_.size(); i > 0; i--) {
+    nodes_[i-1]->~Expr();
+  }
+  for (std::size_t i = 0; i < chunks_.size(); i++) {
+    delete[] chunks_[i];
+  }
+  nodes_.clear();
+  chunks_.clear();
+  shared_.clear();
+  ptr_ = end_ = NULL;
+}
+
+void PositionSet::iterator::Next()
+{
+  leaf_ = NULL;
+  while (depth_ > 0) {
+    const Node *n = Pop();
+    if (n->lhs == NULL) {
+      leaf_ = n;
+      return;
+    }
+    Push(n->rhs);
+    Push(n->lhs);
+  }
+}
+
+/* root_ becomes (root_ n). */
+void PositionSet::Join(Node *n, ExprPool *p)
+{
+  if (root_ == NULL) {
+    root_ = n;
+  } else {
+    Node *join = p->node();
+    join->lhs = root_;
+    join->rhs = n;
+    root_ = join;
+  }
+}
+
+void PositionSet::insert(StateExpr *s, ExprPool *p)
+{
+  Join(s->leaf(), p);
+}
+
+/* s already joined last (as Connect of nested loops does) is not joined
+ * again, to keep follow sets from doubling. */
+void PositionSet::insert(const PositionSet &s, ExprPool *p)
+{
+  if (s.root_ == NULL || s.root_ == root_) return;
+  if (root_ != NULL && root_->lhs != NULL && root_->rhs == s.root_) return;
+  Join(s.root_, p);
+}
+
+void Expr::Connect(PositionSet &src, PositionSet &dst, ExprPool *p)
+{
+  for (PositionSet::iterator iter = src.begin(); iter != src.end(); ++iter) {
+    (*iter)->follow().insert(dst, p);
+  }
+}
+
+std::size_t Expr::Children(Expr **children)
+{
+  switch (type()) {
+    case kConcat: case kUnion: case kIntersection: case kXOR: case kInterleave:
+      children[0] = static_cast<BinaryExpr*>(this)->lhs();
+      children[1] = static_cast<BinaryExpr*>(this)->rhs();
+      return 2;
+    case kQmark: case kStar: case kPlus: case kPermute:
+      children[0] = static_cast<UnaryExpr*>(this)->lhs();
+      return 1;
+    case kRepetition:
+      children[0] = static_cast<Repetition*>(this)->expanded();
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+void Expr::NonGreedify()
+{
+  std::vector<Expr*> stack(1, this);
+  while (!stack.empty()) {
+    Expr *e = stack.back(), *children[2];
+    stack.pop_back();
+    if (SuperTypeOf(e) == kStateExpr) static_cast<StateExpr*>(e)->set_root_non_greedy(true);
+    std::vector<StateExpr*> *positions = ProductPositions(e);
+    if (positions != NULL) stack.insert(stack.end(), positions->begin(), positions->end());
+    std::size_t n = e->Children(children);
+    stack.insert(stack.end(), children, children + n);
+  }
+}
+
+std::vector<StateExpr*>* Expr::ProductPositions(Expr *e)
+{
+  switch (e->type()) {
+    case kInterleave: return &static_cast<Interleave*>(e)->positions();
+    case kPermute: return &static_cast<Permute*>(e)->positions();
+    case kIntersection: {
+      Intersection *i = static_cast<Intersection*>(e);
+      return i->product().empty() ? NULL : &i->positions();
+    }
+    case kXOR: {
+      XOR *x = static_cast<XOR*>(e);
+      return x->product().empty() ? NULL : &x->positions();
+    }
+    default: return NULL;
+  }
+}
+
+void Expr::StateExprs(std::vector<StateExpr*> *states)
+{
+  std::vector<Expr*> stack(1, this);
+  while (!stack.empty()) {
+    Expr *e = stack.back(), *children[2];
+    stack.pop_back();
+    if (SuperTypeOf(e) == kStateExpr) states->push_back(static_cast<StateExpr*>(e));
+    std::vector<StateExpr*> *positions = ProductPositions(e);
+    if (positions != NULL) {
+      /* the positions of the operands are only copied. */
+      states->insert(states->end(), positions->begin(), positions->end());
+      continue;
+    }
+    std::size_t n = e->Children(children);
+    while (n > 0) stack.push_back(children[--n]);
+  }
+}
+
+struct PositionFrame {
+  PositionFrame(Expr *e_, ExprInfo *info_): e(e_), info(info_), lhs_info(NULL), xor_num(0), visited(false) {}
+  Expr *e;
+  ExprInfo *info;
+  ExprInfo *lhs_info; // the lhs of an intersection numbers its XORs apart
+  std::size_t xor_num;
+  bool visited;
+};
+
+struct KeywordsFrame {
+  KeywordsFrame(Expr *e_, Keywords *key_): e(e_), key(key_), rhs_key(NULL), visited(false) {}
+  Expr *e;
+  Keywords *key;
+  Keywords *rhs_key;
+  bool visited;
+};
+
+/* post-order, subexpressions from left to right. */
+void Expr::FillPosition(ExprInfo *info)
+{
+  std::vector<PositionFrame> stack(1, PositionFrame(this, info));
+  while (!stack.empty()) {
+    PositionFrame f = stack.back();
+    if (f.visited) {
+      stack.pop_back();
+      if (f.lhs_info != NULL) {
+        f.info->xor_num += f.lhs_info->xor_num - f.xor_num;
+        delete f.lhs_info;
+      }
+      f.e->FillPositionNode(f.info);
+      continue;
+    }
+    Expr *children[2];
+    std::size_t n = f.e->Children(children);
+    ExprInfo *lhs_info = f.info;
+    if (f.e->type() == kIntersection) {
+      lhs_info = stack.back().lhs_info = new ExprInfo(*f.info);
+      stack.back().xor_num = f.info->xor_num;
+    }
+    stack.back().visited = true;
+    if (n == 2) stack.push_back(PositionFrame(children[1], f.info));
+    if (n >= 1) stack.push_back(PositionFrame(children[0], lhs_info));
+  }
+}
+
+/* pre-order, rhs before lhs. */
+void Expr::FillTransition(ExprPool *p)
+{
+  std::vector<Expr*> stack(1, this);
+  while (!stack.empty()) {
+    Expr *e = stack.back(), *children[2];
+    stack.pop_back();
+    /* product nodes fill the follow of their operands with their positions. */
+    if (ProductPositions(e) != NULL) continue;
+    std::size_t n = e->Children(children);
+    switch (e->type()) {
+      case kConcat:
+        Connect(children[0]->last(), children[1]->first(), p);
+        break;
+      case kStar: case kPlus:
+        Connect(children[0]->last(), children[0]->first(), p);
+        break;
+      default:
+        break;
+    }
+    stack.insert(stack.end(), children, children + n);
+  }
+}
+
+/* post-order, rhs before lhs: the lhs goes on with key, while the rhs of a
+ * concatenation (union) fills its own keywords, merged by the node. */
+void Expr::FillKeywords(Keywords *key, std::bitset<256> *involve)
+{
+  std::vector<KeywordsFrame> stack(1, KeywordsFrame(this, key));
+  while (!stack.empty()) {
+    KeywordsFrame f = stack.back();
+    if (f.visited) {
+      stack.pop_back();
+      f.e->FillKeywordsNode(f.key, f.rhs_key, involve);
+      delete f.rhs_key;
+      continue;
+    }
+    stack.back().visited = true;
+    switch (f.e->type()) {
+      case kConcat: case kUnion: {
+        BinaryExpr *b = static_cast<BinaryExpr*>(f.e);
+        Keywords *rhs_key = f.key != NULL ? new Keywords() : NULL;
+        stack.back().rhs_key = rhs_key;
+        stack.push_back(KeywordsFrame(b->lhs(), f.key));
+        stack.push_back(KeywordsFrame(b->rhs(), rhs_key));
+        break;
+      }
+      case kQmark: case kStar:
+        stack.push_back(KeywordsFrame(static_cast<UnaryExpr*>(f.e)->lhs(), NULL));
+        break;
+      case kPlus:
+        stack.push_back(KeywordsFrame(static_cast<UnaryExpr*>(f.e)->lhs(), f.key));
+        break;
+      case kRepetition:
+        stack.push_back(KeywordsFrame(static_cast<Repetition*>(f.e)->expanded(), f.key));
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+/* post-order, clones of the subexpressions are kept on a stack. */
+Expr* Expr::CloneTree(Expr *root, ExprPool *p)
+{
+  std::vector<std::pair<Expr*, bool> > stack(1, std::make_pair(root, false));
+  std::vector<Expr*> clones;
+  while (!stack.empty()) {
+    Expr *e = stack.back().first;
+    if (SuperTypeOf(e) == kStateExpr) {
+      stack.pop_back();
+      clones.push_back(e->Clone(p));
+      continue;
+    }
+    if (!stack.back().second) {
+      stack.back().second = true;
+      if (SuperTypeOf(e) == kBinaryExpr) {
+        BinaryExpr *b = static_cast<BinaryExpr*>(e);
+        if (e->type() == kIntersection || e->type() == kXOR) {
+          /* operands, without the operators concatenated to them. */
+          stack.push_back(std::make_pair(static_cast<BinaryExpr*>(b->rhs())->lhs(), false));
+          stack.push_back(std::make_pair(static_cast<BinaryExpr*>(b->lhs())->lhs(), false));
+        } else {
+          stack.push_back(std::make_pair(b->rhs(), false));
+          stack.push_back(std::make_pair(b->lhs(), false));
+        }
+      } else {
+        stack.push_back(std::make_pair(static_cast<UnaryExpr*>(e)->lhs(), false));
+      }
+      continue;
+    }
+    stack.pop_back();
+    Expr *rhs = NULL, *lhs;
+    if (SuperTypeOf(e) == kBinaryExpr) {
+      rhs = clones.back();
+      clones.pop_back();
+    }
+    lhs = clones.back();
+    clones.pop_back();
+    switch (e->type()) {
+      case kConcat: clones.push_back(p->alloc<Concat>(lhs, rhs)); break;
+      case kUnion: clones.push_back(p->alloc<Union>(lhs, rhs)); break;
+      case kIntersection: {
+        Intersection *i = p->alloc<Intersection>(lhs, rhs, p);
+        i->set_product(static_cast<Intersection*>(e)->product());
+        clones.push_back(i);
+        break;
+      }
+      case kXOR: {
+        XOR *x = p->alloc<XOR>(lhs, rhs, p);
+        x->set_product(static_cast<XOR*>(e)->product());
+        clones.push_back(x);
+        break;
+      }
+      case kInterleave: clones.push_back(p->alloc<Interleave>(lhs, rhs, p)); break;
+      case kPermute: clones.push_back(p->alloc<Permute>(lhs, p)); break;
+      case kQmark: {
+        Qmark *q = static_cast<Qmark*>(e);
+        clones.push_back(p->alloc<Qmark>(lhs, q->non_greedy(), q->probability()));
+        break;
+      }
+      case kStar: {
+        Star *s = static_cast<Star*>(e);
+        clones.push_back(p->alloc<Star>(lhs, s->non_greedy(), s->probability()));
+        break;
+      }
+      case kPlus:
+        clones.push_back(p->alloc<Plus>(lhs, static_cast<Plus*>(e)->probability()));
+        break;
+      case kRepetition: {
+        Repetition *r = static_cast<Repetition*>(e);
+        Repetition *c = p->alloc<Repetition>(lhs, std::make_pair(r->min(), r->max()), r->non_greedy(), r->reverse(), p);
+        c->set_probability(r->probability());
+        clones.push_back(c);
+        break;
+      }
+      default: exitmsg("Invalid Expr Type: %d", e->type());
+    }
+  }
+  return clones.back();
+}
+
+/* true if e contains operators (of intersections, XORs and back-references):
+ * they are paired by the DFA, so their positions can't be copied into products. */
+bool Expr::HasOperator(Expr *e)
 {
-  for (std::set<StateExpr*>::iterator iter = src.begin(); iter != src.end(); ++iter) {
-    (*iter)->follow().insert(dst.begin(), dst.end());
+  std::vector<Expr*> stack(1, e);
+  while (!stack.empty()) {
+    Expr *f = stack.back(), *children[2];
+    stack.pop_back();
+    if (f->type() == kOperator) return true;
+    std::size_t n = f->Children(children);
+    stack.insert(stack.end(), children, children + n);
   }
+  return false;
 }
 
+/* R||S as a product automaton (Interleave), or, if R or S contains operators,
+ * as the union of the interleavings of their factors. */
 Expr* Expr::Shuffle(Expr *lhs, Expr *rhs, ExprPool *p)
 {
+  if (!HasOperator(lhs) && !HasOperator(rhs)) return p->alloc<Interleave>(lhs, rhs, p);
   Expr *e = NULL;
   std::vector<Expr *> ls, rs;
   ExprPool tmp_pool;
@@ -103,9 +542,28 @@ void Expr::_Shuffle(std::vector<Expr*>& lfac, std::size_t il, std::vector<Expr*>
   }
 }
 
+/* items of a permutation: up to 2^(MAX_PERMUTATION-1) copies of their positions. */
+static const std::size_t MAX_PERMUTATION = 16;
+
+/* #R as the union of subset constructions (Permute) over the factors of each
+ * alternative of R, or, if R contains operators, of the concatenations of
+ * the factors in every order. */
 Expr* Expr::Permutation(Expr *e, ExprPool *p)
 {
   std::vector<Expr*> es;
+  if (!HasOperator(e)) {
+    e->Serialize(es, p);
+    e = NULL;
+    for (std::vector<Expr*>::iterator iter = es.begin(); iter != es.end(); ++iter) {
+      std::vector<Expr*> fac;
+      (*iter)->Factorize(fac);
+      if (fac.size() > MAX_PERMUTATION) exitmsg("Too many items to permute (max: %d).", (int)MAX_PERMUTATION);
+      Expr *perm = p->alloc<Permute>(*iter, p);
+      e = e == NULL ? perm : p->alloc<Union>(e, perm);
+    }
+    return e;
+  }
+
   ExprPool tmp_pool;
   e->Serialize(es, &tmp_pool);
   e = NULL;
@@ -115,6 +573,7 @@ Expr* Expr::Permutation(Expr *e, ExprPool *p)
     std::bitset<8> perm(false); //Maximum: 8! = 40320
 
     (*iter)->Factorize(fac);
+    if (fac.size() > perm.size()) exitmsg("Too many items to permute (max: %d).", (int)perm.size());
     for (std::size_t i = 0; i < fac.size(); i++) {
       perm[i] = true;
     }
@@ -154,7 +613,7 @@ void Expr::_Permutation(std::vector<Expr*> &v, std::bitset<8> &perm, std::vector
   }
 }
 
-void Literal::FillKeywords(Keywords *key, std::bitset<256> *involve)
+void Literal::FillKeywordsNode(Keywords *key, Keywords *, std::bitset<256> *involve)
 {
   if (key != NULL) {
     key->is.assign(1, literal_);
@@ -196,16 +655,13 @@ top:
   }
 }
 
-void CharClass::FillKeywords(Keywords *key, std::bitset<256> *involve)
+void CharClass::FillKeywordsNode(Keywords *, Keywords *, std::bitset<256> *involve)
 {
-  *involve = table_;
-  if (negative_) involve->flip();
-  if (key != NULL) {
-    for (std::size_t i = 0; i < 256; i++) {
-      if (involve->test(i)) {
-        key->in.insert(std::string(1, i));
-      }
-    }
+  /* none of characters is required, so no keywords. */
+  if (negative_) {
+    *involve |= ~table_;
+  } else {
+    *involve |= table_;
   }
 }
 
@@ -266,14 +722,9 @@ void Dot::Generate(std::set<std::string> &g, GenOpt opt, std::size_t n)
   Trim(g, opt, n);
 }
 
-void Dot::FillKeywords(Keywords *key, std::bitset<256> *involve)
+void Dot::FillKeywordsNode(Keywords *, Keywords *, std::bitset<256> *involve)
 {
   involve->set();
-  if (key != NULL) {
-    for (std::size_t i = 0; i < 256; i++) {
-      key->in.insert(std::string(1, i));
-    }
-  }
 }
 
 void Operator::PatchBackRef(Expr *patch, std::size_t i, ExprPool *p)
@@ -308,11 +759,8 @@ void Operator::PatchBackRef(Expr *patch, std::size_t i, ExprPool *p)
   }
 }
 
-void Concat::FillPosition(ExprInfo *info)
+void Concat::FillPositionNode(ExprInfo *info)
 {
-  lhs_->FillPosition(info);
-  rhs_->FillPosition(info);
-
   if (lhs_->max_length() == std::numeric_limits<size_t>::max()
       || rhs_->max_length() == std::numeric_limits<size_t>::max()) {
     max_length_ = std::numeric_limits<size_t>::max();
@@ -326,30 +774,20 @@ void Concat::FillPosition(ExprInfo *info)
   first() = lhs_->first();
 
   if (lhs_->nullable() && lhs_ != info->copied_root) {
-    first().insert(rhs_->first().begin(), rhs_->first().end());
+    first().insert(rhs_->first(), info->pool);
   }
 
   last() = rhs_->last();
 
   if (rhs_->nullable()) {
-    last().insert(lhs_->last().begin(), lhs_->last().end());
+    last().insert(lhs_->last(), info->pool);
   }
 }
 
-void Concat::FillTransition()
-{
-  Connect(lhs_->last(), rhs_->first());
-  rhs_->FillTransition();
-  lhs_->FillTransition();
-}
-
-void Concat::FillKeywords(Keywords *key, std::bitset<256> *involve)
+void Concat::FillKeywordsNode(Keywords *key, Keywords *rhs_key, std::bitset<256> *)
 {
   if (key != NULL) {
-    Keywords key_;
-    rhs_->FillKeywords(&key_, involve);
-    lhs_->FillKeywords(key, involve);
-
+    Keywords &key_ = *rhs_key;
     key->in.insert(key_.in.begin(), key_.in.end());
     if (key_.left != "" && key->right != "") {
       key->in.erase(key->right);
@@ -357,16 +795,15 @@ void Concat::FillKeywords(Keywords *key, std::bitset<256> *involve)
       key->in.insert(key->right+key_.left);
     }
 
-    key->right = key_.right;
+    /* prefix (suffix) extends over the whole literal lhs (rhs). */
+    if (key->is != "") key->left = key->is + key_.left;
+    key->right = key_.is != "" ? key->right + key_.is : key_.right;
     
     if (key->is != "" && key_.is != "") {
-      key->is = key->right = key->left = key->is + key_.is;
+      key->is = key->is + key_.is;
     } else {
       key->is.assign("");
     }
-  } else {
-    rhs_->FillKeywords(NULL, involve);
-    lhs_->FillKeywords(NULL, involve);
   }
 }
 
@@ -405,35 +842,24 @@ void Concat::Generate(std::set<std::string> &g, GenOpt opt, std::size_t n)
   Trim(g, opt, n);
 }
 
-void Union::FillPosition(ExprInfo *info)
+void Union::FillPositionNode(ExprInfo *info)
 {
-  lhs_->FillPosition(info);
-  rhs_->FillPosition(info);
-  
   max_length_ = std::max(lhs_->max_length(), rhs_->max_length());
   min_length_ = std::min(lhs_->min_length(), rhs_->min_length());
   nullable_ = lhs_->nullable() || rhs_->nullable();
 
   first() = lhs_->first();
-  first().insert(rhs_->first().begin(), rhs_->first().end());
+  first().insert(rhs_->first(), info->pool);
 
   last() = lhs_->last();
-  last().insert(rhs_->last().begin(), rhs_->last().end());
-}
-
-void Union::FillTransition()
-{
-  rhs_->FillTransition();
-  lhs_->FillTransition();
+  last().insert(rhs_->last(), info->pool);
 }
 
-void Union::FillKeywords(Keywords *key, std::bitset<256> *involve)
+void Union::FillKeywordsNode(Keywords *key, Keywords *rhs_key, std::bitset<256> *)
 {
   if (key != NULL) {
-    Keywords key_;
+    Keywords &key_ = *rhs_key;
     std::size_t i;
-    rhs_->FillKeywords(&key_, involve);
-    lhs_->FillKeywords(key, involve);
 
     if (!key->no_candidates && !key_.no_candidates) {
       if ((key->candidates.empty() && key->in.empty()) ||
@@ -479,12 +905,9 @@ void Union::FillKeywords(Keywords *key, std::bitset<256> *involve)
 
     std::size_t min = std::min(key->right.size(), key_.right.size());
     for (i = 0; i < min; i++) {
-      if (key->right[min-i-1] != key_.right[min-i-1]) break;
+      if (key->right[key->right.size()-i-1] != key_.right[key_.right.size()-i-1]) break;
     }
-    key->right.assign(key_.right, min-i, i);
-  } else {
-    rhs_->FillKeywords(NULL, involve);
-    lhs_->FillKeywords(NULL, involve);
+    key->right.assign(key_.right, key_.right.size()-i, i);
   }
 }
 
@@ -509,8 +932,40 @@ void Union::Generate(std::set<std::string> &g, GenOpt opt, std::size_t n)
   Trim(g, opt, n);
 }
 
+/* positions of e from the edges of the automaton a: a position per pair of
+ * states with edges, which all the edges from a state share as follow. */
+static void FillAutomaton(const Automaton &a, Expr *e, std::vector<StateExpr*> *positions, ExprPool *p)
+{
+  std::vector<PositionSet> out(a.edges.size());
+  std::vector<std::pair<StateExpr*, std::size_t> > edges;
+  for (std::size_t s = 0; s < a.edges.size(); s++) {
+    for (std::size_t i = 0; i < a.edges[s].size(); i++) {
+      const Automaton::Edge &edge = a.edges[s][i];
+      StateExpr *position;
+      if (edge.bytes.count() == 256) {
+        position = p->alloc<Dot>();
+      } else if (edge.bytes.count() == 1) {
+        std::size_t c = 0;
+        while (!edge.bytes[c]) c++;
+        position = p->alloc<Literal>((unsigned char)c);
+      } else {
+        position = p->alloc<CharClass>(edge.bytes);
+      }
+      position->FillPositionNode(NULL);
+      positions->push_back(position);
+      edges.push_back(std::make_pair(position, edge.next));
+      out[s].insert(position, p);
+      if (a.accept[edge.next]) e->last().insert(position, p);
+    }
+  }
+  for (std::size_t i = 0; i < edges.size(); i++) {
+    edges[i].first->follow() = out[edges[i].second];
+  }
+  e->first() = out[0];
+}
+
 Intersection::Intersection(Expr *lhs, Expr *rhs, ExprPool *p):
-    BinaryExpr(lhs, rhs)
+    BinaryExpr(lhs, rhs), pool_(p)
 {
   Operator::NewPair(&lop_, &rop_, Operator::kIntersection, p);
   lhs__ = lhs_; rhs__ = rhs_;
@@ -520,29 +975,22 @@ Intersection::Intersection(Expr *lhs, Expr *rhs, ExprPool *p):
   rhs_->set_parent(this);
 }
 
-void Intersection::FillPosition(ExprInfo* info)
+void Intersection::FillPositionNode(ExprInfo *)
 {
-  ExprInfo tmp_info = *info;
-  std::size_t xor_num = info->xor_num;
-  lhs_->FillPosition(&tmp_info);
-  rhs_->FillPosition(info);
-  info->xor_num += tmp_info.xor_num - xor_num;
-
   nullable_ = lhs__->nullable() & rhs__->nullable();
   max_length_ = std::min(lhs__->max_length(), rhs__->max_length());
   min_length_ = std::max(lhs__->min_length(), rhs__->min_length());
 
+  if (!product_.empty()) {
+    FillAutomaton(product_, this, &positions_, pool_);
+    return;
+  }
+
   first() = lhs_->first();
-  first().insert(rhs_->first().begin(), rhs_->first().end());
+  first().insert(rhs_->first(), pool_);
 
   last() = lhs_->last();
-  last().insert(rhs_->last().begin(), rhs_->last().end());
-}
-
-void Intersection::FillTransition()
-{
-  rhs_->FillTransition();
-  lhs_->FillTransition();
+  last().insert(rhs_->last(), pool_);
 }
 
 void Intersection::Generate(std::set<std::string> &g, GenOpt opt, std::size_t n)
@@ -560,12 +1008,8 @@ void Intersection::Generate(std::set<std::string> &g, GenOpt opt, std::size_t n)
   Trim(g, opt, n);
 }
 
-void Intersection::FillKeywords(Keywords *key, std::bitset<256> *)
-{
-}
-
 XOR::XOR(Expr* lhs, Expr* rhs, ExprPool *p):
-    BinaryExpr(lhs, rhs)
+    BinaryExpr(lhs, rhs), pool_(p)
 {
   Operator::NewPair(&lop_, &rop_, Operator::kXOR, p);
   lhs__ = lhs_; rhs__ = rhs_;
@@ -575,11 +1019,8 @@ XOR::XOR(Expr* lhs, Expr* rhs, ExprPool *p):
   rhs_->set_parent(this);
 }
 
-void XOR::FillPosition(ExprInfo *info)
+void XOR::FillPositionNode(ExprInfo *info)
 {
-  lhs_->FillPosition(info);
-  rhs_->FillPosition(info);
-
   nullable_ = lhs__->nullable() ^ rhs__->nullable();
   max_length_ = std::max(lhs__->max_length(), rhs__->max_length());
   if (lhs__->min_length() == 0 && rhs__->min_length() == 0) {
@@ -587,24 +1028,23 @@ void XOR::FillPosition(ExprInfo *info)
   } else {
     min_length_ = std::min(lhs_->min_length(), rhs_->min_length());
   }
-  
+
+  if (!product_.empty()) {
+    FillAutomaton(product_, this, &positions_, pool_);
+    return;
+  }
+
   first() = lhs_->first();
-  first().insert(rhs_->first().begin(), rhs_->first().end());
+  first().insert(rhs_->first(), pool_);
 
   last() = lhs_->last();
-  last().insert(rhs_->last().begin(), rhs_->last().end());
+  last().insert(rhs_->last(), pool_);
 
   std::size_t id = info->xor_num++;
   lop_->set_id(id);
   rop_->set_id(id);
 }
 
-void XOR::FillTransition()
-{
-  rhs_->FillTransition();
-  lhs_->FillTransition();
-}
-
 void XOR::Generate(std::set<std::string> &g, GenOpt opt, std::size_t n)
 {
   std::set<std::string> h;
@@ -624,14 +1064,8 @@ void XOR::Generate(std::set<std::string> &g, GenOpt opt, std::size_t n)
   Trim(g, opt, n);
 }
 
-void XOR::FillKeywords(Keywords *key, std::bitset<256> *)
+void Qmark::FillPositionNode(ExprInfo *)
 {
-}
-
-void Qmark::FillPosition(ExprInfo *info)
-{
-  lhs_->FillPosition(info);
-  
   max_length_ = lhs_->min_length();
   min_length_ = 0;
   nullable_ = true;
@@ -640,16 +1074,6 @@ void Qmark::FillPosition(ExprInfo *info)
   if (non_greedy_) NonGreedify();
 }
 
-void Qmark::FillTransition()
-{
-  lhs_->FillTransition();
-}
-
-void Qmark::FillKeywords(Keywords *key, std::bitset<256> *involve)
-{
-  lhs_->FillKeywords(NULL, involve);
-}
-
 double frand()
 {
   double f = (double)rand() / RAND_MAX;
@@ -671,10 +1095,8 @@ void Qmark::Generate(std::set<std::string> &g, GenOpt opt, std::size_t n)
   Trim(g, opt, n);
 }
 
-void Star::FillPosition(ExprInfo *info)
+void Star::FillPositionNode(ExprInfo *)
 {
-  lhs_->FillPosition(info);
-
   max_length_ = std::numeric_limits<size_t>::max();
   min_length_ = 0;
   nullable_ = true;
@@ -683,17 +1105,6 @@ void Star::FillPosition(ExprInfo *info)
   if (non_greedy_) NonGreedify();
 }
 
-void Star::FillTransition()
-{
-  Connect(lhs_->last(), lhs_->first());
-  lhs_->FillTransition();
-}
-
-void Star::FillKeywords(Keywords *key, std::bitset<256> *involve)
-{
-  lhs_->FillKeywords(NULL, involve);
-}
-
 void Star::Generate(std::set<std::string> &g, GenOpt opt, std::size_t n)
 {
   if (probability_ != 0.0 && frand() < probability_) {
@@ -714,10 +1125,8 @@ void Star::Generate(std::set<std::string> &g, GenOpt opt, std::size_t n)
   Trim(g, opt, n);
 }
 
-void Plus::FillPosition(ExprInfo *info)
+void Plus::FillPositionNode(ExprInfo *)
 {
-  lhs_->FillPosition(info);
-
   max_length_ = std::numeric_limits<size_t>::max();
   min_length_ = lhs_->min_length();
   nullable_ = lhs_->nullable();
@@ -725,17 +1134,9 @@ void Plus::FillPosition(ExprInfo *info)
   last() = lhs_->last();
 }
 
-void Plus::FillTransition()
+void Plus::FillKeywordsNode(Keywords *key, Keywords *, std::bitset<256> *)
 {
-  Connect(lhs_->last(), lhs_->first());
-  lhs_->FillTransition();
-}
-
-void Plus::FillKeywords(Keywords *key, std::bitset<256> *involve)
-{
-  lhs_->FillKeywords(key, involve);
-
-  key->is.assign("");
+  if (key != NULL) key->is.assign("");
 }
 
 void Plus::Generate(std::set<std::string> &g, GenOpt opt, std::size_t n)
@@ -756,4 +1157,288 @@ void Plus::Generate(std::set<std::string> &g, GenOpt opt, std::size_t n)
   Trim(g, opt, n);
 }
 
+Expr* Repetition::expanded()
+{
+  if (expanded_ == NULL) {
+    expanded_ = Expand(lhs_, std::make_pair(min_, max_), non_greedy_, probability_, reverse_, pool_);
+    expanded_->set_parent(this);
+  }
+  return expanded_;
+}
+
+Expr* Repetition::Expand(Expr *e, std::pair<int, int> range, bool non_greedy, double probability, bool reverse, ExprPool *p)
+{
+  int lower_repetition = range.first, upper_repetition = range.second;
+  if (lower_repetition == 0 && upper_repetition == 0) {
+    e = p->alloc<Epsilon>();
+  } else if (upper_repetition == -1) {
+    Expr* f = e;
+    for (int i = 0; i < lower_repetition - 1; i++) {
+      e = p->alloc<Concat>(e, f->Clone(p), reverse);
+    }
+    e = p->alloc<Concat>(e, p->alloc<Star>(f->Clone(p), non_greedy, probability), reverse);
+  } else if (upper_repetition == lower_repetition) {
+    Expr *f;
+    if (probability == 0.0) {
+      f = e;
+    } else {
+      f = p->alloc<Qmark>(e, non_greedy, probability);
+    }
+    for (int i = 0; i < lower_repetition - 1; i++) {
+      e = p->alloc<Concat>(e, f->Clone(p), reverse);
+    }
+  } else {
+    Expr *f = e;
+    for (int i = 0; i < lower_repetition - 1; i++) {
+      e = p->alloc<Concat>(e, f->Clone(p), reverse);
+    }
+    if (lower_repetition == 0) {
+      e = p->alloc<Qmark>(e, non_greedy, probability);
+      lower_repetition++;
+    }
+    for (int i = 0; i < (upper_repetition - lower_repetition); i++) {
+      e = p->alloc<Concat>(e, p->alloc<Qmark>(f->Clone(p), non_greedy, probability), reverse);
+    }
+  }
+  return e;
+}
+
+void Repetition::FillPositionNode(ExprInfo *)
+{
+  Expr *e = expanded();
+  max_length_ = e->max_length();
+  min_length_ = e->min_length();
+  nullable_ = e->nullable();
+  first() = e->first();
+  last() = e->last();
+}
+
+/* positions of e which follow its position s (NULL: not started), without
+ * Epsilons and Nones (they never consume a byte). */
+static void NextPositions(Expr *e, StateExpr *s, std::vector<StateExpr*> *next)
+{
+  PositionSet &follow = s == NULL ? e->first() : s->follow();
+  std::set<StateExpr*> seen;
+  for (PositionSet::iterator i = follow.begin(); i != follow.end(); ++i) {
+    if ((*i)->type() == Expr::kEpsilon || (*i)->type() == Expr::kNone) continue;
+    if (seen.insert(*i).second) next->push_back(*i);
+  }
+}
+
+/* a copy of the position s of an operand, as a position of a product. */
+static StateExpr* CopyPosition(StateExpr *s, ExprPool *p)
+{
+  StateExpr *c = static_cast<StateExpr*>(s->Clone(p));
+  if (s->root_non_greedy()) c->set_root_non_greedy(true);
+  c->FillPositionNode(NULL);
+  return c;
+}
+
+static std::size_t SumLength(std::size_t l1, std::size_t l2)
+{
+  if (l1 == std::numeric_limits<size_t>::max() || l2 == std::numeric_limits<size_t>::max()) {
+    return std::numeric_limits<size_t>::max();
+  }
+  return l1 + l2;
+}
+
+typedef std::pair<StateExpr*, StateExpr*> InterleaveState; // of lhs and rhs (NULL: not started)
+
+/* the positions of the operands are filled, their follow is filled here.
+ * a position is a copy of the position just consumed in one operand, with
+ * the state of both, and all the positions of a state share its follow. */
+void Interleave::FillPositionNode(ExprInfo *)
+{
+  nullable_ = lhs_->nullable() && rhs_->nullable();
+  min_length_ = lhs_->min_length() + rhs_->min_length();
+  max_length_ = SumLength(lhs_->max_length(), rhs_->max_length());
+
+  Expr *operands[2] = { lhs_, rhs_ };
+  std::set<StateExpr*> finals[2];
+  for (int k = 0; k < 2; k++) {
+    operands[k]->FillTransition(pool_);
+    finals[k].insert(operands[k]->last().begin(), operands[k]->last().end());
+  }
+  std::map<std::pair<InterleaveState, int>, StateExpr*> copies;
+  std::map<InterleaveState, PositionSet> follows;
+  std::vector<InterleaveState> queue(1, InterleaveState(NULL, NULL));
+  follows[queue[0]];
+  for (std::size_t i = 0; i < queue.size(); i++) {
+    InterleaveState state = queue[i];
+    PositionSet &follow = follows[state];
+    for (int k = 0; k < 2; k++) {
+      std::vector<StateExpr*> next;
+      NextPositions(operands[k], k == 0 ? state.first : state.second, &next);
+      for (std::size_t j = 0; j < next.size(); j++) {
+        InterleaveState to = k == 0 ? InterleaveState(next[j], state.second) : InterleaveState(state.first, next[j]);
+        StateExpr *&copy = copies[std::make_pair(to, k)];
+        if (copy == NULL) {
+          copy = CopyPosition(next[j], pool_);
+          positions_.push_back(copy);
+          if (follows.find(to) == follows.end()) {
+            follows[to];
+            queue.push_back(to);
+          }
+          if ((to.first == NULL ? lhs_->nullable() : finals[0].count(to.first) != 0)
+              && (to.second == NULL ? rhs_->nullable() : finals[1].count(to.second) != 0)) {
+            last().insert(copy, pool_);
+          }
+        }
+        follow.insert(copy, pool_);
+      }
+    }
+  }
+  first() = follows[InterleaveState(NULL, NULL)];
+  for (std::map<std::pair<InterleaveState, int>, StateExpr*>::iterator i = copies.begin(); i != copies.end(); ++i) {
+    i->second->follow().insert(follows[i->first.first], pool_);
+  }
+}
+
+/* interleavings of the strings of lhs and rhs. */
+void Interleave::Generate(std::set<std::string> &g, GenOpt opt, std::size_t n)
+{
+  std::set<std::string> h, r;
+  lhs_->Generate(g);
+  rhs_->Generate(h);
+  for (std::set<std::string>::iterator i = g.begin(); i != g.end(); ++i) {
+    for (std::set<std::string>::iterator j = h.begin(); j != h.end(); ++j) {
+      /* interleavings of prefixes, one more byte of i or j at a time. */
+      std::vector<std::set<std::string> > prefixes(j->size() + 1);
+      prefixes[0].insert("");
+      for (std::size_t k = 1; k <= j->size(); k++) prefixes[k].insert(j->substr(0, k));
+      for (std::size_t a = 1; a <= i->size(); a++) {
+        std::vector<std::set<std::string> > next(j->size() + 1);
+        next[0].insert(i->substr(0, a));
+        for (std::size_t b = 1; b <= j->size(); b++) {
+          for (std::set<std::string>::iterator x = prefixes[b].begin(); x != prefixes[b].end(); ++x) {
+            next[b].insert(*x + (*i)[a-1]);
+          }
+          for (std::set<std::string>::iterator x = next[b-1].begin(); x != next[b-1].end(); ++x) {
+            next[b].insert(*x + (*j)[b-1]);
+          }
+        }
+        prefixes.swap(next);
+      }
+      r.insert(prefixes.back().begin(), prefixes.back().end());
+    }
+  }
+  g.swap(r);
+  Trim(g, opt, n);
+}
+
+/* states of a Permute: copies of the positions of the items, by the set of
+ * items passed (bits of a word, the item of the position is not passed). */
+struct PermuteStates {
+  typedef std::pair<std::size_t, StateExpr*> State;
+  PermuteStates(const std::vector<Expr*> &items_, std::vector<StateExpr*> *positions_, ExprPool *pool_):
+      items(items_), finals(items_.size()), all(((std::size_t)1 << items_.size()) - 1), nullables(0),
+      positions(positions_), pool(pool_) {}
+  StateExpr* Copy(std::size_t passed, StateExpr *s);
+  PositionSet& Enter(std::size_t passed);
+  const std::vector<Expr*> &items;
+  std::map<StateExpr*, std::size_t> item_of;
+  std::vector<std::set<StateExpr*> > finals;
+  std::size_t all, nullables;
+  std::map<State, StateExpr*> copies;
+  std::map<std::size_t, PositionSet> entries;
+  std::vector<State> queue; // copies whose follow is to be filled
+  std::vector<StateExpr*> *positions;
+  PositionSet last;
+  ExprPool *pool;
+};
+
+StateExpr* PermuteStates::Copy(std::size_t passed, StateExpr *s)
+{
+  StateExpr *&copy = copies[State(passed, s)];
+  if (copy == NULL) {
+    copy = CopyPosition(s, pool);
+    positions->push_back(copy);
+    queue.push_back(State(passed, s));
+    const std::size_t item = item_of[s], rest = all & ~(passed | (std::size_t)1 << item);
+    if (finals[item].count(s) && (rest & ~nullables) == 0) last.insert(copy, pool);
+  }
+  return copy;
+}
+
+/* positions which begin an item not passed, or (passing nullable items
+ * without a byte) an item not passed after them. */
+PositionSet& PermuteStates::Enter(std::size_t passed)
+{
+  std::map<std::size_t, PositionSet>::iterator found = entries.find(passed);
+  if (found != entries.end()) return found->second;
+  PositionSet entry;
+  const std::size_t skippable = nullables & ~passed;
+  for (std::size_t skipped = skippable; ; skipped = (skipped - 1) & skippable) {
+    const std::size_t p = passed | skipped;
+    for (std::size_t i = 0; i < items.size(); i++) {
+      if (p >> i & 1) continue;
+      std::vector<StateExpr*> next;
+      NextPositions(items[i], NULL, &next);
+      for (std::size_t j = 0; j < next.size(); j++) entry.insert(Copy(p, next[j]), pool);
+    }
+    if (skipped == 0) break;
+  }
+  return entries[passed] = entry;
+}
+
+void Permute::FillPositionNode(ExprInfo *)
+{
+  nullable_ = lhs_->nullable();
+  min_length_ = lhs_->min_length();
+  max_length_ = lhs_->max_length();
+
+  std::vector<Expr*> items;
+  lhs_->Factorize(items);
+  PermuteStates states(items, &positions_, pool_);
+  for (std::size_t i = 0; i < items.size(); i++) {
+    items[i]->FillTransition(pool_);
+    if (items[i]->nullable()) states.nullables |= (std::size_t)1 << i;
+    states.finals[i].insert(items[i]->last().begin(), items[i]->last().end());
+    std::vector<StateExpr*> s;
+    items[i]->StateExprs(&s);
+    for (std::size_t j = 0; j < s.size(); j++) states.item_of[s[j]] = i;
+  }
+  first() = states.Enter(0);
+  for (std::size_t i = 0; i < states.queue.size(); i++) {
+    const std::size_t passed = states.queue[i].first;
+    StateExpr *s = states.queue[i].second, *copy = states.copies[states.queue[i]];
+    const std::size_t item = states.item_of[s];
+    std::vector<StateExpr*> next;
+    NextPositions(items[item], s, &next);
+    for (std::size_t j = 0; j < next.size(); j++) copy->follow().insert(states.Copy(passed, next[j]), pool_);
+    if (states.finals[item].count(s)) copy->follow().insert(states.Enter(passed | (std::size_t)1 << item), pool_);
+  }
+  last() = states.last;
+}
+
+/* concatenations of the strings of the items, in every order
+ * (at most 8! orders, as many as enumerating the orders used to make). */
+void Permute::Generate(std::set<std::string> &g, GenOpt opt, std::size_t n)
+{
+  std::vector<Expr*> items;
+  lhs_->Factorize(items);
+  std::vector<std::set<std::string> > strings(items.size());
+  std::vector<std::size_t> order(items.size());
+  for (std::size_t i = 0; i < items.size(); i++) {
+    items[i]->Generate(strings[i]);
+    order[i] = i;
+  }
+  std::size_t orders = 0;
+  do {
+    std::set<std::string> r;
+    r.insert("");
+    for (std::size_t i = 0; i < order.size(); i++) {
+      std::set<std::string> h;
+      for (std::set<std::string>::iterator x = r.begin(); x != r.end(); ++x) {
+        for (std::set<std::string>::iterator y = strings[order[i]].begin(); y != strings[order[i]].end(); ++y) {
+          h.insert(*x + *y);
+        }
+      }
+      r.swap(h);
+    }
+    g.insert(r.begin(), r.end());
+  } while (++orders < 40320 && std::next_permutation(order.begin(), order.end()));
+  Trim(g, opt, n);
+}
+
 } // namespace regen
@@ -3,6 +3,9 @@
 
 #include <list>
 #include <algorithm>
+#include <new>
+#include <iterator>
+#include <cstddef>
 #include "util.h"
 
 namespace regen {
@@ -12,9 +15,9 @@ class StateExpr;
 class Literal; class CharClass; class Dot; class Anchor;
 class None; class Epsilon; class Operator; class EOP;
 class BinaryExpr;
-class Concat; class Union; class Intersection; class XOR;
+class Concat; class Union; class Intersection; class XOR; class Interleave;
 class UnaryExpr;
-class Qmark; class Plus; class Star;
+class Qmark; class Plus; class Star; class Repetition; class Permute;
 struct ExprPool;
 
 class ExprVisitor {
@@ -34,10 +37,13 @@ public:
   virtual void Visit(Union *e) { Visit((BinaryExpr*)e); }
   virtual void Visit(Intersection *e) { Visit((BinaryExpr*)e); }
   virtual void Visit(XOR *e) { Visit((BinaryExpr*)e); }
+  virtual void Visit(Interleave *e) { Visit((BinaryExpr*)e); }
   virtual void Visit(UnaryExpr *e) { Visit((Expr*)e); }
   virtual void Visit(Qmark *e) { Visit((UnaryExpr*)e); }
   virtual void Visit(Plus *e) { Visit((UnaryExpr*)e); }
   virtual void Visit(Star *e) { Visit((UnaryExpr*)e); }
+  virtual void Visit(Repetition *e) { Visit((UnaryExpr*)e); }
+  virtual void Visit(Permute *e) { Visit((UnaryExpr*)e); }
 };
 
 struct Keywords {
@@ -50,12 +56,12 @@ struct Keywords {
   std::set<std::string> in;
   std::set<std::string> candidates;
   const std::string& longest_keyword() const
-  { static const std::string empty; return in.empty() ? empty : *std::max_element(in.begin(), in.end(), compare_keywords); }
+  { static const std::string empty; return in.empty() ? empty : *std::min_element(in.begin(), in.end(), compare_keywords); }
   bool no_candidates;
 };
 
 struct ExprInfo {
-  ExprInfo(): xor_num(0), expr_root(NULL), orig_root(NULL), copied_root(NULL), extra_top(NULL), eop(NULL), min_length(0), max_length(0) {}
+  ExprInfo(): xor_num(0), expr_root(NULL), orig_root(NULL), copied_root(NULL), extra_top(NULL), eop(NULL), min_length(0), max_length(0), pool(NULL) {}
   std::size_t xor_num;
   Expr *expr_root;
   Expr *orig_root;
@@ -66,12 +72,89 @@ struct ExprInfo {
   std::size_t max_length;
   std::bitset<256> involve;
   Keywords key;
+  ExprPool *pool; // of the position sets filled
+};
+
+/* DFA over bytes, as edges between its states (0 is the start).
+ * an Intersection or XOR whose operands were compiled apart holds the
+ * product of their DFAs (see product.h), and its positions are its edges. */
+struct Automaton {
+  struct Edge {
+    Edge(std::size_t next_, const std::bitset<256> &bytes_): next(next_), bytes(bytes_) {}
+    std::size_t next;
+    std::bitset<256> bytes;
+  };
+  std::vector<std::vector<Edge> > edges;
+  std::vector<bool> accept;
+  bool empty() const { return accept.empty(); }
+};
+
+/* Set of positions, as a persistent tree whose leaves are the positions.
+ * positions of sibling subtrees are disjoint, so a union shares both
+ * operands in a new node instead of copying them: first/last of all the
+ * subtrees take linear space, and Connect adds one node per follow set.
+ * nodes are never changed once built: the leaf of a position is a member
+ * of the position, joins are allocated from an ExprPool and freed with it.
+ * a position may be visited more than once (as in (a*)*), users collect
+ * them into sets. */
+class PositionSet {
+public:
+  struct Node {
+    Node *lhs; // NULL if leaf
+    union {
+      Node *rhs;
+      StateExpr *position;
+    };
+  };
+  /* leaves from left to right (depth first, by an explicit stack which
+   * overflows to the heap only for trees deeper than STACK_SIZE). */
+  class iterator {
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef StateExpr* value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef StateExpr* const* pointer;
+    typedef StateExpr* const& reference;
+    iterator(): leaf_(NULL), depth_(0) {}
+    explicit iterator(const Node *root): leaf_(root), depth_(0)
+    { if (root != NULL && root->lhs != NULL) { Push(root); Next(); } }
+    reference operator*() const { return leaf_->position; }
+    iterator& operator++() { Next(); return *this; }
+    iterator operator++(int) { iterator i(*this); Next(); return i; }
+    bool operator==(const iterator &i) const { return leaf_ == i.leaf_ && depth_ == i.depth_; }
+    bool operator!=(const iterator &i) const { return !(*this == i); }
+  private:
+    enum { STACK_SIZE = 16 };
+    void Push(const Node *n)
+    { if (depth_ < STACK_SIZE) stack_[depth_] = n; else overflow_.push_back(n); depth_++; }
+    const Node* Pop()
+    { if (--depth_ < STACK_SIZE) return stack_[depth_]; const Node *n = overflow_.back(); overflow_.pop_back(); return n; }
+    void Next();
+    const Node *stack_[STACK_SIZE];
+    std::vector<const Node*> overflow_;
+    const Node *leaf_;
+    std::size_t depth_;
+  };
+  typedef iterator const_iterator;
+  PositionSet(): root_(NULL) {}
+  explicit PositionSet(Node *root): root_(root) {}
+  iterator begin() const { return iterator(root_); }
+  iterator end() const { return iterator(); }
+  bool empty() const { return root_ == NULL; }
+  void insert(StateExpr *s, ExprPool *p);
+  void insert(const PositionSet &s, ExprPool *p);
+  template<class InputIterator> void assign(InputIterator first, InputIterator last, ExprPool *p)
+  { clear(); for (; first != last; ++first) insert(*first, p); }
+  void clear() { root_ = NULL; }
+private:
+  void Join(Node *n, ExprPool *p);
+  Node *root_;
 };
 
 struct Transition {
-  std::set<StateExpr*> first;
-  std::set<StateExpr*> last;
-  std::set<StateExpr*> follow;
+  PositionSet first;
+  PositionSet last;
+  PositionSet follow;
 };
 
 class Expr {
@@ -81,7 +164,8 @@ public:
     kAnchor, kEOP, kOperator,
     kConcat, kUnion, kIntersection, kXOR,
     kQmark, kStar, kPlus,
-    kEpsilon, kNone
+    kEpsilon, kNone, kRepetition,
+    kInterleave, kPermute
   };
   enum SuperType {
     kStateExpr=0, kBinaryExpr, kUnaryExpr
@@ -102,9 +186,9 @@ public:
   bool nonnullable() { return nonnullable_; }
   void set_nonnullable(bool b = true) { nonnullable_ = b; }
   Transition& transition() { return transition_; }
-  std::set<StateExpr*>& first() { return transition_.first; }
-  std::set<StateExpr*>& last() { return transition_.last; }
-  std::set<StateExpr*>& follow() { return transition_.follow; }
+  PositionSet& first() { return transition_.first; }
+  PositionSet& last() { return transition_.last; }
+  PositionSet& follow() { return transition_.follow; }
 
   Expr* parent() { return parent_; }
   void set_parent(Expr *parent) { parent_ = parent; }
@@ -114,10 +198,15 @@ public:
 
   virtual Expr::Type type() = 0;
   virtual Expr* Clone(ExprPool *) = 0;
-  virtual void NonGreedify() = 0;
-  virtual void FillPosition(ExprInfo *) = 0;
-  virtual void FillKeywords(Keywords *, std::bitset<256> *) = 0;
-  virtual void FillTransition() = 0;
+  /* passes over the whole subtree. they walk it with an explicit stack,
+   * calling the Fill*Node of each node, so that deep trees (long
+   * concatenations nest to the left) don't overflow the call stack. */
+  void NonGreedify();
+  void FillPosition(ExprInfo *);
+  void FillKeywords(Keywords *, std::bitset<256> *);
+  void FillTransition(ExprPool *);
+  /* positions of the subtree, from left to right. */
+  void StateExprs(std::vector<StateExpr*> *states);
   virtual void Serialize(std::vector<Expr*> &v, ExprPool *p) { v.push_back(Clone(p)); }
   virtual void Factorize(std::vector<Expr*> &v) { v.push_back(this); }
   virtual void Generate(std::set<std::string> &g, GenOpt opt = GenAll, std::size_t n = 1) { g.insert(""); }
@@ -127,9 +216,21 @@ public:
   
   virtual void Accept(ExprVisitor* visit) { visit->Visit(this); };
 protected:
-  static void Connect(std::set<StateExpr*> &src, std::set<StateExpr*> &dst);
+  /* subexpressions the passes descend into. */
+  std::size_t Children(Expr **children);
+  /* fills this node from its filled subexpressions. */
+  virtual void FillPositionNode(ExprInfo *) = 0;
+  /* merges keywords of the rhs (key_, if any) into the keywords of this node. */
+  virtual void FillKeywordsNode(Keywords *key, Keywords *key_, std::bitset<256> *involve) {}
+  /* clones the tree of an inner node. */
+  static Expr* CloneTree(Expr *, ExprPool *);
+  static void Connect(PositionSet &src, PositionSet &dst, ExprPool *p);
   static void _Shuffle(std::vector<Expr*>&, std::size_t, std::vector<Expr*>&, std::size_t, std::vector<Expr*>&, Expr *c, ExprPool *);
   static void _Permutation(std::vector<Expr*> &, std::bitset<8> &, std::vector<Expr*> &, std::vector<std::size_t> &, ExprPool *);
+  static bool HasOperator(Expr *);
+  /* positions of a product node (Interleave, Permute, and Intersection
+   * or XOR with a product DFA), NULL for others. */
+  static std::vector<StateExpr*>* ProductPositions(Expr *);
   std::size_t max_length_;
   std::size_t min_length_;
   bool nullable_;
@@ -140,37 +241,60 @@ private:
   DISALLOW_COPY_AND_ASSIGN(Expr);
 };
 
+/* Arena of expression nodes.
+ * nodes are constructed in large chunks by bumping a pointer, and are
+ * destructed and freed in bulk with the pool. */
 struct ExprPool {
-  typedef std::list<Expr *> Pool;
  public:
-  ~ExprPool() { for(Pool::iterator i = pool.begin(); i != pool.end(); ++i) { delete *i; } }
+  ExprPool(): ptr_(NULL), end_(NULL) {}
+  ~ExprPool() { clear(); }
 
   template<class T> T* alloc()
-  { pool.push_back(0); Expr* &i = pool.back(); T* p = new T(); i = p; return p; }
+  { T* p = new(allocate(sizeof(T))) T(); nodes_.push_back(p); return p; }
   template<class T, class P1> T* alloc(P1 p1)
-  { pool.push_back(0); Expr* &i = pool.back(); T* p = new T(p1); i = p; return p; }
+  { T* p = new(allocate(sizeof(T))) T(p1); nodes_.push_back(p); return p; }
   template<class T, class P1, class P2> T* alloc(P1 p1, P2 p2)
-  { pool.push_back(0); Expr* &i = pool.back(); T* p = new T(p1, p2); i = p; return p; }
+  { T* p = new(allocate(sizeof(T))) T(p1, p2); nodes_.push_back(p); return p; }
   template<class T, class P1, class P2, class P3> T* alloc(P1 p1, P2 p2, P3 p3)
-  { pool.push_back(0); Expr* &i = pool.back(); T* p = new T(p1, p2, p3); i = p; return p; }
+  { T* p = new(allocate(sizeof(T))) T(p1, p2, p3); nodes_.push_back(p); return p; }
+  template<class T, class P1, class P2, class P3, class P4, class P5> T* alloc(P1 p1, P2 p2, P3 p3, P4 p4, P5 p5)
+  { T* p = new(allocate(sizeof(T))) T(p1, p2, p3, p4, p5); nodes_.push_back(p); return p; }
+
+  /* hash-consing: the node of the pool structurally equal to T(...) (same
+   * type, attributes and children nodes), which is shared, or a new one.
+   * for trees which are never filled with positions (a position must be
+   * a node of its own) nor patched, as the parent of a shared node is
+   * only one of its parents. */
+  template<class T> T* share()
+  { return static_cast<T*>(Share(alloc<T>(), sizeof(T))); }
+  template<class T, class P1> T* share(P1 p1)
+  { return static_cast<T*>(Share(alloc<T>(p1), sizeof(T))); }
+  template<class T, class P1, class P2> T* share(P1 p1, P2 p2)
+  { return static_cast<T*>(Share(alloc<T>(p1, p2), sizeof(T))); }
+
+  /* a join of position sets, freed with the pool. */
+  PositionSet::Node* node()
+  { return static_cast<PositionSet::Node*>(allocate(sizeof(PositionSet::Node))); }
 
   void drain(ExprPool &p) { drain(&p); }
-  void drain(ExprPool *p)
-  {
-    pool.insert(pool.end(), p->pool.begin(), p->pool.end());
-    p->pool.clear();
-  }
+  void drain(ExprPool *p);
+  void clear();
 
  private:
-  Pool pool;
+  void* allocate(std::size_t size);
+  Expr* Share(Expr *e, std::size_t size);
+  std::vector<Expr*> nodes_;
+  std::map<std::string, Expr*> shared_; // by key of ShareKey
+  std::vector<char*> chunks_;
+  char *ptr_, *end_; // free space of the current chunk
+  DISALLOW_COPY_AND_ASSIGN(ExprPool);
 };
 
 class StateExpr: public Expr {
 public:
   StateExpr(): state_id_(0), root_non_greedy_(false), non_greedy_(false), complete_non_greedy_(false), non_greedy_pair_(NULL), near_root_non_greedy_pair_(NULL)
-  { max_length_ = min_length_ = 1; nullable_ = false; }
+  { max_length_ = min_length_ = 1; nullable_ = false; leaf_.lhs = NULL; leaf_.position = this; }
   ~StateExpr() {}
-  void FillTransition() {}
   std::size_t state_id() { return state_id_; }
   void set_state_id(std::size_t id) { state_id_ = id; }
   bool root_non_greedy() { return root_non_greedy_; }
@@ -184,10 +308,9 @@ public:
   StateExpr* near_root_non_greedy_pair() { return near_root_non_greedy_pair_; }
   void set_near_root_non_greedy_pair(StateExpr* s) { near_root_non_greedy_pair_ = s; }
   void Accept(ExprVisitor* visit) { visit->Visit(this); };
-  void NonGreedify()  { set_root_non_greedy(true); }
   virtual bool Match(const unsigned char c) { return false; }
-  void FillPosition(ExprInfo *) { transition_.first.insert(this); transition_.last.insert(this); }
-  void FillKeywords(Keywords *, std::bitset<256> *) {}
+  void FillPositionNode(ExprInfo *) { transition_.last = transition_.first = PositionSet(&leaf_); }
+  PositionSet::Node* leaf() { return &leaf_; }
   void PatchBackRef(Expr *, std::size_t, ExprPool *) {}
 protected:
   std::size_t state_id_;
@@ -196,6 +319,7 @@ protected:
   bool complete_non_greedy_;
   StateExpr* non_greedy_pair_;
   StateExpr* near_root_non_greedy_pair_;
+  PositionSet::Node leaf_;
   DISALLOW_COPY_AND_ASSIGN(StateExpr);
 };
 
@@ -207,7 +331,7 @@ public:
   Expr::Type type() { return Expr::kLiteral; }
   void Accept(ExprVisitor* visit) { visit->Visit(this); };
   bool Match(unsigned char c) { return c == literal_; };
-  void FillKeywords(Keywords *key, std::bitset<256> *);
+  void FillKeywordsNode(Keywords *key, Keywords *, std::bitset<256> *);
   Expr *Clone(ExprPool *p) { return p->alloc<Literal>(literal_); };
   void Generate(std::set<std::string> &g, GenOpt opt, std::size_t n) { g.insert(std::string(1, literal_)); }
 private:
@@ -230,7 +354,7 @@ public:
   Expr::Type type() { return Expr::kCharClass; }
   void Accept(ExprVisitor* visit) { visit->Visit(this); };
   bool Match(const unsigned char c) { return Involve(c); };
-  void FillKeywords(Keywords *, std::bitset<256> *);
+  void FillKeywordsNode(Keywords *, Keywords *, std::bitset<256> *);
   Expr *Clone(ExprPool *p) { return p->alloc<CharClass>(table_, negative_); };
   void Generate(std::set<std::string> &g, GenOpt opt, std::size_t n);
 private:
@@ -246,7 +370,7 @@ public:
   Expr::Type type() { return Expr::kDot; }
   void Accept(ExprVisitor* visit) { visit->Visit(this); };
   bool Match(const unsigned char c) { return true; };
-  void FillKeywords(Keywords *, std::bitset<256> *);
+  void FillKeywordsNode(Keywords *, Keywords *, std::bitset<256> *);
   bool match_delimiter() { return match_delimiter_; }
   Expr *Clone(ExprPool *p) { return p->alloc<Dot>(); };
   void Generate(std::set<std::string> &g, GenOpt opt, std::size_t n);
@@ -301,12 +425,14 @@ private:
 
 class EOP: public StateExpr {
 public:
-  EOP() { min_length_ = max_length_ = 0; nullable_ = true; }
+  EOP(std::size_t id = 0): id_(id) { min_length_ = max_length_ = 0; nullable_ = true; }
   ~EOP() {}
   Expr::Type type() { return Expr::kEOP; }  
   void Accept(ExprVisitor* visit) { visit->Visit(this); };
-  Expr* Clone(ExprPool *p) { return p->alloc<EOP>(); };
+  Expr* Clone(ExprPool *p) { return p->alloc<EOP>(id_); };
+  std::size_t id() { return id_; }
 private:
+  std::size_t id_; // pattern id (for multiple pattern matching)
   DISALLOW_COPY_AND_ASSIGN(EOP);
 };
 
@@ -341,7 +467,7 @@ public:
   Expr* rhs() { return rhs_; }
   void  set_rhs(Expr *rhs) { rhs_ = rhs; }
   void Accept(ExprVisitor* visit) { visit->Visit(this); };
-  void NonGreedify()  { lhs_->NonGreedify(); rhs_->NonGreedify(); }
+  Expr* Clone(ExprPool *p) { return CloneTree(this, p); }
   void PatchBackRef(Expr *e, std::size_t i, ExprPool *p) { lhs_->PatchBackRef(e, i, p); rhs_->PatchBackRef(e, i, p); }
 protected:
   Expr *lhs_;
@@ -354,12 +480,10 @@ class Concat: public BinaryExpr {
 public:
 Concat(Expr *lhs, Expr *rhs, bool reverse = false): BinaryExpr(lhs, rhs) { if (reverse) std::swap(lhs_, rhs_); }
   ~Concat() {}
-  void FillPosition(ExprInfo *);
-  void FillTransition();
-  void FillKeywords(Keywords *, std::bitset<256> *);
+  void FillPositionNode(ExprInfo *);
+  void FillKeywordsNode(Keywords *, Keywords *, std::bitset<256> *);
   Expr::Type type() { return Expr::kConcat; }
   void Accept(ExprVisitor* visit) { visit->Visit(this); };
-  Expr* Clone(ExprPool *p) { return p->alloc<Concat>(lhs_->Clone(p), rhs_->Clone(p)); };
   void Serialize(std::vector<Expr*> &v, ExprPool *p);
   void Factorize(std::vector<Expr*> &v) { lhs_->Factorize(v); rhs_->Factorize(v); }
   void Generate(std::set<std::string> &g, GenOpt opt, std::size_t n);
@@ -371,12 +495,10 @@ class Union: public BinaryExpr {
 public:
   Union(Expr *lhs, Expr *rhs): BinaryExpr(lhs, rhs) {}
   ~Union() {}
-  void FillPosition(ExprInfo *);
-  void FillTransition();
-  void FillKeywords(Keywords *, std::bitset<256> *);
+  void FillPositionNode(ExprInfo *);
+  void FillKeywordsNode(Keywords *, Keywords *, std::bitset<256> *);
   Expr::Type type() { return Expr::kUnion; }
   void Accept(ExprVisitor* visit) { visit->Visit(this); };
-  Expr* Clone(ExprPool *p) { return p->alloc<Union>(lhs_->Clone(p), rhs_->Clone(p)); };
   void Serialize(std::vector<Expr*> &v, ExprPool *p);
   void Generate(std::set<std::string> &g, GenOpt opt, std::size_t n);
 private:
@@ -387,16 +509,19 @@ class Intersection: public BinaryExpr {
 public:
   Intersection(Expr *lhs, Expr *rhs, ExprPool *p);
   ~Intersection() {}
-  void FillPosition(ExprInfo *);
-  void FillTransition();
-  void FillKeywords(Keywords *, std::bitset<256> *);
+  void FillPositionNode(ExprInfo *);
   Expr::Type type() { return Expr::kIntersection; }
   void Accept(ExprVisitor* visit) { visit->Visit(this); };
-  Expr* Clone(ExprPool *p) { return p->alloc<Intersection>(lhs__->Clone(p), rhs__->Clone(p), p); };
   void Generate(std::set<std::string> &g, GenOpt opt, std::size_t n);
+  const Automaton& product() const { return product_; }
+  void set_product(const Automaton &product) { product_ = product; }
+  std::vector<StateExpr*>& positions() { return positions_; }
 private:
   Operator *rop_, *lop_;
   Expr *lhs__, *rhs__;
+  ExprPool *pool_;
+  Automaton product_;
+  std::vector<StateExpr*> positions_;
   DISALLOW_COPY_AND_ASSIGN(Intersection);
 };
 
@@ -404,19 +529,43 @@ class XOR: public BinaryExpr {
 public:
   XOR(Expr *lhs, Expr *rhs, ExprPool *p);
   ~XOR() {}
-  void FillPosition(ExprInfo *);
-  void FillTransition();
-  void FillKeywords(Keywords *, std::bitset<256> *);
+  void FillPositionNode(ExprInfo *);
   Expr::Type type() { return Expr::kXOR; }
   void Accept(ExprVisitor* visit) { visit->Visit(this); };
-  Expr* Clone(ExprPool *p) { return p->alloc<XOR>(lhs__->Clone(p), rhs__->Clone(p), p); }
   void Generate(std::set<std::string> &g, GenOpt opt, std::size_t n);
+  const Automaton& product() const { return product_; }
+  void set_product(const Automaton &product) { product_ = product; }
+  std::vector<StateExpr*>& positions() { return positions_; }
 private:
   Operator *lop_, *rop_;
   Expr *lhs__, *rhs__;
+  ExprPool *pool_;
+  Automaton product_;
+  std::vector<StateExpr*> positions_;
   DISALLOW_COPY_AND_ASSIGN(XOR);
 };
 
+/* Shuffle R||S as the product of the automata of R and S.
+ * positions of R and S are filled (with their follow) apart, and the
+ * positions of this node are pairs of a position of one operand, just
+ * consumed, and the state of the other (a position, or not started):
+ * O(|R||S|) positions, where interleaving the factors of R and S
+ * expanded to exponentially many concatenations. */
+class Interleave: public BinaryExpr {
+public:
+  Interleave(Expr *lhs, Expr *rhs, ExprPool *p): BinaryExpr(lhs, rhs), pool_(p) {}
+  ~Interleave() {}
+  void FillPositionNode(ExprInfo *);
+  Expr::Type type() { return Expr::kInterleave; }
+  void Accept(ExprVisitor* visit) { visit->Visit(this); };
+  void Generate(std::set<std::string> &g, GenOpt opt, std::size_t n);
+  std::vector<StateExpr*>& positions() { return positions_; }
+private:
+  ExprPool *pool_;
+  std::vector<StateExpr*> positions_;
+  DISALLOW_COPY_AND_ASSIGN(Interleave);
+};
+
 class UnaryExpr: public Expr {
 public:
   UnaryExpr(Expr* lhs, double probability = 0.0): lhs_(lhs), probability_(probability) { lhs->set_parent(this); }
@@ -424,7 +573,7 @@ public:
   Expr* lhs() { return lhs_; }
   void  set_lhs(Expr *lhs) { lhs_ = lhs; }
   void Accept(ExprVisitor* visit) { visit->Visit(this); };
-  void NonGreedify()  { lhs_->NonGreedify(); }
+  Expr* Clone(ExprPool *p) { return CloneTree(this, p); }
   void PatchBackRef(Expr *e, std::size_t i, ExprPool *p) { lhs_->PatchBackRef(e, i, p); }
   double probability() { return probability_; }
   void set_probability(double p) { probability_ = p; }
@@ -440,12 +589,10 @@ public:
   Qmark(Expr *lhs, bool non_greedy = false, double probability = 0.0): UnaryExpr(lhs, probability), non_greedy_(non_greedy) {}
   Qmark(Expr *lhs, double probability): UnaryExpr(lhs, probability), non_greedy_(false) {}
   ~Qmark() {}
-  void FillPosition(ExprInfo *);
-  void FillTransition();
-  void FillKeywords(Keywords *, std::bitset<256> *);
+  void FillPositionNode(ExprInfo *);
   Expr::Type type() { return Expr::kQmark; }
   void Accept(ExprVisitor* visit) { visit->Visit(this); };
-  Expr* Clone(ExprPool *p) { return p->alloc<Qmark>(lhs_->Clone(p), non_greedy_, probability_); };
+  bool non_greedy() { return non_greedy_; }
   void Serialize(std::vector<Expr*> &v, ExprPool *p) { v.push_back(p->alloc<Epsilon>()); lhs_->Serialize(v, p); }
   void Generate(std::set<std::string> &g, GenOpt opt, std::size_t n);
 private:
@@ -458,12 +605,10 @@ public:
   Star(Expr *lhs, bool non_greedy = false, double probability = 0.0): UnaryExpr(lhs, probability), non_greedy_(non_greedy) {}
   Star(Expr *lhs, double probability): UnaryExpr(lhs, probability), non_greedy_(false) {}
   ~Star() {}
-  void FillPosition(ExprInfo *);
-  void FillTransition();
-  void FillKeywords(Keywords *, std::bitset<256> *);
+  void FillPositionNode(ExprInfo *);
   Expr::Type type() { return Expr::kStar; }
   void Accept(ExprVisitor* visit) { visit->Visit(this); };
-  Expr* Clone(ExprPool *p) { return p->alloc<Star>(lhs_->Clone(p), non_greedy_, probability_); };
+  bool non_greedy() { return non_greedy_; }
   void Generate(std::set<std::string> &g, GenOpt opt, std::size_t n);
 private:
   bool non_greedy_;
@@ -474,17 +619,69 @@ class Plus: public UnaryExpr {
 public:
   Plus(Expr *lhs, double probability = 0.0): UnaryExpr(lhs, probability) {}
   ~Plus() {}
-  void FillPosition(ExprInfo *);
-  void FillTransition();
-  void FillKeywords(Keywords *, std::bitset<256> *);
+  void FillPositionNode(ExprInfo *);
+  void FillKeywordsNode(Keywords *, Keywords *, std::bitset<256> *);
   Expr::Type type() { return Expr::kPlus; }
   void Accept(ExprVisitor* visit) { visit->Visit(this); };
-  Expr* Clone(ExprPool* p) { return p->alloc<Plus>(lhs_->Clone(p), probability_); };
   void Generate(std::set<std::string> &g, GenOpt opt, std::size_t n);
 private:
   DISALLOW_COPY_AND_ASSIGN(Plus);
 };
 
+/* Counted repetition R{min,max} (max == -1: unbounded).
+ * kept as one node over a single R, and expanded into concatenated copies
+ * of R only when positions are needed (FillPosition), so that passes which
+ * don't need positions never pay for large bounds.
+ * a Regex still builds all its positions when it is constructed, so the
+ * bound costs O(max) positions there: [0-9a-f]{1,4096} has 4096 of them.
+ * only CountingMatcher matches without them (see counting.h). */
+class Repetition: public UnaryExpr {
+public:
+  Repetition(Expr *lhs, std::pair<int, int> range, bool non_greedy, bool reverse, ExprPool *p):
+      UnaryExpr(lhs), min_(range.first), max_(range.second), non_greedy_(non_greedy), reverse_(reverse),
+      pool_(p), expanded_(NULL) {}
+  ~Repetition() {}
+  void FillPositionNode(ExprInfo *);
+  Expr::Type type() { return Expr::kRepetition; }
+  void Accept(ExprVisitor* visit) { visit->Visit(this); };
+  void Serialize(std::vector<Expr*> &v, ExprPool *p) { expanded()->Serialize(v, p); }
+  void Factorize(std::vector<Expr*> &v) { expanded()->Factorize(v); }
+  void Generate(std::set<std::string> &g, GenOpt opt, std::size_t n) { expanded()->Generate(g, opt, n); }
+  int min() { return min_; }
+  int max() { return max_; }
+  bool non_greedy() { return non_greedy_; }
+  bool reverse() { return reverse_; }
+  Expr* expanded();
+  /* R{min,max} as concatenation of R, R? and R*. */
+  static Expr* Expand(Expr *e, std::pair<int, int> range, bool non_greedy, double probability, bool reverse, ExprPool *p);
+private:
+  int min_, max_;
+  bool non_greedy_;
+  bool reverse_;
+  ExprPool *pool_;
+  Expr *expanded_;
+  DISALLOW_COPY_AND_ASSIGN(Repetition);
+};
+
+/* Permutation #R of the factors (items) of a concatenation R, as a subset
+ * construction: positions are the positions of the items, paired with the
+ * set of items already passed. 2^(n-1) copies of each position of n items,
+ * where the enumeration of orders made n! concatenations. */
+class Permute: public UnaryExpr {
+public:
+  Permute(Expr *lhs, ExprPool *p): UnaryExpr(lhs), pool_(p) {}
+  ~Permute() {}
+  void FillPositionNode(ExprInfo *);
+  Expr::Type type() { return Expr::kPermute; }
+  void Accept(ExprVisitor* visit) { visit->Visit(this); };
+  void Generate(std::set<std::string> &g, GenOpt opt, std::size_t n);
+  std::vector<StateExpr*>& positions() { return positions_; }
+private:
+  ExprPool *pool_;
+  std::vector<StateExpr*> positions_;
+  DISALLOW_COPY_AND_ASSIGN(Permute);
+};
+
 } // namespace regen
 
 #endif // REGEN_EXPR_H_
@@ -93,6 +93,18 @@ void PrintRegexVisitor::Visit(BinaryExpr *e)
   }
 }
 
+void PrintExprVisitor::Visit(Repetition *e)
+{
+  if (e->max() == -1) {
+    printf("{%d,}", e->min());
+  } else if (e->min() == e->max()) {
+    printf("{%d}", e->min());
+  } else {
+    printf("{%d,%d}", e->min(), e->max());
+  }
+  if (e->non_greedy()) printf("?");
+}
+
 void PrintRegexVisitor::Visit(UnaryExpr *e)
 {
   switch (Expr::SuperTypeOf(e->lhs())) {
@@ -108,6 +120,14 @@ void PrintRegexVisitor::Visit(UnaryExpr *e)
   PrintExprVisitor::Print(e);
 }
 
+void PrintRegexVisitor::Visit(Permute *e)
+{
+  PrintExprVisitor::Print(e);
+  printf("(");
+  e->lhs()->Accept(this);
+  printf(")");
+}
+
 void PrintParseTreeVisitor::print_state(Expr *e)
 {
   printf("  0x%p [label=\"", e);
@@ -149,7 +169,7 @@ void DumpExprVisitor::Visit(StateExpr *e)
   printf("StateExpr(%): ", e->state_id());
   PrintExprVisitor::Print(e);
   Transition transition = e->transition();
-  std::set<StateExpr*>::iterator iter;
+  PositionSet::iterator iter;
   puts("");
   printf("follow:");
   iter = transition.follow.begin();
@@ -175,7 +195,7 @@ void DumpExprVisitor::Dump(Expr* e)
 {
   static DumpExprVisitor self;
   Transition transition = e->transition();
-  std::set<StateExpr*>::iterator iter;
+  PositionSet::iterator iter;
   printf("Start: ");
   iter = transition.first.begin();
   while (iter != transition.first.end()) {
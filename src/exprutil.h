@@ -19,6 +19,9 @@ public:
   void Visit(Qmark* e) { printf("?"); }
   void Visit(Plus* e) { printf("+"); }
   void Visit(Star* e) { printf("*"); }
+  void Visit(Repetition* e);
+  void Visit(Interleave* e) { printf("||"); }
+  void Visit(Permute* e) { printf("#"); }
   static void Print(Expr *e);
 protected:
   PrintExprVisitor() {}
@@ -29,6 +32,7 @@ public:
   void Visit(StateExpr *e) { PrintExprVisitor::Print(e); }
   void Visit(BinaryExpr *e);
   void Visit(UnaryExpr *e);
+  void Visit(Permute *e);
   static void Print(Expr *e);
 private:
   PrintRegexVisitor() {}
@@ -52,6 +56,10 @@ public:
   void Visit(Expr *e) {}
   void Visit(StateExpr *e);
   void Visit(UnaryExpr* e);
+  void Visit(Repetition* e) { e->expanded()->Accept(this); }
+  void Visit(Interleave* e) { Visit(e->positions()); }
+  void Visit(Permute* e) { Visit(e->positions()); }
+  void Visit(const std::vector<StateExpr*> &positions) { for (std::size_t i = 0; i < positions.size(); i++) Visit(positions[i]); }
   void Visit(BinaryExpr* e);
   static void Dump(Expr *e);
 private:
@@ -0,0 +1,344 @@
+#include "literal.h"
+#include "regex.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define REGEN_LITERAL_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace regen {
+
+/* limit of the number of literals (char classes are expanded). */
+static const std::size_t MAX_LITERALS = 64;
+
+LiteralMatcher::LiteralMatcher(const std::set<std::string> &literals, const Regen::Options &flag):
+    literals_(literals), flag_(flag), ac_(NULL)
+{
+  std::set<std::size_t> lengths;
+  for (std::set<std::string>::const_iterator iter = literals_.begin(); iter != literals_.end(); ++iter) {
+    lengths.insert(iter->size());
+  }
+  lengths_.assign(lengths.begin(), lengths.end());
+  if (literals_.size() > 1) {
+    ac_ = new AhoCorasick();
+    for (std::set<std::string>::const_iterator iter = literals_.begin(); iter != literals_.end(); ++iter) {
+      ac_->Add(*iter);
+    }
+    ac_->Compile();
+  }
+}
+
+bool LiteralMatcher::Expand(Expr *e, const Regen::Options &flag, std::set<std::string> *literals)
+{
+  switch (e->type()) {
+    case Expr::kLiteral: {
+      unsigned char c = static_cast<Literal*>(e)->literal();
+      if (c == flag.delimiter() && !flag.one_line()) return false;
+      literals->insert(std::string(1, c));
+      return true;
+    }
+    case Expr::kCharClass: {
+      CharClass *cc = static_cast<CharClass*>(e);
+      if (cc->count() > MAX_LITERALS) return false;
+      for (std::size_t c = 0; c < 256; c++) {
+        if (c == flag.delimiter() && !flag.one_line()) continue;
+        if (cc->Involve(c)) literals->insert(std::string(1, c));
+      }
+      return !literals->empty();
+    }
+    case Expr::kConcat: {
+      Concat *concat = static_cast<Concat*>(e);
+      std::set<std::string> lhs, rhs;
+      if (!Expand(concat->lhs(), flag, &lhs) || !Expand(concat->rhs(), flag, &rhs)) return false;
+      if (lhs.size() * rhs.size() > MAX_LITERALS) return false;
+      for (std::set<std::string>::iterator l = lhs.begin(); l != lhs.end(); ++l) {
+        for (std::set<std::string>::iterator r = rhs.begin(); r != rhs.end(); ++r) {
+          literals->insert(*l + *r);
+        }
+      }
+      return true;
+    }
+    case Expr::kUnion: {
+      Union *u = static_cast<Union*>(e);
+      if (!Expand(u->lhs(), flag, literals) || !Expand(u->rhs(), flag, literals)) return false;
+      return literals->size() <= MAX_LITERALS;
+    }
+    case Expr::kQmark: {
+      /* X? (as factored alternatives: foo(bar)?) is X or the empty string. */
+      Qmark *q = static_cast<Qmark*>(e);
+      if (q->non_greedy() || !Expand(q->lhs(), flag, literals)) return false;
+      literals->insert(std::string());
+      return literals->size() <= MAX_LITERALS;
+    }
+    case Expr::kEpsilon:
+      literals->insert(std::string());
+      return true;
+    case Expr::kRepetition:
+      return Expand(static_cast<Repetition*>(e)->expanded(), flag, literals);
+    default:
+      return false;
+  }
+}
+
+LiteralMatcher* LiteralMatcher::Plan(Expr *e, const Regen::Options &flag)
+{
+  if (e == NULL || flag.reverse_match()) return NULL;
+  std::set<std::string> literals;
+  if (!Expand(e, flag, &literals) || literals.empty() || literals.count(std::string())) return NULL;
+  return new LiteralMatcher(literals, flag);
+}
+
+static inline int ctz(unsigned int x)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, x);
+  return index;
+#else
+  return __builtin_ctz(x);
+#endif
+}
+
+/* first occurrence of key in [begin, end).
+ * candidates are filtered by the first and the last bytes of key, 16 positions at once. */
+const char* LiteralMatcher::Find(const char *begin, const char *end, const std::string &key)
+{
+  const std::size_t n = key.size();
+  if (n == 0) return begin;
+  if (begin == NULL || (std::size_t)(end - begin) < n) return NULL;
+  if (n == 1) return (const char*)memchr(begin, key[0], end - begin);
+  const char *last = end - n; // last candidate
+  const char *p = begin;
+#ifdef REGEN_LITERAL_SSE2
+  const __m128i first_byte = _mm_set1_epi8(key[0]);
+  const __m128i last_byte = _mm_set1_epi8(key[n-1]);
+  for (; last - p >= 15; p += 16) {
+    __m128i head = _mm_loadu_si128((const __m128i*)p);
+    __m128i tail = _mm_loadu_si128((const __m128i*)(p + n - 1));
+    unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first_byte),
+                                                        _mm_cmpeq_epi8(tail, last_byte)));
+    while (mask != 0) {
+      const char *candidate = p + ctz(mask);
+      if (memcmp(candidate + 1, key.data() + 1, n - 2) == 0) return candidate;
+      mask &= mask - 1;
+    }
+  }
+#endif
+  while (p <= last) {
+    p = (const char*)memchr(p, key[0], last - p + 1);
+    if (p == NULL) return NULL;
+    if (memcmp(p, key.data(), n) == 0) return p;
+    p++;
+  }
+  return NULL;
+}
+
+bool LiteralMatcher::Contain(const char *begin, std::size_t length) const
+{
+  return literals_.find(std::string(begin, length)) != literals_.end();
+}
+
+/* end of the earliest ending occurrence. */
+const char* LiteralMatcher::FindFirstEnd(const Regen::StringPiece &string) const
+{
+  if (ac_ != NULL) {
+    return ac_->FindEnd(string);
+  } else {
+    const std::string &key = *literals_.begin();
+    const char *p = Find(string.begin(), string.end(), key);
+    return p == NULL ? NULL : p + key.size();
+  }
+}
+
+bool LiteralMatcher::Match(const Regen::StringPiece &string, Regen::StringPiece *result) const
+{
+  const char *begin = string.begin(), *end = string.end(), *matchend = NULL;
+  const std::size_t size = string.size();
+  if (flag_.prefix_match() && flag_.suffix_match()) {
+    if (size <= lengths_.back() && Contain(begin, size)) matchend = end;
+  } else if (flag_.prefix_match()) {
+    matchend = MatchPrefix(string);
+  } else if (flag_.suffix_match()) {
+    for (std::size_t i = 0; i < lengths_.size() && lengths_[i] <= size; i++) {
+      if (Contain(end - lengths_[i], lengths_[i])) {
+        matchend = end;
+        break;
+      }
+    }
+  } else {
+    const char *firstend = FindFirstEnd(string);
+    matchend = firstend;
+    if (firstend != NULL && flag_.longest_match() && result != NULL) {
+      /* occurrences which start before the first one ends are still alive,
+       * the longest of them is the match (same as the DFA). */
+      const char *s = firstend - lengths_.back() < begin ? begin : firstend - lengths_.back();
+      for (; s < firstend; s++) {
+        for (std::size_t i = 0; i < lengths_.size() && s + lengths_[i] <= end; i++) {
+          if (s + lengths_[i] > matchend && Contain(s, lengths_[i])) matchend = s + lengths_[i];
+        }
+      }
+    }
+  }
+  if (matchend == NULL) return false;
+  if (result != NULL) result->set_end(matchend);
+  return true;
+}
+
+const char* LiteralMatcher::MatchPrefix(const Regen::StringPiece &string) const
+{
+  const char *matchend = NULL;
+  for (std::size_t i = 0; i < lengths_.size() && lengths_[i] <= string.size(); i++) {
+    if (Contain(string.begin(), lengths_[i])) {
+      matchend = string.begin() + lengths_[i];
+      if (flag_.shortest_match()) break;
+    }
+  }
+  return matchend;
+}
+
+const char* LiteralMatcher::LongestSuffix(const Regen::StringPiece &string) const
+{
+  for (std::size_t i = lengths_.size(); i > 0; i--) {
+    std::size_t length = lengths_[i-1];
+    if (length <= string.size() && Contain(string.end() - length, length)) {
+      return string.end() - length;
+    }
+  }
+  return NULL;
+}
+
+/* minimum length of K, shorter ones occur too often to pay for the split. */
+static const std::size_t MIN_INNER_LITERAL = 2;
+static const std::size_t MAX_INNER_VERIFY = 8;
+
+InnerLiteralMatcher::InnerLiteralMatcher(const std::string &key, const std::vector<Expr*> &prefix,
+                                         const std::vector<Expr*> &suffix, const Regen::Options &flag):
+    key_(key), prefix_(NULL), suffix_(NULL), flag_(flag)
+{
+  /* both sides are anchored at K, and only existence of a match is needed. */
+  Regen::Options opt(flag);
+  opt.filtered_match(false);
+  opt.captured_match(false);
+  opt.non_nullable(false);
+  opt.prefix_match(true);
+  opt.suffix_match(false);
+  opt.shortest_match(true);
+  if (!suffix.empty()) suffix_ = new Regex(suffix, opt);
+  opt.reverse(true);
+  if (!prefix.empty()) prefix_ = new Regex(prefix, opt);
+}
+
+InnerLiteralMatcher::~InnerLiteralMatcher()
+{
+  delete prefix_;
+  delete suffix_;
+}
+
+bool InnerLiteralMatcher::Splittable(Expr *e)
+{
+  switch (e->type()) {
+    case Expr::kAnchor: case Expr::kOperator: case Expr::kEOP:
+    case Expr::kIntersection: case Expr::kXOR:
+      return false;
+    case Expr::kConcat: case Expr::kUnion: {
+      BinaryExpr *b = static_cast<BinaryExpr*>(e);
+      return Splittable(b->lhs()) && Splittable(b->rhs());
+    }
+    case Expr::kRepetition:
+      return Splittable(static_cast<Repetition*>(e)->expanded());
+    case Expr::kQmark: case Expr::kStar: case Expr::kPlus:
+      return Splittable(static_cast<UnaryExpr*>(e)->lhs());
+    default:
+      return true;
+  }
+}
+
+static void Factorize(Expr *e, std::vector<Expr*> *factors)
+{
+  if (e->type() == Expr::kConcat) {
+    Factorize(static_cast<Concat*>(e)->lhs(), factors);
+    Factorize(static_cast<Concat*>(e)->rhs(), factors);
+  } else if (e->type() == Expr::kRepetition) {
+    Factorize(static_cast<Repetition*>(e)->expanded(), factors);
+  } else {
+    factors->push_back(e);
+  }
+}
+
+InnerLiteralMatcher* InnerLiteralMatcher::Plan(Expr *e, const Regen::Options &flag)
+{
+  if (e == NULL || flag.prefix_match() || flag.suffix_match() || flag.reverse_match()) return NULL;
+  if (!Splittable(e)) return NULL;
+  std::vector<Expr*> factors;
+  Factorize(e, &factors);
+
+  /* longest run of literal factors. */
+  std::size_t begin = 0, length = 0;
+  for (std::size_t i = 0; i < factors.size(); ) {
+    std::size_t j = i;
+    while (j < factors.size() && factors[j]->type() == Expr::kLiteral) {
+      unsigned char c = static_cast<Literal*>(factors[j])->literal();
+      if (c == flag.delimiter() && !flag.one_line()) break;
+      j++;
+    }
+    if (j - i > length) {
+      begin = i;
+      length = j - i;
+    }
+    i = j == i ? i + 1 : j;
+  }
+  if (length < MIN_INNER_LITERAL || length == factors.size()) return NULL;
+
+  std::string key;
+  for (std::size_t i = begin; i < begin + length; i++) {
+    key += static_cast<Literal*>(factors[i])->literal();
+  }
+  std::vector<Expr*> prefix(factors.begin(), factors.begin() + begin);
+  std::vector<Expr*> suffix(factors.begin() + begin + length, factors.end());
+  return new InnerLiteralMatcher(key, prefix, suffix, flag);
+}
+
+bool InnerLiteralMatcher::Compile(Regen::Options::CompileFlag olevel)
+{
+  bool compile = true;
+  if (prefix_ != NULL) compile &= prefix_->Compile(olevel);
+  if (suffix_ != NULL) compile &= suffix_->Compile(olevel);
+  return compile;
+}
+
+bool InnerLiteralMatcher::Complete() const
+{
+  return (prefix_ == NULL || prefix_->dfa().Complete())
+      && (suffix_ == NULL || suffix_->dfa().Complete());
+}
+
+/* each occurrence is verified by scanning its line (the string if OneLine)
+ * both sides, so a line of many occurrences costs their number times its
+ * length. after MAX_INNER_VERIFY failures in a line, the next occurrence
+ * in it is taken unverified: the automaton scans the line once instead. */
+const char* InnerLiteralMatcher::Find(const Regen::StringPiece &string, bool *verified) const
+{
+  const char *begin = string.begin(), *end = string.end();
+  const char *failed = NULL; // the last occurrence which failed
+  std::size_t fails = 0;     // in the line of failed
+  for (const char *p = begin; (p = LiteralMatcher::Find(p, end, key_)) != NULL; p++) {
+    if (fails > 0 && !flag_.one_line() && memchr(failed, flag_.delimiter(), p - failed) != NULL) fails = 0;
+    if (fails < MAX_INNER_VERIFY
+        && ((prefix_ != NULL && !prefix_->Match(Regen::StringPiece(begin, p)))
+            || (suffix_ != NULL && !suffix_->Match(Regen::StringPiece(p + key_.size(), end))))) {
+      failed = p;
+      fails++;
+      continue;
+    }
+    *verified = fails < MAX_INNER_VERIFY;
+    if (flag_.one_line()) return begin;
+    /* matches never contain the delimiter. */
+    while (p > begin && (unsigned char)p[-1] != flag_.delimiter()) p--;
+    return p;
+  }
+  return NULL;
+}
+
+} // namespace regen
@@ -0,0 +1,68 @@
+#ifndef REGEN_LITERAL_H_
+#define  REGEN_LITERAL_H_
+#include "regen.h"
+#include "util.h"
+#include "expr.h"
+#include "ahocorasick.h"
+
+namespace regen {
+
+/* Matcher for patterns which denote a finite set of literals
+ * ("abc", "foo|bar", "a[bc]d", ...). strings are searched without automaton,
+ * by SIMD substring search (single literal) or Aho-Corasick (literal set),
+ * and have the same match/result semantics as the DFA. */
+class LiteralMatcher {
+public:
+  ~LiteralMatcher() { delete ac_; }
+  /* returns NULL if the expression is not a literal (set). */
+  static LiteralMatcher* Plan(Expr *e, const Regen::Options &flag);
+  bool Match(const Regen::StringPiece& string, Regen::StringPiece* result = NULL) const;
+  /* end of the longest (shortest if ShortestMatch) literal which begins at string.begin(), or NULL. */
+  const char* MatchPrefix(const Regen::StringPiece& string) const;
+  /* begin of the longest literal which ends at string.end(), or NULL. */
+  const char* LongestSuffix(const Regen::StringPiece& string) const;
+  const std::set<std::string> &literals() const { return literals_; }
+  static const char* Find(const char *begin, const char *end, const std::string &key);
+private:
+  LiteralMatcher(const std::set<std::string> &literals, const Regen::Options &flag);
+  static bool Expand(Expr *e, const Regen::Options &flag, std::set<std::string> *literals);
+  bool Contain(const char *begin, std::size_t length) const;
+  const char* FindFirstEnd(const Regen::StringPiece& string) const;
+  std::set<std::string> literals_;
+  std::vector<std::size_t> lengths_; // ascending
+  Regen::Options flag_;
+  AhoCorasick *ac_;
+  DISALLOW_COPY_AND_ASSIGN(LiteralMatcher);
+};
+
+/* Partial matching driven by an inner literal.
+ * regex is split into P K S at the longest literal K among its top-level
+ * factors, each occurrence of K is verified by the reverse DFA of P
+ * (which must end at K) and the forward DFA of S (which must begin after K),
+ * so the bytes far from K are never scanned. */
+class InnerLiteralMatcher {
+public:
+  ~InnerLiteralMatcher();
+  /* returns NULL if regex can't be split. */
+  static InnerLiteralMatcher* Plan(Expr *e, const Regen::Options &flag);
+  bool Compile(Regen::Options::CompileFlag olevel);
+  bool Complete() const;
+  /* returns the head of the line (string.begin() if OneLine) where
+   * the first verified occurrence of K lies, or NULL if nothing matches.
+   * any match of regex begins at or after it. *verified is false if the
+   * occurrence was taken without verification (see Find). */
+  const char* Find(const Regen::StringPiece& string, bool *verified) const;
+  const std::string &key() const { return key_; }
+private:
+  InnerLiteralMatcher(const std::string &key, const std::vector<Expr*> &prefix,
+                      const std::vector<Expr*> &suffix, const Regen::Options &flag);
+  static bool Splittable(Expr *e);
+  std::string key_;
+  Regex *prefix_; // reverse of P (NULL if P is empty)
+  Regex *suffix_; // S (NULL if S is empty)
+  Regen::Options flag_;
+  DISALLOW_COPY_AND_ASSIGN(InnerLiteralMatcher);
+};
+
+} // namespace regen
+#endif // REGEN_LITERAL_H_
@@ -0,0 +1,278 @@
+#include "matcher.h"
+#include "program.h"
+#include "regex.h"
+#include "literal.h"
+#include "cache.h"
+#include "capture.h"
+#include "counting.h"
+#include "bitparallel.h"
+
+namespace regen {
+
+Matcher::Matcher(const Regen &re):
+    program_(re.program_), dfa_(NULL), reverse_dfa_(NULL), reverse_regex_(NULL), consume_regex_(NULL)
+{
+  program_->Ref();
+}
+
+Matcher::Matcher(const Regen::StringPiece &pattern, const Regen::Options &opt, Regen::Options::CompileFlag olevel):
+    program_(NULL), dfa_(NULL), reverse_dfa_(NULL), reverse_regex_(NULL), consume_regex_(NULL)
+{
+  /* the entry may be evicted (or private, if incomplete) meanwhile,
+   * the reference keeps the Program. */
+  RegenCache::Entry *entry = RegenCache::Shared().Acquire(pattern, opt, olevel);
+  program_ = entry->regen->program_;
+  program_->Ref();
+  RegenCache::Shared().Release(entry);
+}
+
+Matcher::Matcher(const Program *program):
+    program_(program), dfa_(NULL), reverse_dfa_(NULL), reverse_regex_(NULL), consume_regex_(NULL)
+{
+  program_->Ref();
+}
+
+Matcher::~Matcher()
+{
+  delete dfa_;
+  delete reverse_dfa_;
+  delete reverse_regex_;
+  delete consume_regex_;
+  program_->Unref();
+}
+
+bool Matcher::shared() const
+{
+  return program_->Complete();
+}
+
+/* the DFA of regex if complete, else an On-The-Fly DFA of this Matcher
+ * over the expressions of regex (which it only reads, see Program). */
+const DFA& Matcher::Automaton(const Regex *regex, DFA **scratch) const
+{
+  if (regex->dfa().Complete()) return regex->dfa();
+  if (*scratch == NULL) {
+    *scratch = new DFA(regex->dfa().flag());
+    (*scratch)->set_expr_info(regex->expr_info());
+  }
+  return **scratch;
+}
+
+/* builds *regex from the pattern of base, unless it's built already. */
+struct BuildRegex {
+  BuildRegex(Regex **regex_, const Regex *base_, const Regen::Options &opt_): regex(regex_), base(base_), opt(opt_) {}
+  void operator()() const
+  {
+    if (*regex != NULL) return;
+    Regex *re = new Regex(base->regex(), opt);
+    re->Compile(base->olevel());
+    *regex = re;
+  }
+  Regex **regex;
+  const Regex *base;
+  Regen::Options opt;
+};
+
+/* builds *regex on its first use in this Matcher. once is per regex: a
+ * built one is read without any lock (a Regen's own Matcher may be called
+ * by several threads). */
+const Regex* Matcher::BuildOnce(Regex **regex, Once *once, const Regen::Options &opt) const
+{
+  once->Call(BuildRegex(regex, program_->regex(), opt));
+  return *regex;
+}
+
+bool Matcher::Match(const Regen::StringPiece &string, Regen::StringPiece *result) const
+{
+  const Program &p = *program_;
+  Regen::StringPiece target(string);
+  /* the literal only narrows where the automaton starts, so it's
+   * skipped if its own automata would grow On-The-Fly. */
+  if (p.inner() != NULL && p.inner()->Complete()) {
+    /* the automaton is started from the line of the verified inner literal,
+     * no match begins before it. */
+    bool verified;
+    const char *begin = p.inner()->Find(string, &verified);
+    if (begin == NULL) return false;
+    if (result == NULL && verified) return true;
+    target.set_begin(begin);
+  }
+  bool match;
+  if (p.literal() != NULL) {
+    match = p.literal()->Match(target, result);
+  } else if (p.bitparallel() != NULL) {
+    match = p.bitparallel()->Match(target, result);
+  } else if (p.counting() != NULL) {
+    match = p.counting()->Match(target, result);
+  } else {
+    match = Automaton(p.regex(), &dfa_).Match(target, result);
+  }
+  if (match && result != NULL && p.flag().captured_match()) ResolveBegin(string, result);
+  return match;
+}
+
+/* sets the begin of the match which ends at result->end(),
+ * the reverse scan never goes before string.begin(). */
+void Matcher::ResolveBegin(const Regen::StringPiece &string, Regen::StringPiece *result) const
+{
+  const Program &p = *program_;
+  if (p.flag().prefix_match() || result->end() == string.begin()) {
+    result->set_begin(string.begin());
+  } else if (p.literal() != NULL) {
+    result->set_begin(p.literal()->LongestSuffix(Regen::StringPiece(string.begin(), result->end())));
+  } else if (p.regex()->min_length() == p.regex()->max_length()) {
+    result->set_begin(result->end() - p.regex()->min_length());
+  } else {
+    Regen::StringPiece string_(string.begin(), result->end());
+    if (p.reverse_regex() != NULL) {
+      Automaton(p.reverse_regex(), &reverse_dfa_).Match(string_, result);
+    } else {
+      BuildOnce(&reverse_regex_, &reverse_once_, p.ReverseOptions())->Match(string_, result);
+    }
+  }
+}
+
+std::size_t Matcher::FindAll(const Regen::StringPiece &string, std::vector<Regen::StringPiece> *matches) const
+{
+  matches->clear();
+  Regen::StringPiece rest(string), result;
+  while (Match(rest, &result)) {
+    /* matches don't overlap, so the begin is searched back to the previous end at most. */
+    if (!program_->flag().captured_match()) ResolveBegin(rest, &result);
+    matches->push_back(result);
+    if (result.end() == rest.end()) break;
+    rest.set_begin(result.empty() ? result.end() + 1 : result.end());
+  }
+  return matches->size();
+}
+
+bool Matcher::MatchGroups(const Regen::StringPiece &string, std::vector<Regen::StringPiece> *groups) const
+{
+  Regen::StringPiece result;
+  if (!Match(string, &result)) return false;
+  if (!program_->flag().captured_match()) ResolveBegin(string, &result);
+  /* the DFA fixes the bounds, tags are resolved within them. */
+  const Capture *capture = program_->capture();
+  if (capture == NULL || !capture->Match(result, groups)) groups->assign(1, result);
+  return true;
+}
+
+/* appends rewrite to out, with the references to groups expanded. */
+static void Rewrite(const Regen::StringPiece &rewrite, const std::vector<Regen::StringPiece> &groups, std::string *out)
+{
+  const char *p = rewrite.begin(), *end = rewrite.end();
+  while (p < end) {
+    const char *q = p;
+    while (q < end && *q != '\\') q++;
+    out->append(p, q);
+    if (q == end) break;
+    q++;
+    if (*q == '\\') {
+      out->push_back('\\');
+    } else {
+      std::size_t n = *q - '0';
+      if (n < groups.size() && groups[n].begin() != NULL) out->append(groups[n].begin(), groups[n].end());
+    }
+    p = q + 1;
+  }
+}
+
+/* the greatest group referred to in rewrite, false if an escape is bad. */
+static bool ScanRewrite(const Regen::StringPiece &rewrite, std::size_t *max_group, std::string *error)
+{
+  *max_group = 0;
+  for (const char *p = rewrite.begin(); p < rewrite.end(); p++) {
+    if (*p != '\\') continue;
+    if (++p == rewrite.end()) {
+      if (error != NULL) *error = "Rewrite ends with '\\'.";
+      return false;
+    }
+    if ('0' <= *p && *p <= '9') {
+      *max_group = std::max(*max_group, (std::size_t)(*p - '0'));
+    } else if (*p != '\\') {
+      if (error != NULL) *error = "Invalid escape in rewrite.";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Matcher::CheckRewrite(const Regen::StringPiece &rewrite, std::string *error) const
+{
+  std::size_t max_group;
+  if (!ScanRewrite(rewrite, &max_group, error)) return false;
+  const Capture *capture = max_group > 0 ? program_->capture() : NULL;
+  if (max_group > 0 && (capture == NULL || max_group > capture->group_num())) {
+    if (error != NULL) *error = "Invalid group reference in rewrite.";
+    return false;
+  }
+  return true;
+}
+
+std::size_t Matcher::GlobalReplace(const Regen::StringPiece &string, const Regen::StringPiece &rewrite, std::string *out) const
+{
+  std::size_t max_group;
+  if (!CheckRewrite(rewrite)) return std::string::npos;
+  ScanRewrite(rewrite, &max_group, NULL);
+
+  out->reserve(out->size() + string.size());
+  std::vector<Regen::StringPiece> groups(1);
+  Regen::StringPiece rest(string), result;
+  std::size_t count = 0;
+  while (Match(rest, &result)) {
+    if (!program_->flag().captured_match()) ResolveBegin(rest, &result);
+    groups[0] = result;
+    if (max_group > 0) program_->capture()->Match(result, &groups);
+    out->append(rest.begin(), result.begin());
+    Rewrite(rewrite, groups, out);
+    count++;
+    /* same progression as FindAll. */
+    const char *next = result.end();
+    if (next == rest.end()) {
+      rest.set_begin(next);
+      break;
+    }
+    if (result.empty()) out->push_back(*next++);
+    rest.set_begin(next);
+  }
+  out->append(rest.begin(), rest.end());
+  return count;
+}
+
+bool Matcher::Consume(Regen::StringPiece* input, Regen::StringPiece* result) const
+{
+  const Program &p = *program_;
+  const Regen::Options &flag = p.flag();
+  const char *end = NULL;
+  Regen::StringPiece match;
+  if (p.literal() != NULL) {
+    end = p.literal()->MatchPrefix(*input);
+  } else if (!flag.prefix_match() || flag.suffix_match() || flag.reverse_match()) {
+    /* needs Prefix-anchored and Suffix-free matching. */
+    Regen::Options opt(flag);
+    opt.filtered_match(false);
+    opt.captured_match(false);
+    opt.reverse(false);
+    opt.prefix_match(true);
+    opt.suffix_match(false);
+    if (BuildOnce(&consume_regex_, &consume_once_, opt)->Match(*input, &match)) end = match.end();
+  } else {
+    /* the engines of Match, so the automata of a complete Program are
+     * only read (cached Programs are shared between threads). */
+    bool matched;
+    if (p.bitparallel() != NULL) {
+      matched = p.bitparallel()->Match(*input, &match);
+    } else if (p.counting() != NULL) {
+      matched = p.counting()->Match(*input, &match);
+    } else {
+      matched = Automaton(p.regex(), &dfa_).Match(*input, &match);
+    }
+    if (matched) end = match.end();
+  }
+  if (end == NULL) return false;
+  if (result != NULL) result->set(input->begin(), end);
+  input->set_begin(end);
+  return true;
+}
+
+} // namespace regen
@@ -0,0 +1,54 @@
+#ifndef REGEN_MATCHER_H_
+#define  REGEN_MATCHER_H_
+#include "regen.h"
+#include "util.h"
+
+namespace regen {
+
+class Program;
+class DFA;
+
+/* Per-thread match state over a compiled pattern (Program).
+ * the Program is never written while matching, so the Matchers of all
+ * threads share it with no lock and no copy. what matching has to build
+ * is kept here instead:
+ *  - On-The-Fly DFAs, where the Program has no complete automaton: their
+ *    states grow here, over the expressions of the Program (not a copy),
+ *  - the regexes built on demand by FindAll (begins of matches) and
+ *    Consume (anchored matching), each built once per Matcher.
+ * Regen keeps a Matcher of its own for the calls on the Regen itself. */
+class Matcher {
+public:
+  /* refers to the Program of re, which may be deleted before the Matcher. */
+  explicit Matcher(const Regen &re);
+  /* the pattern is compiled once in the cache of the static matchers,
+   * and its Program is referenced (counted) by Matchers. */
+  Matcher(const Regen::StringPiece& pattern, const Regen::Options& opt,
+          Regen::Options::CompileFlag olevel = Regen::Options::O3);
+  explicit Matcher(const Program *program);
+  ~Matcher();
+  bool Match(const Regen::StringPiece& string, Regen::StringPiece* result = NULL) const;
+  bool MatchGroups(const Regen::StringPiece& string, std::vector<Regen::StringPiece>* groups) const;
+  std::size_t FindAll(const Regen::StringPiece& string, std::vector<Regen::StringPiece>* matches) const;
+  std::size_t GlobalReplace(const Regen::StringPiece& string, const Regen::StringPiece& rewrite, std::string* out) const;
+  bool CheckRewrite(const Regen::StringPiece& rewrite, std::string* error = NULL) const;
+  bool Consume(Regen::StringPiece* input, Regen::StringPiece* result = NULL) const;
+  const Program& program() const { return *program_; }
+  /* false if the Program needs On-The-Fly DFAs of this Matcher. */
+  bool shared() const;
+private:
+  const DFA& Automaton(const Regex *regex, DFA **scratch) const;
+  const Regex* BuildOnce(Regex **regex, Once *once, const Regen::Options &opt) const;
+  void ResolveBegin(const Regen::StringPiece& string, Regen::StringPiece* result) const;
+  const Program *program_;
+  mutable DFA *dfa_; // On-The-Fly DFA of the regex (built on demand)
+  mutable DFA *reverse_dfa_; // On-The-Fly DFA of the reverse regex (built on demand)
+  mutable Regex *reverse_regex_; // built on demand by FindAll if not CapturedMatch
+  mutable Once reverse_once_;
+  mutable Regex *consume_regex_; // anchored regex for Consume (built on demand)
+  mutable Once consume_once_;
+  DISALLOW_COPY_AND_ASSIGN(Matcher);
+};
+
+} // namespace regen
+#endif // REGEN_MATCHER_H_
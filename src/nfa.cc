@@ -1,4 +1,5 @@
 #include "nfa.h"
+#include <algorithm>
 
 namespace regen{
 
@@ -7,7 +8,99 @@ NFA::State& NFA::get_new_state() {
   State &s = states_.back();
   s.id = states_.size()-1;
   s.accept = false;
+  compact_ = false;
   return s;
 }
 
+std::size_t NFA::Intern(const Targets &targets) const
+{
+  std::map<Targets, std::size_t>::iterator iter = target_ids_.find(targets);
+  if (iter != target_ids_.end()) return iter->second;
+  target_sets_.push_back(targets);
+  return target_ids_[targets] = target_sets_.size() - 1;
+}
+
+void NFA::AddTransition(state_t src, unsigned char lo, unsigned char hi, const std::set<state_t> &dst)
+{
+  if (lo > hi || dst.empty()) return;
+  added_.push_back(Transition(src, lo, hi, Intern(Targets(dst.begin(), dst.end()))));
+  compact_ = false;
+}
+
+/* merges the added transitions into the edges: the edges of a state, and
+ * the transitions added to it, are cut at the bounds of all their ranges,
+ * and the targets of each piece are unified. */
+void NFA::Compact() const
+{
+  if (compact_) return;
+  std::vector<Transition> transitions;
+  for (state_t s = 0; s + 1 < offsets_.size(); s++) {
+    for (std::size_t i = offsets_[s]; i < offsets_[s+1]; i++) {
+      transitions.push_back(Transition(s, edges_[i].lo, edges_[i].hi, edges_[i].targets));
+    }
+  }
+  transitions.insert(transitions.end(), added_.begin(), added_.end());
+  std::stable_sort(transitions.begin(), transitions.end());
+  added_.clear();
+  edges_.clear();
+  offsets_.assign(1, 0);
+
+  std::size_t t = 0;
+  for (state_t s = 0; s < states_.size(); s++) {
+    std::size_t end = t;
+    while (end < transitions.size() && transitions[end].src == s) end++;
+    std::bitset<257> bounds;
+    for (std::size_t i = t; i < end; i++) {
+      bounds.set(transitions[i].lo);
+      bounds.set(transitions[i].hi + 1);
+    }
+    for (std::size_t lo = 0; lo < 256; ) {
+      std::size_t hi = lo + 1;
+      while (!bounds[hi] && hi < 256) hi++;
+      Targets targets;
+      for (std::size_t i = t; i < end; i++) {
+        if (transitions[i].lo <= lo && lo <= transitions[i].hi) {
+          const Targets &dst = target_sets_[transitions[i].targets];
+          targets.insert(targets.end(), dst.begin(), dst.end());
+        }
+      }
+      if (!targets.empty()) {
+        std::sort(targets.begin(), targets.end());
+        targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+        std::size_t id = Intern(targets);
+        if (edges_.size() > offsets_.back() && edges_.back().targets == id && edges_.back().hi + 1u == lo) {
+          edges_.back().hi = hi - 1;
+        } else {
+          edges_.push_back(Edge(lo, hi - 1, id));
+        }
+      }
+      lo = hi;
+    }
+    offsets_.push_back(edges_.size());
+    t = end;
+  }
+  compact_ = true;
+}
+
+NFA::edge_iterator NFA::edge_begin(state_t state) const
+{
+  Compact();
+  return edges_.empty() ? NULL : &edges_[0] + offsets_[state];
+}
+
+NFA::edge_iterator NFA::edge_end(state_t state) const
+{
+  Compact();
+  return edges_.empty() ? NULL : &edges_[0] + offsets_[state+1];
+}
+
+const NFA::Targets& NFA::Next(state_t state, unsigned char c) const
+{
+  for (edge_iterator e = edge_begin(state); e != edge_end(state); ++e) {
+    if (e->lo <= c && c <= e->hi) return target_sets_[e->targets];
+    if (c < e->lo) break;
+  }
+  return target_sets_[0];
+}
+
 } // namespace regen
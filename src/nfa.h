@@ -4,24 +4,43 @@
 
 namespace regen {
 
+/* NFA over bytes, whose transitions are byte-range edges: the edges of a
+ * state are disjoint ranges [lo, hi] in ascending order, each to a set of
+ * states, and the edges of all the states are in one array (CSR).
+ * sets of states are interned, so that states with the same targets share
+ * them. transitions added since the last query are merged into the edges
+ * on the next one. */
 class NFA {
 public:
   typedef uint32_t state_t;
+  typedef std::vector<state_t> Targets; // sorted
+  struct Edge {
+    Edge(unsigned char lo_, unsigned char hi_, std::size_t targets_): lo(lo_), hi(hi_), targets(targets_) {}
+    unsigned char lo, hi;
+    std::size_t targets; // id of the set of states
+  };
+  typedef const Edge* edge_iterator;
   struct State {
-    std::set<state_t> transition[256];
     std::size_t id;
     bool accept;
-    std::set<state_t> &operator[](std::size_t index) { return transition[index]; }
-    const std::set<state_t> &operator[](std::size_t index) const { return transition[index]; }
   };
   typedef std::deque<State>::iterator iterator;
   typedef std::deque<State>::const_iterator const_iterator;  
 
+  NFA(): compact_(true) { Intern(Targets()); }
   bool empty() const { return states_.empty(); }
   std::size_t size() const { return states_.size(); }
   std::set<state_t>& start_states() { return start_states_; }
   const std::set<state_t>& start_states() const { return start_states_; }
   State& get_new_state();
+  /* src moves to the states of dst on the bytes [lo, hi] (in addition to its other transitions). */
+  void AddTransition(state_t src, unsigned char lo, unsigned char hi, const std::set<state_t> &dst);
+
+  edge_iterator edge_begin(state_t state) const;
+  edge_iterator edge_end(state_t state) const;
+  const Targets& targets(std::size_t id) const { return target_sets_[id]; }
+  /* states which state moves to on c. */
+  const Targets& Next(state_t state, unsigned char c) const;
 
   iterator begin() { return states_.begin(); }
   iterator end() { return states_.end(); }
@@ -32,8 +51,23 @@ public:
   const State &operator[](std::size_t index) const { return states_[index]; }
 
 protected:
+  struct Transition {
+    Transition(state_t src_, unsigned char lo_, unsigned char hi_, std::size_t targets_): src(src_), lo(lo_), hi(hi_), targets(targets_) {}
+    bool operator<(const Transition &t) const { return src < t.src; }
+    state_t src;
+    unsigned char lo, hi;
+    std::size_t targets;
+  };
+  std::size_t Intern(const Targets &targets) const;
+  void Compact() const;
   std::deque<State> states_;
   std::set<state_t> start_states_;
+  mutable std::vector<Transition> added_; // not merged yet
+  mutable std::vector<Edge> edges_;
+  mutable std::vector<std::size_t> offsets_; // of the edges of each state (and the end)
+  mutable std::vector<Targets> target_sets_;
+  mutable std::map<Targets, std::size_t> target_ids_;
+  mutable bool compact_;
 };
 
 } // namespace regen
@@ -0,0 +1,189 @@
+#include "product.h"
+
+namespace regen {
+
+/* states of the DFA of an operand, and of a product. */
+static const std::size_t OPERAND_LIMIT = 1000;
+static const std::size_t PRODUCT_LIMIT = 10000;
+
+/* the operand of an Intersection or XOR, without the Operator concatenated to it. */
+Expr* ProductDFA::Operand(Expr *e, bool lhs)
+{
+  BinaryExpr *b = static_cast<BinaryExpr*>(e);
+  return static_cast<BinaryExpr*>(lhs ? b->lhs() : b->rhs())->lhs();
+}
+
+void ProductDFA::Build(Expr *root, const Regen::Options &flag)
+{
+  std::vector<std::pair<Expr*, bool> > stack(1, std::make_pair(root, false));
+  while (!stack.empty()) {
+    Expr *e = stack.back().first;
+    const bool product = e->type() == Expr::kIntersection || e->type() == Expr::kXOR;
+    if (Expr::SuperTypeOf(e) == Expr::kStateExpr) {
+      stack.pop_back();
+      continue;
+    }
+    if (!stack.back().second) {
+      stack.back().second = true;
+      if (product) {
+        stack.push_back(std::make_pair(Operand(e, false), false));
+        stack.push_back(std::make_pair(Operand(e, true), false));
+      } else if (Expr::SuperTypeOf(e) == Expr::kBinaryExpr) {
+        stack.push_back(std::make_pair(static_cast<BinaryExpr*>(e)->rhs(), false));
+        stack.push_back(std::make_pair(static_cast<BinaryExpr*>(e)->lhs(), false));
+      } else {
+        stack.push_back(std::make_pair(static_cast<UnaryExpr*>(e)->lhs(), false));
+      }
+      continue;
+    }
+    stack.pop_back();
+    if (!product) continue;
+    Automaton a;
+    if (!Product(static_cast<BinaryExpr*>(e), flag, &a)) continue;
+    if (e->type() == Expr::kIntersection) {
+      static_cast<Intersection*>(e)->set_product(a);
+    } else {
+      static_cast<XOR*>(e)->set_product(a);
+    }
+  }
+}
+
+/* false if the language of operand depends on where it is in the text
+ * (anchors), on other parts of the regex (back-references, operators of
+ * the intersections and XORs left as they are), or on where a match ends
+ * (non-greedy loops). */
+bool ProductDFA::Compilable(Expr *operand)
+{
+  std::vector<Expr*> stack(1, operand);
+  while (!stack.empty()) {
+    Expr *e = stack.back();
+    stack.pop_back();
+    switch (e->type()) {
+      case Expr::kIntersection:
+        if (static_cast<Intersection*>(e)->product().empty()) return false;
+        continue;
+      case Expr::kXOR:
+        if (static_cast<XOR*>(e)->product().empty()) return false;
+        continue;
+      case Expr::kAnchor: case Expr::kOperator:
+        return false;
+      case Expr::kQmark:
+        if (static_cast<Qmark*>(e)->non_greedy()) return false;
+        break;
+      case Expr::kStar:
+        if (static_cast<Star*>(e)->non_greedy()) return false;
+        break;
+      case Expr::kRepetition:
+        if (static_cast<Repetition*>(e)->non_greedy()) return false;
+        break;
+      default:
+        break;
+    }
+    if (Expr::SuperTypeOf(e) == Expr::kBinaryExpr) {
+      stack.push_back(static_cast<BinaryExpr*>(e)->lhs());
+      stack.push_back(static_cast<BinaryExpr*>(e)->rhs());
+    } else if (Expr::SuperTypeOf(e) == Expr::kUnaryExpr) {
+      stack.push_back(static_cast<UnaryExpr*>(e)->lhs());
+    }
+  }
+  return true;
+}
+
+/* minimized DFA of a copy of operand (in pool) alone. */
+bool ProductDFA::Compile(Expr *operand, ExprPool *pool, DFA *dfa)
+{
+  ExprInfo info;
+  Expr *e = operand->Clone(pool);
+  info.eop = pool->alloc<EOP>();
+  e = pool->alloc<Concat>(e, info.eop);
+  info.expr_root = e;
+  info.pool = pool;
+  e->FillPosition(&info);
+  e->FillTransition(pool);
+  dfa->set_expr_info(info);
+  if (!dfa->Construct(OPERAND_LIMIT)) return false;
+  dfa->Minimize();
+  return true;
+}
+
+static DFA::state_t Next(const DFA &dfa, DFA::state_t state, unsigned char c)
+{
+  return state == DFA::REJECT ? (DFA::state_t)DFA::REJECT : dfa.GetTransition(state)[c];
+}
+
+bool ProductDFA::Product(BinaryExpr *e, const Regen::Options &flag, Automaton *product)
+{
+  Expr *lhs = Operand(e, true), *rhs = Operand(e, false);
+  if (!Compilable(lhs) || !Compilable(rhs)) return false;
+  /* bytes are filtered as by the DFA of the whole regex. */
+  Regen::Options opt(flag.one_line() ? Regen::Options::OneLine : Regen::Options::NoParseFlags, flag.delimiter());
+  ExprPool pool;
+  DFA l(opt), r(opt);
+  if (!Compile(lhs, &pool, &l) || !Compile(rhs, &pool, &r)) return false;
+
+  /* pairs reachable from the start. (for XOR, one of them may have rejected.) */
+  const bool exclusive = e->type() == Expr::kXOR;
+  typedef std::pair<DFA::state_t, DFA::state_t> Pair;
+  std::vector<Pair> states(1, Pair(l.start_state(), r.start_state()));
+  std::map<Pair, std::size_t> ids;
+  ids[states[0]] = 0;
+  std::vector<std::map<std::size_t, std::bitset<256> > > edges;
+  std::vector<bool> accept;
+  for (std::size_t i = 0; i < states.size(); i++) {
+    const Pair state = states[i];
+    std::map<std::size_t, std::bitset<256> > out;
+    for (std::size_t c = 0; c < 256; c++) {
+      const Pair next(Next(l, state.first, c), Next(r, state.second, c));
+      if (exclusive ? next.first == DFA::REJECT && next.second == DFA::REJECT
+          : next.first == DFA::REJECT || next.second == DFA::REJECT) continue;
+      std::map<Pair, std::size_t>::iterator found = ids.find(next);
+      if (found == ids.end()) {
+        if (states.size() >= PRODUCT_LIMIT) return false;
+        found = ids.insert(std::make_pair(next, states.size())).first;
+        states.push_back(next);
+      }
+      out[found->second].set(c);
+    }
+    edges.push_back(out);
+    const bool la = l.IsAcceptState(state.first), ra = r.IsAcceptState(state.second);
+    accept.push_back(exclusive ? la != ra : la && ra);
+  }
+
+  /* pairs which can reach an acceptance, renumbered (the start is kept). */
+  std::vector<std::vector<std::size_t> > sources(states.size());
+  std::vector<std::size_t> queue;
+  std::vector<bool> live(states.size(), false);
+  for (std::size_t s = 0; s < states.size(); s++) {
+    for (std::map<std::size_t, std::bitset<256> >::iterator iter = edges[s].begin(); iter != edges[s].end(); ++iter) {
+      sources[iter->first].push_back(s);
+    }
+    if (accept[s]) {
+      live[s] = true;
+      queue.push_back(s);
+    }
+  }
+  for (std::size_t i = 0; i < queue.size(); i++) {
+    for (std::size_t j = 0; j < sources[queue[i]].size(); j++) {
+      const std::size_t s = sources[queue[i]][j];
+      if (!live[s]) {
+        live[s] = true;
+        queue.push_back(s);
+      }
+    }
+  }
+  std::vector<std::size_t> renumber(states.size(), 0);
+  for (std::size_t s = 0, n = 0; s < states.size(); s++) {
+    if (s == 0 || live[s]) renumber[s] = n++;
+  }
+  for (std::size_t s = 0; s < states.size(); s++) {
+    if (s != 0 && !live[s]) continue;
+    product->edges.push_back(std::vector<Automaton::Edge>());
+    product->accept.push_back(accept[s]);
+    for (std::map<std::size_t, std::bitset<256> >::iterator iter = edges[s].begin(); iter != edges[s].end(); ++iter) {
+      if (live[iter->first]) product->edges.back().push_back(Automaton::Edge(renumber[iter->first], iter->second));
+    }
+  }
+  return true;
+}
+
+} // namespace regen
@@ -0,0 +1,30 @@
+#ifndef REGEN_PRODUCT_H_
+#define  REGEN_PRODUCT_H_
+#include "regen.h"
+#include "util.h"
+#include "expr.h"
+#include "dfa.h"
+
+namespace regen {
+
+/* Intersection (R&S) and XOR (R&&S) by product construction.
+ * with Operator pairs, every subset of the DFA of the whole regex tracks
+ * which operands have reached their end. instead, R and S are compiled to
+ * minimized DFAs apart, and the pairs of their states which are reachable
+ * from the start, and can still reach an acceptance, make an Automaton
+ * held by the node, whose edges are the positions of the node. */
+class ProductDFA {
+public:
+  /* builds the products of the tree, inner ones first. a node keeps its
+   * Operators if its operands contain anchors, back-references or
+   * non-greedy loops, or if their DFAs exceed the limits. */
+  static void Build(Expr *root, const Regen::Options &flag);
+private:
+  static bool Product(BinaryExpr *e, const Regen::Options &flag, Automaton *product);
+  static bool Compile(Expr *operand, ExprPool *pool, DFA *dfa);
+  static bool Compilable(Expr *operand);
+  static Expr* Operand(Expr *e, bool lhs);
+};
+
+} // namespace regen
+#endif // REGEN_PRODUCT_H_
@@ -0,0 +1,125 @@
+#include "program.h"
+#include "regex.h"
+#include "literal.h"
+#include "capture.h"
+#include "counting.h"
+#include "bitparallel.h"
+
+namespace regen {
+
+/* states of the DFA built before bit-parallel matching is preferred. */
+static const std::size_t BITPARALLEL_DFA_LIMIT = 256;
+
+#ifdef REGEN_ENABLE_PARALLEL
+#define REGEN_PROGRAM_LOCK boost::mutex::scoped_lock lock(mutex_)
+#else
+#define REGEN_PROGRAM_LOCK
+#endif
+
+Program::Program(const std::string &regex, const Regen::Options &flag):
+    regex_(NULL), reverse_regex_(NULL), literal_(NULL), inner_(NULL), capture_(NULL),
+    counting_(NULL), bitparallel_(NULL), flag_(flag), refs_(1)
+{
+  regex_ = new Regex(regex, flag_);
+  literal_ = LiteralMatcher::Plan(regex_->expr_info().orig_root, flag_);
+  if (literal_ == NULL) inner_ = InnerLiteralMatcher::Plan(regex_->expr_info().orig_root, flag_);
+  if (flag_.captured_match() && !flag_.prefix_match()
+      && regex_->min_length() != regex_->max_length()) {
+    reverse_regex_ = new Regex(regex, ReverseOptions());
+  }
+  /* On-The-Fly DFAs of Matchers only read the expressions from now on. */
+  regex_->dfa().CompleteNonGreedy(regex_->state_exprs());
+  if (reverse_regex_ != NULL) reverse_regex_->dfa().CompleteNonGreedy(reverse_regex_->state_exprs());
+}
+
+Program::~Program()
+{
+  delete regex_;
+  delete reverse_regex_;
+  delete literal_;
+  delete inner_;
+  delete capture_;
+  delete counting_;
+  delete bitparallel_;
+}
+
+void Program::Ref() const
+{
+  REGEN_PROGRAM_LOCK;
+  refs_++;
+}
+
+void Program::Unref() const
+{
+  {
+    REGEN_PROGRAM_LOCK;
+    if (--refs_ > 0) return;
+  }
+  delete this;
+}
+
+/* the reverse regex finds the begin of a match from its end. */
+Regen::Options Program::ReverseOptions() const
+{
+  Regen::Options opt(flag_);
+  opt.reverse(true);
+  opt.prefix_match(true);
+  opt.suffix_match(false);
+  opt.longest_match(true);
+  opt.captured_match(false);
+  return opt;
+}
+
+bool Program::Compile(Regen::Options::CompileFlag olevel)
+{
+  /* literals are matched without automaton. */
+  if (literal_ != NULL) return true;
+  bool compile;
+  if (olevel != Regen::Options::Onone && !regex_->dfa().Complete() && counting_ == NULL && bitparallel_ == NULL) {
+    /* the DFA is built within a small budget first: beyond it, positions
+     * which fit in bits are simulated without building more states. if the
+     * DFA explodes, bounded repetitions are counted instead. */
+    compile = regex_->Compile(olevel, BITPARALLEL_DFA_LIMIT);
+    if (!regex_->dfa().Complete()) bitparallel_ = BitParallelMatcher::Plan(*regex_, flag_);
+    if (bitparallel_ == NULL) {
+      compile = regex_->Compile(olevel);
+      if (!regex_->dfa().Complete()) counting_ = CountingMatcher::Plan(regex_->expr_info().orig_root, flag_);
+    }
+  } else {
+    compile = regex_->Compile(olevel);
+  }
+  if (reverse_regex_ != NULL) {
+    compile &= reverse_regex_->Compile(olevel);
+  }
+  if (inner_ != NULL) {
+    compile &= inner_->Compile(olevel);
+  }
+  return compile;
+}
+
+bool Program::Complete() const
+{
+  if (literal_ != NULL) return true;
+  return (regex_->dfa().Complete() || counting_ != NULL || bitparallel_ != NULL)
+      && (reverse_regex_ == NULL || reverse_regex_->dfa().Complete())
+      && (inner_ == NULL || inner_->Complete());
+}
+
+struct PlanCapture {
+  PlanCapture(Capture **capture_, const Regex *regex_, const Regen::Options &flag_): capture(capture_), regex(regex_), flag(flag_) {}
+  void operator()() const { *capture = Capture::Plan(regex->expr_info().orig_root, regex->groups(), flag); }
+  Capture **capture;
+  const Regex *regex;
+  Regen::Options flag;
+};
+
+/* the Capture (one copy of a counted repetition per iteration) is planned
+ * on the first submatch request, not for every pattern with groups.
+ * it's never written after that, so Matchers share it. */
+const Capture* Program::capture() const
+{
+  capture_once_.Call(PlanCapture(&capture_, regex_, flag_));
+  return capture_;
+}
+
+} // namespace regen
@@ -0,0 +1,58 @@
+#ifndef REGEN_PROGRAM_H_
+#define  REGEN_PROGRAM_H_
+#include "regen.h"
+#include "util.h"
+#ifdef REGEN_ENABLE_PARALLEL
+#include <boost/thread/mutex.hpp>
+#endif
+
+namespace regen {
+
+/* Compiled pattern: the automata of a Regen (DFA tables, JIT code, literal
+ * and bit-parallel stand-ins), shared by the Regen and all its Matchers.
+ * nothing in it is written after Compile, so threads match with it without
+ * locks. what matching builds (On-The-Fly DFA states, regexes built on
+ * demand) is kept by each Matcher instead (see matcher.h).
+ * reference counted: the Regen and each Matcher of it hold a reference,
+ * the last Unref deletes it. */
+class Program {
+public:
+  Program(const std::string &regex, const Regen::Options &flag);
+  void Ref() const;
+  void Unref() const;
+  /* must be done before the Program is shared between threads. */
+  bool Compile(Regen::Options::CompileFlag olevel);
+  /* true if every automaton of the Program is complete (or stood in for by
+   * counters or bits), so no public method of a Matcher writes it. */
+  bool Complete() const;
+  /* planned once, on the first submatch request (NULL: no submatches). */
+  const Capture* capture() const;
+  /* options of a regex which finds the begin of a match from its end. */
+  Regen::Options ReverseOptions() const;
+  const Regen::Options& flag() const { return flag_; }
+  const Regex* regex() const { return regex_; }
+  const Regex* reverse_regex() const { return reverse_regex_; }
+  const LiteralMatcher* literal() const { return literal_; }
+  const InnerLiteralMatcher* inner() const { return inner_; }
+  const CountingMatcher* counting() const { return counting_; }
+  const BitParallelMatcher* bitparallel() const { return bitparallel_; }
+private:
+  ~Program();
+  Regex *regex_;
+  Regex *reverse_regex_; // for CapturedMatch, if match lengths vary
+  LiteralMatcher *literal_; // non-NULL if the pattern is a literal (set)
+  InnerLiteralMatcher *inner_; // non-NULL if partial matching is driven by an inner literal
+  mutable Capture *capture_; // non-NULL if submatches can be extracted (planned on demand)
+  mutable Once capture_once_;
+  CountingMatcher *counting_; // non-NULL if the DFA exceeded its limit, counters stand in for it
+  BitParallelMatcher *bitparallel_; // non-NULL if the DFA exceeded its limit, and the positions fit in 256 bits
+  Regen::Options flag_;
+  mutable std::size_t refs_;
+#ifdef REGEN_ENABLE_PARALLEL
+  mutable boost::mutex mutex_;
+#endif
+  DISALLOW_COPY_AND_ASSIGN(Program);
+};
+
+} // namespace regen
+#endif // REGEN_PROGRAM_H_
@@ -1,5 +1,13 @@
 #include "regen.h"
 #include "regex.h"
+#include "ahocorasick.h"
+#include "cache.h"
+#include "program.h"
+#include "matcher.h"
+#ifdef REGEN_ENABLE_PARALLEL
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#endif
 
 namespace regen {
 
@@ -11,7 +19,7 @@ Regen::Options::Options(Regen::Options::ParseFlag flag, const unsigned char deli
     captured_match_(false), filtered_match_(false),
     complement_ext_(false), intersection_ext_(false), recursion_ext_(false), xor_ext_(false), shuffle_ext_(false),
     permutation_ext_(false), reverse_ext_(false), weakbackref_ext_(false),
-    encoding_utf8_(false), non_nullable_(false),
+    encoding_utf8_(false), non_nullable_(false), nosimplify_(false), noproduct_dfa_(false),
     delimiter_(delimiter)
 {
   shortest_match_ = flag & ShortestMatch;
@@ -34,59 +42,114 @@ Regen::Options::Options(Regen::Options::ParseFlag flag, const unsigned char deli
   weakbackref_ext_ = flag & WeakBackRefExt;
   encoding_utf8_ = flag & EncodingUTF8;
   non_nullable_ = flag & NonNullable;
+  nosimplify_ = flag & NoSimplify;
+  noproduct_dfa_ = flag & NoProductDFA;
 }
 
 Regen::Regen(const std::string &regex, const Regen::Options options):
-    regex_(NULL), reverse_regex_(NULL), flag_(options)
-{
-  regex_ = new Regex(regex, flag_);
-  if (flag_.captured_match() && !flag_.prefix_match()
-      && regex_->min_length() != regex_->max_length()) {
-    Options opt(flag_);
-    opt.reverse(true);
-    opt.prefix_match(true);
-    opt.suffix_match(false);
-    opt.longest_match(true);
-    opt.captured_match(false);
-    reverse_regex_ = new Regex(regex, opt);
-  }
+    program_(new Program(regex, options)), matcher_(NULL)
+{
+  matcher_ = new Matcher(program_);
 }
 
 Regen::~Regen()
 {
-  delete regex_;
-  delete reverse_regex_;
+  delete matcher_;
+  program_->Unref();
 }
 
 bool Regen::Compile(Options::CompileFlag olevel)
 {
-  bool compile = regex_->Compile(olevel);
-  if (reverse_regex_ != NULL) {
-    compile &= reverse_regex_->Compile(olevel);
-  }
-  return compile;
+  return program_->Compile(olevel);
 }
 
 bool Regen::Match(const StringPiece &string, StringPiece *result) const
 {
-  if (result != NULL && flag_.captured_match()) {
-    bool match = regex_->Match(string, result);
-    if (result->end() != NULL) {
-      if (flag_.suffix_match()) {
-        result->set_begin(string.begin());
-      } else if (flag_.prefix_match()) {
-        result->set_begin(string.begin());
-      } else if (reverse_regex_ == NULL) {
-        result->set_begin(result->end() - regex_->min_length());
-      } else {
-        StringPiece string_(string.begin(), result->end());
-        reverse_regex_->Match(string_, result);
-      }
+  return matcher_->Match(string, result);
+}
+
+std::size_t Regen::FindAll(const StringPiece &string, std::vector<StringPiece> *matches) const
+{
+  return matcher_->FindAll(string, matches);
+}
+
+bool Regen::MatchGroups(const StringPiece &string, std::vector<StringPiece> *groups) const
+{
+  return matcher_->MatchGroups(string, groups);
+}
+
+bool Regen::CheckRewrite(const StringPiece &rewrite, std::string *error) const
+{
+  return matcher_->CheckRewrite(rewrite, error);
+}
+
+std::size_t Regen::GlobalReplace(const StringPiece &string, const StringPiece &rewrite, std::string *out) const
+{
+  return matcher_->GlobalReplace(string, rewrite, out);
+}
+
+bool Regen::Complete() const
+{
+  return program_->Complete();
+}
+
+void Regen::MatchBatchTask(const StringPiece *records, std::size_t begin, std::size_t end,
+                           unsigned char *bitmap, StringPiece *results, std::size_t *count,
+                           bool parallel) const
+{
+  /* worker threads match with their own state (see Matcher). */
+  Matcher *matcher = parallel ? new Matcher(program_) : NULL;
+  const Matcher &re = matcher != NULL ? *matcher : *matcher_;
+  std::size_t count_ = 0;
+  for (std::size_t i = begin; i < end; i++) {
+    StringPiece *result = NULL;
+    if (results != NULL) {
+      result = &results[i];
+      result->clear();
     }
-    return match;
-  } else {
-    return regex_->Match(string, result);    
+    if (re.Match(records[i], result)) {
+      if (bitmap != NULL) bitmap[i / 8] |= 1 << (i % 8);
+      count_++;
+    }
+  }
+  *count = count_;
+  delete matcher;
+}
+
+std::size_t Regen::MatchBatch(const StringPiece *records, std::size_t num, unsigned char *bitmap,
+                              StringPiece *results, std::size_t thread_num) const
+{
+  if (bitmap != NULL) memset(bitmap, 0, (num + 7) / 8);
+  std::size_t count = 0;
+#ifdef REGEN_ENABLE_PARALLEL
+  if (thread_num == 0) thread_num = boost::thread::hardware_concurrency();
+  /* records are dealt in blocks so that threads never share a byte
+   * (nor a cache line) of bitmap. */
+  const std::size_t block_size = 512;
+  const std::size_t block_num = (num + block_size - 1) / block_size;
+  if (thread_num > block_num) thread_num = block_num;
+  if (thread_num > 1) {
+    std::vector<std::size_t> counts(thread_num);
+    std::vector<boost::thread*> threads(thread_num);
+    std::size_t begin = 0;
+    for (std::size_t i = 0; i < thread_num; i++) {
+      std::size_t end = block_num * (i + 1) / thread_num * block_size;
+      if (end > num) end = num;
+      threads[i] = new boost::thread(
+          boost::bind(&regen::Regen::MatchBatchTask, this,
+                      records, begin, end, bitmap, results, &counts[i], true));
+      begin = end;
+    }
+    for (std::size_t i = 0; i < thread_num; i++) {
+      threads[i]->join();
+      delete threads[i];
+      count += counts[i];
+    }
+    return count;
   }
+#endif
+  MatchBatchTask(records, 0, num, bitmap, results, &count, false);
+  return count;
 }
 
 bool Regen::FullMatch(const StringPiece& string, const StringPiece& pattern, StringPiece *result)
@@ -97,9 +160,10 @@ bool Regen::FullMatch(const StringPiece& string, const StringPiece& pattern, Str
 bool Regen::FullMatch(const StringPiece& string, const StringPiece &pattern, Options opt, StringPiece *result)
 {
   opt.full_match(true);
-  Regex re(pattern, opt);
-  re.Compile();
-  return re.Match(string, result);
+  RegenCache::Entry *entry = RegenCache::Shared().Acquire(pattern, opt, Options::O3);
+  bool match = entry->regen->Match(string, result);
+  RegenCache::Shared().Release(entry);
+  return match;
 }
 
 bool Regen::PartialMatch(const StringPiece& string, const StringPiece &pattern, StringPiece *result)
@@ -110,19 +174,153 @@ bool Regen::PartialMatch(const StringPiece& string, const StringPiece &pattern,
 bool Regen::PartialMatch(const StringPiece& string, const StringPiece& pattern, Options opt, StringPiece *result)
 {
   opt.partial_match(true);
-  Regex re(pattern, opt);
-  re.Compile();
-  return re.Match(string, result);
+  RegenCache::Entry *entry = RegenCache::Shared().Acquire(pattern, opt, Options::O3);
+  bool match = entry->regen->Match(string, result);
+  RegenCache::Shared().Release(entry);
+  return match;
+}
+
+void Regen::SetCacheCapacity(std::size_t capacity)
+{
+  RegenCache::Shared().set_capacity(capacity);
 }
 
-bool Regen::Consume(const StringPiece& string, const StringPiece& pattern, StringPiece* result)
+std::size_t Regen::CacheHits()
 {
-  return false;
+  return RegenCache::Shared().hits();
 }
 
-bool Regen::Consume(const StringPiece& string, const StringPiece& pattern, Options opt, StringPiece* result)
+std::size_t Regen::CacheMisses()
 {
-  return false;
+  return RegenCache::Shared().misses();
+}
+
+bool Regen::Consume(StringPiece* input, StringPiece* result) const
+{
+  return matcher_->Consume(input, result);
+}
+
+bool Regen::Consume(StringPiece* input, const StringPiece& pattern, StringPiece* result)
+{
+  return Consume(input, pattern, DefaultOptions, result);
+}
+
+bool Regen::Consume(StringPiece* input, const StringPiece& pattern, Options opt, StringPiece* result)
+{
+  /* the options of Consume itself, so no regex is built on demand
+   * for a cached Regen. */
+  opt.prefix_match(true);
+  opt.suffix_match(false);
+  opt.reverse(false);
+  RegenCache::Entry *entry = RegenCache::Shared().Acquire(pattern, opt, Options::O3);
+  bool match = entry->regen->Consume(input, result);
+  RegenCache::Shared().Release(entry);
+  return match;
+}
+
+RegenSet::RegenSet(Regen::Options options):
+    regex_(NULL), prefilter_(NULL), built_(false), flag_(options)
+{
+  /* keyword filter of JIT (FilteredMatch) resets states, it breaks multiple matching. */
+  bool prefix_match = flag_.prefix_match();
+  flag_.filtered_match(false);
+  flag_.prefix_match(prefix_match);
+}
+
+RegenSet::~RegenSet()
+{
+  delete regex_;
+  delete prefilter_;
+  for (std::size_t i = 0; i < filtered_regexes_.size(); i++) {
+    delete filtered_regexes_[i];
+  }
+}
+
+std::size_t RegenSet::Add(const std::string &pattern)
+{
+  if (built_) exitmsg("can't add a pattern after compilation.\n");
+  patterns_.push_back(pattern);
+  return patterns_.size() - 1;
+}
+
+void RegenSet::Build()
+{
+  /* prefiltering pays for large sets only. */
+  const std::size_t prefilter_min_patterns = 8;
+  const std::size_t prefilter_min_keyword = 3;
+
+  built_ = true;
+  std::vector<std::string> patterns;
+  if (patterns_.size() >= prefilter_min_patterns) {
+    prefilter_ = new AhoCorasick();
+    filtered_regexes_.resize(patterns_.size(), NULL);
+    for (std::size_t i = 0; i < patterns_.size(); i++) {
+      Regex *regex = new Regex(std::vector<std::string>(1, patterns_[i]), flag_);
+      std::string keyword = regex->expr_info().key.longest_keyword();
+      if (keyword.size() >= prefilter_min_keyword) {
+        if (flag_.reverse_match()) std::reverse(keyword.begin(), keyword.end());
+        std::size_t id = prefilter_->Add(keyword);
+        if (id >= keyword_patterns_.size()) keyword_patterns_.resize(id + 1);
+        keyword_patterns_[id].push_back(i);
+        filtered_regexes_[i] = regex;
+      } else {
+        delete regex;
+        patterns.push_back(patterns_[i]);
+        regex_ids_.push_back(i);
+      }
+    }
+    prefilter_->Compile();
+  } else {
+    patterns = patterns_;
+    for (std::size_t i = 0; i < patterns_.size(); i++) regex_ids_.push_back(i);
+  }
+  if (!patterns.empty()) regex_ = new Regex(patterns, flag_);
+}
+
+bool RegenSet::Compile(Regen::Options::CompileFlag olevel)
+{
+  if (patterns_.empty()) exitmsg("Empty pattern set.\n");
+  if (!built_) Build();
+  bool compile = true;
+  if (regex_ != NULL) compile &= regex_->Compile(olevel);
+  for (std::size_t i = 0; i < filtered_regexes_.size(); i++) {
+    if (filtered_regexes_[i] != NULL) compile &= filtered_regexes_[i]->Compile(olevel);
+  }
+  return compile;
+}
+
+bool RegenSet::Match(const Regen::StringPiece &string, std::vector<std::size_t> *ids) const
+{
+  if (ids != NULL) ids->clear();
+  if (!built_) exitmsg("RegenSet must be compiled before matching.\n");
+  bool match = false;
+  if (regex_ != NULL) {
+    std::vector<std::size_t> regex_ids;
+    if (regex_->MultiMatch(string, &regex_ids)) {
+      if (ids == NULL) return true;
+      match = true;
+      for (std::size_t i = 0; i < regex_ids.size(); i++) {
+        ids->push_back(regex_ids_[regex_ids[i]]);
+      }
+    }
+  }
+  if (prefilter_ != NULL) {
+    std::vector<bool> seen;
+    if (prefilter_->Match(string, &seen) == 0) return match;
+    for (std::size_t i = 0; i < seen.size(); i++) {
+      if (!seen[i]) continue;
+      for (std::size_t j = 0; j < keyword_patterns_[i].size(); j++) {
+        std::size_t id = keyword_patterns_[i][j];
+        if (filtered_regexes_[id]->MultiMatch(string)) {
+          if (ids == NULL) return true;
+          match = true;
+          ids->push_back(id);
+        }
+      }
+    }
+    if (ids != NULL) std::sort(ids->begin(), ids->end());
+  }
+  return match;
 }
 
 } // namespace regen
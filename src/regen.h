@@ -3,10 +3,21 @@
 
 #include <string>
 #include <string.h>
+#include <vector>
 
 namespace regen {
 
 class Regex;
+class AhoCorasick;
+class LiteralMatcher;
+class InnerLiteralMatcher;
+class Capture;
+class CountingMatcher;
+class BitParallelMatcher;
+class RegenCache;
+class StreamMatcher;
+class Matcher;
+class Program;
 
 class Regen {
 public:
@@ -40,7 +51,9 @@ public:
       | XORExt | ShuffleExt | PermutationExt | ReverseExt | WeakBackRefExt,
       /* Encodings: UTF8 (ASCII is default) */
       EncodingUTF8 = 1 << 18,
-      NonNullable = 1 << 19
+      NonNullable = 1 << 19,
+      NoSimplify = 1 << 20, // keep the parse tree as written (see simplify.h)
+      NoProductDFA = 1 << 21 // & and && by Operator pairs in the DFA (see product.h)
     };
     enum CompileFlag {
       Onone = -1, O0 = 0, O1 = 1, O2 = 2, O3 = 3
@@ -98,6 +111,10 @@ public:
     void encoding_ascii(bool b) { encoding_utf8(!b); }
     bool non_nullable() const { return non_nullable_; }
     void non_nullable(bool b) { non_nullable_ = b; }
+    bool simplify() const { return !nosimplify_; }
+    void simplify(bool b) { nosimplify_ = !b; }
+    bool product_dfa() const { return !noproduct_dfa_; }
+    void product_dfa(bool b) { noproduct_dfa_ = !b; }
     const unsigned char delimiter() const { return delimiter_; }
  private:
     bool shortest_match_;
@@ -120,6 +137,8 @@ public:
     bool weakbackref_ext_;
     bool encoding_utf8_;
     bool non_nullable_;
+    bool nosimplify_;
+    bool noproduct_dfa_;
     const unsigned char delimiter_;
   };
   static const Options DefaultOptions;
@@ -186,15 +205,92 @@ public:
   static bool PartialMatch(const StringPiece &string, const StringPiece& pattern, Options opt, StringPiece *result = NULL);
   static bool PartialMatch(const StringPiece &string, const StringPiece& pattern, StringPiece *result = NULL);
 
-  bool Consume(const StringPiece& string, StringPiece* result = NULL) const;
-  static bool Consume(const StringPiece& string, const Regen& re, StringPiece* result = NULL) { return re.Consume(string, result); }
-  static bool Consume(const StringPiece& string, const StringPiece& pattern, StringPiece* result = NULL);
-  static bool Consume(const StringPiece& string, const StringPiece& pattern, Options opt, StringPiece* result = NULL);
+  /* compiled patterns of the static matchers are kept in an LRU cache
+   * shared by all threads (capacity 0 disables it, default is 64). */
+  static void SetCacheCapacity(std::size_t capacity);
+  static std::size_t CacheHits();
+  static std::size_t CacheMisses();
+
+  /* Match each of records independently, spreading them over thread_num threads
+   * (0: number of hardware threads). the bit (i % 8) of bitmap[i / 8] is set
+   * if records[i] matched, results[i] receives the match bounds if results
+   * is not NULL. returns the number of matched records. */
+  std::size_t MatchBatch(const StringPiece *records, std::size_t num, unsigned char *bitmap,
+                         StringPiece *results = NULL, std::size_t thread_num = 0) const;
+
+  /* successive non-overlapping matches (with their begins, as CapturedMatch)
+   * in one forward pass. returns the number of matches. */
+  std::size_t FindAll(const StringPiece& string, std::vector<StringPiece>* matches) const;
+
+  /* Match with submatches: (*groups)[0] is the match, (*groups)[i] is the last
+   * match of the i-th parenthesized subexpression (cleared if it didn't participate).
+   * patterns with anchors, back-references or operators (&&, ^^, ...) report
+   * the whole match only. */
+  bool MatchGroups(const StringPiece& string, std::vector<StringPiece>* groups) const;
+
+  /* appends string to *out with each of successive non-overlapping matches
+   * (as FindAll) replaced by rewrite, in one pass. in rewrite, \0 stands for
+   * the match, \1-\9 for the groups (as MatchGroups) and \\ for a backslash.
+   * returns the number of replacements, or std::string::npos (and out is
+   * left as is) if rewrite is invalid (see CheckRewrite). */
+  std::size_t GlobalReplace(const StringPiece& string, const StringPiece& rewrite, std::string* out) const;
+
+  /* true if rewrite may be passed to GlobalReplace, else the reason is set
+   * in *error (if not NULL): a bad escape or a group the pattern lacks. */
+  bool CheckRewrite(const StringPiece& rewrite, std::string* error = NULL) const;
+
+  /* Match anchored at the beginning of *input (longest, or shortest if ShortestMatch).
+   * on success, result receives the match and *input is advanced past it. */
+  bool Consume(StringPiece* input, StringPiece* result = NULL) const;
+  static bool Consume(StringPiece* input, const Regen& re, StringPiece* result = NULL) { return re.Consume(input, result); }
+  static bool Consume(StringPiece* input, const StringPiece& pattern, StringPiece* result = NULL);
+  static bool Consume(StringPiece* input, const StringPiece& pattern, Options opt, StringPiece* result = NULL);
+
+private:
+  friend class RegenCache;
+  friend class StreamMatcher;
+  friend class Matcher;
+  /* not copyable, threads share the Program of one Regen through Matchers. */
+  Regen(const Regen&);
+  void operator=(const Regen&);
+  /* true if the automata never change while matching (shareable between threads). */
+  bool Complete() const;
+  void MatchBatchTask(const StringPiece *records, std::size_t begin, std::size_t end,
+                      unsigned char *bitmap, StringPiece *results, std::size_t *count,
+                      bool parallel) const;
+  Program *program_; // the compiled pattern, referenced by Matchers too
+  Matcher *matcher_; // match state of the calls on the Regen itself
+};
+
+/* Multiple patterns matching.
+ * patterns are compiled into one DFA, and each input is scanned once
+ * regardless of the number of patterns.
+ * for large sets, patterns which have a required keyword are excluded from
+ * the DFA and prefiltered by Aho-Corasick automaton of the keywords,
+ * only patterns whose keyword appeared are matched by their own DFA. */
+class RegenSet {
+public:
+  RegenSet(Regen::Options = Regen::Options::NoParseFlags);
+  ~RegenSet();
+  /* returns id of the pattern (0, 1, ...). */
+  std::size_t Add(const std::string &pattern);
+  std::size_t size() const { return patterns_.size(); }
+  bool Compile(Regen::Options::CompileFlag olevel = Regen::Options::O3);
+  /* ids of matched patterns are stored into ids in ascending order. */
+  bool Match(const Regen::StringPiece& string, std::vector<std::size_t> *ids = NULL) const;
 
 private:
+  void Build();
+  std::vector<std::string> patterns_;
   Regex *regex_;
-  Regex *reverse_regex_;
-  Options flag_;
+  std::vector<std::size_t> regex_ids_; // pattern id of each EOP id of regex_
+  AhoCorasick *prefilter_;
+  std::vector<std::vector<std::size_t> > keyword_patterns_;
+  std::vector<Regex*> filtered_regexes_;
+  bool built_;
+  Regen::Options flag_;
+  RegenSet(const RegenSet&);
+  void operator=(const RegenSet&);
 };
 
 inline Regen::Options::ParseFlag operator|(Regen::Options::ParseFlag a, Regen::Options::ParseFlag b)
@@ -209,5 +305,6 @@ inline Regen::Options::ParseFlag& operator&=(Regen::Options::ParseFlag &a, Regen
 } // namespace regen
 
 using regen::Regen;
+using regen::RegenSet;
 
 #endif // REGEN_H_
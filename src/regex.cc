@@ -1,4 +1,6 @@
 #include "regex.h"
+#include "simplify.h"
+#include "product.h"
 
 namespace regen {
 
@@ -8,22 +10,96 @@ Regex::Regex(const Regen::StringPiece& pattern, const Regen::Options flags):
     recursion_depth_(0),
     involved_char_(std::bitset<256>()),
     olevel_(Regen::Options::Onone),
-    dfa_failure_(false),
+    dfa_failure_(0),
     dfa_(flags)
 {
   Parse();
   dfa_.set_expr_info(expr_info_);
 }
 
+static std::string JoinPatterns(const std::vector<std::string> &patterns)
+{
+  std::string regex;
+  for (std::size_t i = 0; i < patterns.size(); i++) {
+    if (i != 0) regex += "|";
+    regex += "(" + patterns[i] + ")";
+  }
+  return regex;
+}
+
+Regex::Regex(const std::vector<std::string>& patterns, const Regen::Options flags):
+    regex_(JoinPatterns(patterns)),
+    flag_(flags),
+    recursion_depth_(0),
+    involved_char_(std::bitset<256>()),
+    olevel_(Regen::Options::Onone),
+    dfa_failure_(0),
+    dfa_(flags)
+{
+  ParseSet(patterns);
+  dfa_.set_expr_info(expr_info_);
+}
+
+Regex::Regex(const std::vector<Expr*>& factors, const Regen::Options flags):
+    regex_(""),
+    flag_(flags),
+    recursion_depth_(0),
+    involved_char_(std::bitset<256>()),
+    olevel_(Regen::Options::Onone),
+    dfa_failure_(0),
+    dfa_(flags)
+{
+  if (factors.empty()) exitmsg("Empty factors.");
+  Expr *e = CloneExpr(factors[0]);
+  for (std::size_t i = 1; i < factors.size(); i++) {
+    e = pool_.alloc<Concat>(e, CloneExpr(factors[i]), flag_.reverse_regex());
+  }
+  Build(e);
+  dfa_.set_expr_info(expr_info_);
+}
+
+Expr* Regex::CloneExpr(Expr *e)
+{
+  switch (e->type()) {
+    case Expr::kConcat: {
+      Concat *c = static_cast<Concat*>(e);
+      return pool_.alloc<Concat>(CloneExpr(c->lhs()), CloneExpr(c->rhs()), flag_.reverse_regex());
+    }
+    case Expr::kUnion: {
+      Union *u = static_cast<Union*>(e);
+      return pool_.alloc<Union>(CloneExpr(u->lhs()), CloneExpr(u->rhs()));
+    }
+    case Expr::kQmark: {
+      Qmark *q = static_cast<Qmark*>(e);
+      return pool_.alloc<Qmark>(CloneExpr(q->lhs()), q->non_greedy(), q->probability());
+    }
+    case Expr::kStar: {
+      Star *s = static_cast<Star*>(e);
+      return pool_.alloc<Star>(CloneExpr(s->lhs()), s->non_greedy(), s->probability());
+    }
+    case Expr::kPlus: {
+      Plus *p = static_cast<Plus*>(e);
+      return pool_.alloc<Plus>(CloneExpr(p->lhs()), p->probability());
+    }
+    case Expr::kRepetition: {
+      Repetition *r = static_cast<Repetition*>(e);
+      Repetition *c = pool_.alloc<Repetition>(CloneExpr(r->lhs()), std::make_pair(r->min(), r->max()),
+                                              r->non_greedy(), flag_.reverse_regex(), &pool_);
+      c->set_probability(r->probability());
+      return c;
+    }
+    default:
+      return e->Clone(&pool_);
+  }
+}
+
 StateExpr* Regex::CombineStateExpr(StateExpr *e1, StateExpr *e2, ExprPool *p)
 {
   StateExpr *s;
-  CharClass *cc = p->alloc<CharClass>(e1, e2);
-  if (cc->count() == 256) {
-    //delete cc;
-    s = p->alloc<Dot>();
-  } else if (cc->count() == 1) {
-    //delete cc;
+  CharClass cc(e1, e2);
+  if (cc.count() == 256) {
+    s = p->share<Dot>();
+  } else if (cc.count() == 1) {
     char c;
     switch (e1->type()) {
       case Expr::kLiteral:
@@ -31,9 +107,9 @@ StateExpr* Regex::CombineStateExpr(StateExpr *e1, StateExpr *e2, ExprPool *p)
         break;
       default: exitmsg("Invalid Expr Type: %d", e1->type());
     }
-    s = p->alloc<Literal>(c);
+    s = p->share<Literal>(c);
   } else {
-    s = cc;
+    s = p->share<CharClass>(cc.table(), cc.negative());
   }
   return s;
 }
@@ -93,10 +169,10 @@ Expr* Regex::PatchBackRef(Lexer *lexer, Expr *e, ExprPool *p)
   return e;
 }
 
-void Regex::Parse()
+Expr* Regex::ParsePattern(const std::string &pattern, std::vector<Expr*> *groups)
 {
-  const unsigned char *begin = (const unsigned char*)regex_.c_str(),
-      *end = begin + regex_.length();
+  const unsigned char *begin = (const unsigned char*)pattern.c_str(),
+      *end = begin + pattern.length();
   Lexer lexer(begin, end, flag_);
   lexer.Consume();
   Expr* e;
@@ -106,7 +182,22 @@ void Regex::Parse()
   if (lexer.token() != Lexer::kEOP) exitmsg("Expected end of pattern.");
 
   if (!lexer.backrefs().empty()) e = PatchBackRef(&lexer, e, &pool_);
+  if (flag_.simplify()) e = Simplifier::Simplify(e, groups != NULL ? &lexer.groups() : NULL, &pool_);
+  if (flag_.product_dfa() && (flag_.intersection_ext() || flag_.xor_ext() || flag_.complement_ext())) {
+    ProductDFA::Build(e, flag_);
+  }
+  if (groups != NULL) *groups = lexer.groups();
 
+  return e;
+}
+
+void Regex::Parse()
+{
+  Build(ParsePattern(regex_, &groups_));
+}
+
+void Regex::Build(Expr *e)
+{
   expr_info_.orig_root = e;
 
   e->set_nonnullable(flag_.non_nullable());
@@ -124,10 +215,66 @@ void Regex::Parse()
   e = pool_.alloc<Concat>(e, expr_info_.eop);
 
   expr_info_.expr_root = e;
+  expr_info_.pool = &pool_;
   e->FillPosition(&expr_info_);
   expr_info_.min_length = expr_info_.orig_root->min_length();
   expr_info_.max_length = expr_info_.orig_root->max_length();
-  e->FillTransition();
+  e->FillTransition(&pool_);
+  NumberStates();
+}
+
+/* positions (NFA states) of the tree, numbered from left to right. */
+void Regex::NumberStates()
+{
+  state_exprs_.clear();
+  expr_info_.expr_root->StateExprs(&state_exprs_);
+  for (std::size_t i = 0; i < state_exprs_.size(); i++) {
+    state_exprs_[i]->set_state_id(i);
+  }
+}
+
+/* Multiple patterns are unified into one expression,
+ * RE ::= (e0_0 EOP_0) | (e0_1 EOP_1) | ...
+ * so a DFA state knows which patterns are accepted in it.
+ * when Suffix-free matching is required, each pattern is followed by
+ * .* to keep its EOP in the state until the end of the input. */
+void Regex::ParseSet(const std::vector<std::string> &patterns)
+{
+  if (patterns.empty()) exitmsg("Empty pattern set.");
+  Expr *e = NULL;
+  std::vector<Expr*> roots;
+  for (std::size_t i = 0; i < patterns.size(); i++) {
+    Expr *p = ParsePattern(patterns[i]);
+    p->set_nonnullable(flag_.non_nullable());
+    if (patterns.size() == 1) p->FillKeywords(&expr_info_.key, &expr_info_.involve);
+    roots.push_back(p);
+    if (!flag_.suffix_match()) {
+      Expr *dotstar = pool_.alloc<Star>(pool_.alloc<Dot>(true));
+      p = pool_.alloc<Concat>(p, dotstar, flag_.reverse_regex());
+    }
+    EOP *eop = pool_.alloc<EOP>(i);
+    if (i == 0) expr_info_.eop = eop;
+    p = pool_.alloc<Concat>(p, eop);
+    e = e == NULL ? p : pool_.alloc<Union>(e, p);
+  }
+
+  if (!flag_.prefix_match()) {
+    /* non-greedy .*? will be trimmed on acceptance, so use greedy .* instead. */
+    Expr *dotstar = pool_.alloc<Star>(pool_.alloc<Dot>(true));
+    e = pool_.alloc<Concat>(dotstar, e, flag_.reverse_regex());
+  }
+
+  expr_info_.expr_root = e;
+  expr_info_.pool = &pool_;
+  e->FillPosition(&expr_info_);
+  expr_info_.min_length = roots[0]->min_length();
+  expr_info_.max_length = roots[0]->max_length();
+  for (std::size_t i = 1; i < roots.size(); i++) {
+    expr_info_.min_length = std::min(expr_info_.min_length, roots[i]->min_length());
+    expr_info_.max_length = std::max(expr_info_.max_length, roots[i]->max_length());
+  }
+  e->FillTransition(&pool_);
+  NumberStates();
 }
 
 /* Regen parsing rules
@@ -141,80 +288,162 @@ void Regex::Parse()
  * e6 ::= ATOM | '(' e0 ')' | '!' e0 | '#' e0 # ATOM, grouped, complement, permutation
 */
 
-Expr* Regex::e0(Lexer *lexer, ExprPool *pool)
+/* e0-e4 are parsed by one loop with an explicit stack of frames ('(' and
+ * prefix operators waiting for their operand) rather than by recursion, so
+ * that long or deeply nested patterns don't overflow the call stack.
+ * binary operators are reduced by precedence, from the left. */
+struct ParseFrame {
+  enum Type { kGroup, kComplement, kPermutation, kReverse };
+  ParseFrame(Type type_, std::size_t ngroup_ = 0): type(type_), ngroup(ngroup_), flag(false), pool(NULL) {}
+  Type type;
+  std::vector<Expr*> operands; // kGroup: operands, and operators between them
+  std::vector<std::size_t> operators; // (precedences: 0: shuffle, .., 4: concatenation)
+  std::size_t ngroup; // kGroup: index in groups (except the top level)
+  bool flag; // kComplement: complemented, kReverse: reverse_regex to restore
+  ExprPool *pool; // kPermutation: pool to restore
+};
+
+static const std::size_t NO_OPERATOR = 5;
+
+static std::size_t Precedence(Lexer::Type token)
 {
-  Expr *e, *f;
-  e = e1(lexer, pool);
-
-  while (lexer->token() == Lexer::kShuffle) {
-    lexer->Consume();
-    f = e1(lexer, pool);
-    e = Expr::Shuffle(e, f, pool);
+  switch (token) {
+    case Lexer::kShuffle: return 0;
+    case Lexer::kXOR: return 1;
+    case Lexer::kUnion: return 2;
+    case Lexer::kIntersection: return 3;
+    default: return NO_OPERATOR;
   }
-
-  return e;
 }
 
-Expr* Regex::e1(Lexer *lexer, ExprPool *pool)
+/* reduces operators of the frame which bind at least as tight as precedence. */
+static void Reduce(ParseFrame *f, std::size_t precedence, bool reverse, ExprPool *pool)
 {
-  Expr *e, *f;
-  e = e2(lexer, pool);
-
-  while (lexer->token() == Lexer::kXOR) {
-    lexer->Consume();
-    f = e2(lexer, pool);
-    e = pool->alloc<XOR>(e, f, pool);
+  while (!f->operators.empty() && f->operators.back() >= precedence) {
+    Expr *rhs = f->operands.back();
+    f->operands.pop_back();
+    Expr *lhs = f->operands.back(), *e;
+    switch (f->operators.back()) {
+      case 0: e = Expr::Shuffle(lhs, rhs, pool); break;
+      case 1: e = pool->alloc<XOR>(lhs, rhs, pool); break;
+      case 2: e = pool->alloc<Union>(lhs, rhs); break;
+      case 3: e = pool->alloc<Intersection>(lhs, rhs, pool); break;
+      default: e = pool->alloc<Concat>(lhs, rhs, reverse); break;
+    }
+    f->operands.back() = e;
+    f->operators.pop_back();
   }
-
-  return e;
 }
 
-Expr* Regex::e2(Lexer *lexer, ExprPool *pool)
+Expr* Regex::e0(Lexer *lexer, ExprPool *pool)
 {
-  Expr *e, *f;
-  e = e3(lexer, pool);
+  std::vector<ParseFrame> stack(1, ParseFrame(ParseFrame::kGroup));
 
-  while (lexer->token() == Lexer::kUnion) {
-    lexer->Consume();
-    f = e3(lexer, pool);
-    e = pool->alloc<Union>(e, f);
-  }
-
-  return e;
-}
+  for (;;) {
+    Expr *e;
+    /* '(' and prefix operators open a frame for their operand. */
+    switch (lexer->token()) {
+      case Lexer::kLpar: {
+        lexer->Consume();
+        std::size_t ngroup = lexer->groups().size();
+        lexer->groups().push_back(0);
+        if (lexer->token() != Lexer::kRpar) {
+          stack.push_back(ParseFrame(ParseFrame::kGroup, ngroup));
+          continue;
+        }
+        e = pool->alloc<Epsilon>();
+        lexer->groups()[ngroup] = e;
+        lexer->Consume();
+        break;
+      }
+      case Lexer::kComplement: {
+        ParseFrame f(ParseFrame::kComplement);
+        do {
+          f.flag = !f.flag;
+          lexer->Consume();
+        } while (lexer->token() == Lexer::kComplement);
+        stack.push_back(f);
+        continue;
+      }
+      case Lexer::kPermutation: {
+        lexer->Consume();
+        ParseFrame f(ParseFrame::kPermutation);
+        f.pool = pool;
+        pool = new ExprPool();
+        stack.push_back(f);
+        continue;
+      }
+      case Lexer::kReverse: {
+        lexer->Consume();
+        ParseFrame f(ParseFrame::kReverse);
+        f.flag = flag_.reverse_regex();
+        flag_.reverse_regex(!f.flag);
+        stack.push_back(f);
+        continue;
+      }
+      default:
+        e = e6(lexer, pool);
+        break;
+    }
 
-Expr* Regex::e3(Lexer *lexer, ExprPool *pool)
-{
-  Expr *e, *f;
-  e = e4(lexer, pool);
+    /* e is a complete e6: apply the frames it completes. */
+    for (;;) {
+      while (stack.back().type != ParseFrame::kGroup) {
+        ParseFrame &f = stack.back();
+        switch (f.type) {
+          case ParseFrame::kComplement:
+            if (!f.flag) break;
+            if (e->type() == Expr::kNone) {
+              e = pool->alloc<Star>(pool->alloc<Dot>());
+            } else {
+              Expr *dotstar = pool->alloc<Star>(pool->alloc<Dot>());
+              e = pool->alloc<XOR>(dotstar, e, pool); /* R xor .* == !R */
+            }
+            break;
+          case ParseFrame::kPermutation:
+            e = Expr::Permutation(e, f.pool);
+            delete pool;
+            pool = f.pool;
+            break;
+          case ParseFrame::kReverse:
+            flag_.reverse_regex(f.flag);
+            break;
+          default:
+            break;
+        }
+        stack.pop_back();
+      }
 
-  while (lexer->token() == Lexer::kIntersection) {
-    lexer->Consume();
-    f = e4(lexer, pool);
-    e = pool->alloc<Intersection>(e, f, pool);
-  }
-  
-  return e;
-}
+      e = e5(lexer, pool, e);
+      ParseFrame &f = stack.back();
+      f.operands.push_back(e);
 
-Expr* Regex::e4(Lexer *lexer, ExprPool *pool)
-{
-  Expr *e, *f;
-  e = e5(lexer, pool);
+      if (lexer->Concatenated()) {
+        Reduce(&f, 4, flag_.reverse_regex(), pool);
+        f.operators.push_back(4);
+        break;
+      }
+      std::size_t precedence = Precedence(lexer->token());
+      if (precedence != NO_OPERATOR) {
+        lexer->Consume();
+        Reduce(&f, precedence, flag_.reverse_regex(), pool);
+        f.operators.push_back(precedence);
+        break;
+      }
 
-  while (lexer->Concatenated()) {
-    f = e5(lexer, pool);
-    e = pool->alloc<Concat>(e, f, flag_.reverse_regex());
+      Reduce(&f, 0, flag_.reverse_regex(), pool);
+      e = f.operands.back();
+      if (stack.size() == 1) return e;
+      if (lexer->token() != Lexer::kRpar) exitmsg("expected a ')'");
+      lexer->groups()[f.ngroup] = e;
+      lexer->Consume();
+      stack.pop_back();
+    }
   }
-
-  return e;
 }
 
-Expr* Regex::e5(Lexer *lexer, ExprPool *pool)
+Expr* Regex::e5(Lexer *lexer, ExprPool *pool, Expr *e)
 {
-  Expr *e;
-  e = e6(lexer, pool);
-
   while (lexer->Quantifier()) {
     bool non_greedy = false;
     Lexer::Type token = lexer->token();
@@ -244,38 +473,14 @@ Expr* Regex::e5(Lexer *lexer, ExprPool *pool)
       }
       case Lexer::kRepetition: {
         std::pair<int, int> r = lexer->repetition();
-        int lower_repetition = r.first, upper_repetition = r.second;
-        if (lower_repetition == 0 && upper_repetition == 0) {
-          //delete e;
+        if (r.first == 0 && r.second == 0) {
           e = pool->alloc<Epsilon>();
-        } else if (upper_repetition == -1) {
-          Expr* f = e;
-          for (int i = 0; i < lower_repetition - 1; i++) {
-            e = pool->alloc<Concat>(e, f->Clone(pool), flag_.reverse_regex());
-          }
-          e = pool->alloc<Concat>(e, pool->alloc<Star>(f->Clone(pool), non_greedy, probability), flag_.reverse_regex());
-        } else if (upper_repetition == lower_repetition) {
-          Expr *f;
-          if (probability == 0.0) {
-            f = e;
-          } else {
-            f = pool->alloc<Qmark>(e, non_greedy, probability);
-          }
-          for (int i = 0; i < lower_repetition - 1; i++) {
-            e = pool->alloc<Concat>(e, f->Clone(pool), flag_.reverse_regex());
-          }
+        } else if (flag_.weakbackref_ext()) {
+          /* back-references are patched on the first copy of a group. */
+          e = Repetition::Expand(e, r, non_greedy, probability, flag_.reverse_regex(), pool);
         } else {
-          Expr *f = e;
-          for (int i = 0; i < lower_repetition - 1; i++) {
-            e = pool->alloc<Concat>(e, f->Clone(pool), flag_.reverse_regex());
-          }
-          if (lower_repetition == 0) {
-            e = pool->alloc<Qmark>(e, non_greedy, probability);
-            lower_repetition++;
-          }
-          for (int i = 0; i < (upper_repetition - lower_repetition); i++) {
-            e = pool->alloc<Concat>(e, pool->alloc<Qmark>(f->Clone(pool), non_greedy, probability), flag_.reverse_regex());
-          }
+          e = pool->alloc<Repetition>(e, r, non_greedy, flag_.reverse_regex(), pool);
+          static_cast<Repetition*>(e)->set_probability(probability);
         }
         break;
       }
@@ -380,51 +585,6 @@ Expr* Regex::e6(Lexer *lexer, ExprPool *pool)
       }
       break;
     }
-    case Lexer::kLpar: {
-      lexer->Consume();
-      std::size_t ngroup = lexer->groups().size();
-      lexer->groups().push_back(0);
-      if (lexer->token() == Lexer::kRpar) {
-        e = pool->alloc<Epsilon>();
-      } else {
-        e = e0(lexer, pool);
-      }
-      if (lexer->token() != Lexer::kRpar) exitmsg("expected a ')'");
-      lexer->groups()[ngroup] = e;
-      break;
-    }
-    case Lexer::kComplement: {
-      bool complement = false;
-      do {
-        complement = !complement;
-        lexer->Consume();
-      } while (lexer->token() == Lexer::kComplement);
-      e = e6(lexer, pool);
-      if (complement) {
-        if (e->type() == Expr::kNone) {
-          //delete e;
-          return pool->alloc<Star>(pool->alloc<Dot>());
-        }
-        Expr *dotstar = pool->alloc<Star>(pool->alloc<Dot>());
-        e = pool->alloc<XOR>(dotstar, e, pool); /* R xor .* == !R */
-      }
-      return e;
-    }
-    case Lexer::kPermutation: {
-      lexer->Consume();
-      ExprPool tmp_pool;
-      e = e6(lexer, &tmp_pool);
-      e = Expr::Permutation(e, pool);
-      return e;
-    }
-    case Lexer::kReverse: {
-      lexer->Consume();
-      bool reverse = flag_.reverse_regex();
-      flag_.reverse_regex(!reverse);
-      e = e6(lexer, pool);
-      flag_.reverse_regex(reverse);
-      return e;
-    }
     case Lexer::kRecursion: {
       lexer->Consume();
       std::pair<int, int> recursion_limit;
@@ -519,6 +679,9 @@ CharClass* Regex::BuildCharClass(Lexer *lexer, CharClass *cc)
 
 // Converte DFA to Regular Expression using GNFA.
 // see http://en.wikipedia.org/wiki/Generalized_nondeterministic_finite-state_machine
+/* regex of the DFA, by state elimination. the expressions of the paths
+ * through eliminated states are hash-consed (see ExprPool::share), so
+ * the result is a DAG of the subexpressions rather than a tree of copies. */
 void Regex::CreateRegexFromDFA(const DFA &dfa, ExprInfo *info, ExprPool *p)
 {
   int GSTART  = dfa.size();
@@ -541,7 +704,7 @@ void Regex::CreateRegexFromDFA(const DFA &dfa, ExprInfo *info, ExprPool *p)
           }
           int end = c;
           if (begin == 0 && end == 255) {
-            e = p->alloc<Dot>();
+            e = p->share<Dot>();
           } else {
             std::bitset<256> table;
             bool negative = false;
@@ -552,10 +715,10 @@ void Regex::CreateRegexFromDFA(const DFA &dfa, ExprInfo *info, ExprPool *p)
               negative = true;
               table.flip();
             }
-            e = p->alloc<CharClass>(table, negative);
+            e = p->share<CharClass>(table, negative);
           }
         } else {
-          e = p->alloc<Literal>(c);
+          e = p->share<Literal>(c);
         }
         if (gtransition.find(next) != gtransition.end()) {
           Expr* f = gtransition[next];
@@ -566,7 +729,7 @@ void Regex::CreateRegexFromDFA(const DFA &dfa, ExprInfo *info, ExprPool *p)
             //delete f;
             e = e_;
           } else {
-            e = p->alloc<Union>(e, f);
+            e = p->share<Union>(e, f);
           }
         }
         gtransition[next] = e;
@@ -577,7 +740,7 @@ void Regex::CreateRegexFromDFA(const DFA &dfa, ExprInfo *info, ExprPool *p)
   for (std::size_t i = 0; i < dfa.size(); i++) {
     if (dfa.IsAcceptOrEndlineState(i)) {
       if (dfa.IsEndlineState(i)) {
-        gnfa_transition[i][GACCEPT] = p->alloc<Anchor>(Anchor::kEndLine);
+        gnfa_transition[i][GACCEPT] = p->share<Anchor>(Anchor::kEndLine);
       } else {
         gnfa_transition[i][GACCEPT] = NULL;
       }
@@ -590,7 +753,7 @@ void Regex::CreateRegexFromDFA(const DFA &dfa, ExprInfo *info, ExprPool *p)
     Expr* loop = NULL;
     GNFATrans &gtransition = gnfa_transition[i];
     if (gtransition.find(i) != gtransition.end()) {
-      loop = p->alloc<Star>(gtransition[i]);
+      loop = p->share<Star>(gtransition[i]);
       gtransition.erase(i);
     }
     for (int j = i+1; j <= GSTART; j++) {
@@ -602,21 +765,18 @@ void Regex::CreateRegexFromDFA(const DFA &dfa, ExprInfo *info, ExprPool *p)
           Expr* regex2 = (*iter).second;
           if (loop != NULL) {
             if (regex2 != NULL) {
-              regex2 = p->alloc<Concat>(loop, regex2);
+              regex2 = p->share<Concat>(loop, regex2);
             } else {
               regex2 = loop;
             }
           }
           if (regex1 != NULL) {
             if (regex2 != NULL) {
-              regex2 = p->alloc<Concat>(regex1, regex2);
+              regex2 = p->share<Concat>(regex1, regex2);
             } else {
               regex2 = regex1;
             }
           }
-          if (regex2 != NULL) {
-            regex2 = regex2->Clone(p);
-          }
           if (gnfa_transition[j].find((*iter).first) != gnfa_transition[j].end()) {
             if (gnfa_transition[j][(*iter).first] != NULL) {
               if (regex2 != NULL) {
@@ -629,16 +789,16 @@ void Regex::CreateRegexFromDFA(const DFA &dfa, ExprInfo *info, ExprPool *p)
                   //delete f;
                   e = e_;
                 } else {
-                  e = p->alloc<Union>(e, f);
+                  e = p->share<Union>(e, f);
                 }
                 gnfa_transition[j][(*iter).first] = e;
               } else {
                 gnfa_transition[j][(*iter).first] =
-                    p->alloc<Qmark>(gnfa_transition[j][(*iter).first]);
+                    p->share<Qmark>(gnfa_transition[j][(*iter).first]);
               }
             } else {
               if (regex2 != NULL) {
-                gnfa_transition[j][(*iter).first] = p->alloc<Qmark>(regex2);
+                gnfa_transition[j][(*iter).first] = p->share<Qmark>(regex2);
               } else {
                 gnfa_transition[j][(*iter).first] = regex2;
               }
@@ -656,7 +816,7 @@ void Regex::CreateRegexFromDFA(const DFA &dfa, ExprInfo *info, ExprPool *p)
     info->expr_root = p->alloc<None>();
   } else {
     info->eop = p->alloc<EOP>();
-    info->expr_root = p->alloc<Concat>(gnfa_transition[GSTART][GACCEPT], info->eop);
+    info->expr_root = p->share<Concat>(gnfa_transition[GSTART][GACCEPT], info->eop);
   }
 }
 
@@ -671,15 +831,13 @@ void Regex::CreateRegexFromDFA(const DFA &dfa, ExprInfo *info, ExprPool *p)
  *         - faster -
  */
 
-bool Regex::Compile(Regen::Options::CompileFlag olevel) {
+bool Regex::Compile(Regen::Options::CompileFlag olevel, std::size_t limit) {
   if (olevel == Regen::Options::Onone || olevel_ >= olevel) return true;
-  if (!dfa_failure_ && !dfa_.Complete()) {
+  if (!dfa_.Complete() && limit > dfa_failure_) {
     /* try create DFA.  */
-    std::size_t limit = state_exprs_.size();
-    limit = 1000; // default limitation is 1000 (it's may finish within a second).
-    dfa_failure_ = !dfa_.Construct(limit);
+    if (!dfa_.Construct(limit)) dfa_failure_ = limit;
   }
-  if (dfa_failure_) {
+  if (!dfa_.Complete()) {
     /* can not create DFA. (too many states) */
     return false;
   }
@@ -696,6 +854,10 @@ bool Regex::Match(const Regen::StringPiece& string, Regen::StringPiece *result)
   return dfa_.Match(string, result);
 }
 
+bool Regex::MultiMatch(const Regen::StringPiece& string, std::vector<std::size_t> *ids) const {
+  return dfa_.MultiMatch(string, ids);
+}
+
 /* Thompson-NFA based matching */
 bool Regex::NFAMatch(const Regen::StringPiece& string, Regen::StringPiece *result) const
 {
@@ -704,7 +866,7 @@ bool Regex::NFAMatch(const Regen::StringPiece& string, Regen::StringPiece *resul
   std::vector<uint32_t> next_states_flag(nfa_size);
   uint32_t step = 1;
   NFA::iterator iter;
-  std::set<StateExpr*>::iterator next_iter;
+  PositionSet::iterator next_iter;
   NFA states, next_states;
   states.insert(states.begin(), expr_info_.expr_root->transition().first.begin(), expr_info_.expr_root->transition().first.end());
 
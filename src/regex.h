@@ -18,6 +18,10 @@ namespace regen {
 class Regex {
 public:
   Regex(const Regen::StringPiece& regex, const Regen::Options = Regen::Options::NoParseFlags);
+  Regex(const std::vector<std::string>& patterns, const Regen::Options = Regen::Options::NoParseFlags);
+  /* concatenation of factors taken from another Regex (factors are cloned,
+   * and reversed if reverse_regex is set). */
+  Regex(const std::vector<Expr*>& factors, const Regen::Options = Regen::Options::NoParseFlags);
   ~Regex() {}
   void PrintRegex() const;
   static void PrintRegex(const DFA &);
@@ -25,9 +29,12 @@ public:
   void PrintText(Expr::GenOpt, std::size_t n = 1) const;
   static void CreateRegexFromDFA(const DFA &dfa, ExprInfo *info, ExprPool *p);
   void DumpExprTree() const;
-  bool Compile(Regen::Options::CompileFlag olevel = Regen::Options::O3);
+  /* the DFA is built up to limit states (1000 may finish within a second),
+   * a DFA which exceeded a limit is tried again only with a greater one. */
+  bool Compile(Regen::Options::CompileFlag olevel = Regen::Options::O3, std::size_t limit = 1000);
   bool MinimizeDFA() { if (dfa_.Complete()) { dfa_.Minimize(); return true; } else return false; }
   bool Match(const Regen::StringPiece& string, Regen::StringPiece *result = NULL) const;
+  bool MultiMatch(const Regen::StringPiece& string, std::vector<std::size_t> *ids = NULL) const;
   bool NFAMatch(const Regen::StringPiece& string, Regen::StringPiece *result = NULL) const;
   const std::string& regex() const { return regex_; }
   std::size_t max_length() const { return expr_info_.max_length; }
@@ -40,16 +47,19 @@ public:
   Expr* expr_root() const { return expr_info_.expr_root; }
   const ExprInfo& expr_info() const { return expr_info_; }
   const std::vector<StateExpr*> &state_exprs() const { return state_exprs_; }
+  /* parenthesized subexpressions in the order of their '(' (single pattern only). */
+  const std::vector<Expr*> &groups() const { return groups_; }
   static CharClass* BuildCharClass(Lexer *, CharClass *);
 
 private:
   void Parse();
+  void Build(Expr *);
+  void NumberStates();
+  Expr* CloneExpr(Expr *);
+  void ParseSet(const std::vector<std::string>&);
+  Expr* ParsePattern(const std::string&, std::vector<Expr*> *groups = NULL);
   Expr* e0(Lexer *, ExprPool *);
-  Expr* e1(Lexer *, ExprPool *);
-  Expr* e2(Lexer *, ExprPool *);
-  Expr* e3(Lexer *, ExprPool *);
-  Expr* e4(Lexer *, ExprPool *);
-  Expr* e5(Lexer *, ExprPool *);
+  Expr* e5(Lexer *, ExprPool *, Expr *);
   Expr* e6(Lexer *, ExprPool *);
   static StateExpr* CombineStateExpr(StateExpr*, StateExpr*, ExprPool *);
   Expr* PatchBackRef(Lexer *, Expr *, ExprPool *);
@@ -60,6 +70,7 @@ private:
   ExprPool pool_;
   std::size_t recursion_depth_;
   std::vector<StateExpr*> state_exprs_;
+  std::vector<Expr*> groups_;
 
   std::size_t must_max_length_;
   const std::string must_max_word_;
@@ -67,7 +78,7 @@ private:
   std::size_t count_involved_char_;
 
   Regen::Options::CompileFlag olevel_;
-  bool dfa_failure_;
+  std::size_t dfa_failure_; // the greatest limit the DFA exceeded (0: none)
   DFA dfa_;
 };
 
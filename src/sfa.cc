@@ -10,7 +10,7 @@ SFA::SFA(Expr *expr_root, const std::vector<StateExpr*> &state_exprs, std::size_
     dfa_size_(0),
     thread_num_(thread_num)
 {
-  typedef std::set<StateExpr*> NFA;
+  typedef PositionSet NFA;
   fa_accepts_.resize(nfa_size_);
   for (NFA::iterator i = expr_root->transition().first.begin(); i != expr_root->transition().first.end(); ++i) {
     start_states_.insert((*i)->state_id());
@@ -138,9 +138,10 @@ SFA::SFA(const NFA &nfa, std::size_t thread_num):
       state_t start = (*iter).first;
       std::set<state_t> &currents = (*iter).second;
       for (std::set<state_t>::iterator i = currents.begin(); i != currents.end(); ++i) {
-        for (std::size_t c = 0; c < 256; c++) {
-          if (!nfa[*i][c].empty()) {
-            transition[c][start].insert(nfa[*i][c].begin(), nfa[*i][c].end());
+        for (NFA::edge_iterator e = nfa.edge_begin(*i); e != nfa.edge_end(*i); ++e) {
+          const NFA::Targets &targets = nfa.targets(e->targets);
+          for (std::size_t c = e->lo; c <= e->hi; c++) {
+            transition[c][start].insert(targets.begin(), targets.end());
           }
         }
       }
@@ -245,7 +246,7 @@ void SFA::MatchTask(TaskArg targ) const
 {
 
   if (olevel_ >= Regen::Options::O1) {
-    partial_results_[targ.task_id] = CompiledMatch(targ.string._udata(), NULL, 0);
+    *targ.result = CompiledMatch(targ.string._udata(), NULL, 0);
     return;
   }
   
@@ -254,7 +255,7 @@ void SFA::MatchTask(TaskArg targ) const
   
   while (str != end && (state = transition_[state][*str++]) != DFA::REJECT);
 
-  partial_results_[targ.task_id] = state;
+  *targ.result = state;
   return;
 }
 
@@ -268,7 +269,8 @@ bool SFA::Match(const Regen::StringPiece &string, Regen::StringPiece *result) co
   } else if (string.size() < thread_num) {
     thread_num = string.size();
   }
-  partial_results_.resize(thread_num);
+  /* per call, so that threads can share the SFA. */
+  std::vector<state_t> partial_results(thread_num);
   boost::thread *threads[thread_num];
   std::size_t task_string_length = string.size() / thread_num;
   std::size_t remainder_length = string.size() % thread_num;
@@ -278,12 +280,9 @@ bool SFA::Match(const Regen::StringPiece &string, Regen::StringPiece *result) co
   for (std::size_t i = 0; i < thread_num; i++) {
     if (i == thread_num - 1) task_string_length += remainder_length;
     targ.string.set(str, task_string_length);
-    if (flag_.reverse_match()) {
-      targ.task_id = thread_num - i - 1;
-    } else {
-      targ.task_id = i;
-    }
-    threads[targ.task_id] = new boost::thread(
+    std::size_t task_id = flag_.reverse_match() ? thread_num - i - 1 : i;
+    targ.result = &partial_results[task_id];
+    threads[task_id] = new boost::thread(
         boost::bind(
             boost::bind(&regen::SFA::MatchTask, this, _1),
             targ));
@@ -296,7 +295,7 @@ bool SFA::Match(const Regen::StringPiece &string, Regen::StringPiece *result) co
 
   for (std::size_t i = 0; i < thread_num; i++) {
     threads[i]->join();
-    if ((pstate = partial_results_[i]) == DFA::REJECT) {
+    if ((pstate = partial_results[i]) == DFA::REJECT) {
       states.clear();
       break;
     }
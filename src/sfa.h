@@ -25,11 +25,10 @@ public:
   bool Match(const Regen::StringPiece& string, Regen::StringPiece* result = NULL) const;
   struct TaskArg {
     Regen::StringPiece string;
-    std::size_t task_id;
+    state_t *result;
   };
 private:
   void MatchTask(TaskArg targ) const;
-  mutable std::vector<state_t> partial_results_;
   std::size_t nfa_size_;
   std::size_t dfa_size_;
   std::set<state_t> start_states_;
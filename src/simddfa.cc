@@ -0,0 +1,218 @@
+#include "simddfa.h"
+#ifdef REGEN_ENABLE_PARALLEL
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#endif
+
+namespace regen {
+
+#if REGEN_ENABLE_JIT
+/* void compose(begin, end, mapping, table)
+ *   for (; begin != end; begin++) mapping = pshufb(table[*begin], mapping); */
+class ComposeCode: public Xbyak::CodeGenerator {
+public:
+  ComposeCode(): CodeGenerator(4096)
+  {
+#ifdef XBYAK32
+    const Xbyak::Reg32& begin(esi);
+    const Xbyak::Reg32& end(edi);
+    const Xbyak::Reg32& mapping(edx);
+    const Xbyak::Reg32& table(ecx);
+    const Xbyak::Reg32& tmp(eax);
+    push(esi);
+    push(edi);
+    const int P_ = 4 * 2;
+    mov(begin, ptr [esp + P_ + 4]);
+    mov(end, ptr [esp + P_ + 8]);
+    mov(mapping, ptr [esp + P_ + 12]);
+    mov(table, ptr [esp + P_ + 16]);
+#elif defined(XBYAK64_WIN)
+    const Xbyak::Reg64& begin(rcx);
+    const Xbyak::Reg64& end(rdx);
+    const Xbyak::Reg64& mapping(r8);
+    const Xbyak::Reg64& table(r9);
+    const Xbyak::Reg64& tmp(rax);
+#else
+    const Xbyak::Reg64& begin(rdi);
+    const Xbyak::Reg64& end(rsi);
+    const Xbyak::Reg64& mapping(rdx);
+    const Xbyak::Reg64& table(rcx);
+    const Xbyak::Reg64& tmp(rax);
+#endif
+    movdqu(xmm0, ptr[mapping]);
+    L("loop");
+    cmp(begin, end);
+    je("done");
+    movzx(tmp, byte[begin]);
+    shl(tmp, 4);
+    movdqa(xmm1, ptr[table+tmp]);
+    pshufb(xmm1, xmm0);
+    movdqa(xmm0, xmm1);
+    add(begin, 1);
+    jmp("loop");
+    L("done");
+    movdqu(ptr[mapping], xmm0);
+#ifdef XBYAK32
+    pop(edi);
+    pop(esi);
+#endif
+    ret();
+  }
+};
+#endif
+
+bool SIMDDFA::Applicable(const DFA &dfa)
+{
+  if (!dfa.Complete() || dfa.empty()) return false;
+  if (dfa.size() > MAX_STATE_NUM) return false;
+  if (dfa.size() == MAX_STATE_NUM) {
+    /* no room for the reject state. */
+    for (std::size_t i = 0; i < dfa.size(); i++) {
+      const DFA::Transition &trans = dfa.GetTransition(i);
+      for (std::size_t c = 0; c < 256; c++) {
+        if (trans[c] == DFA::REJECT) return false;
+      }
+    }
+  }
+  return true;
+}
+
+SIMDDFA::SIMDDFA(const DFA &dfa, std::size_t thread_num):
+    dfa_(dfa), complete_(false), thread_num_(thread_num), reject_(0),
+    table_buf_(NULL), table_(NULL)
+#if REGEN_ENABLE_JIT
+    , xgen_(NULL), CompiledCompose(NULL)
+#endif
+{
+  if (!Applicable(dfa)) return;
+
+  /* transition table must be 16byte aligned (movdqa). */
+  table_buf_ = new uint8_t[sizeof(Mapping) * 256 + 16];
+  table_ = (Mapping *)(((uintptr_t)table_buf_ + 15) & ~(uintptr_t)15);
+
+  reject_ = dfa.size() < MAX_STATE_NUM ? dfa.size() : MAX_STATE_NUM - 1;
+  /* for Prefix/Suffix-free matching, once accepted, it's accepted. */
+  const bool sticky = !dfa.flag().suffix_match();
+  for (std::size_t c = 0; c < 256; c++) {
+    Mapping &mapping = table_[c];
+    for (std::size_t i = 0; i < MAX_STATE_NUM; i++) {
+      if (i >= dfa.size()) {
+        mapping[i] = reject_;
+      } else if (sticky && dfa.IsAcceptState(i)) {
+        mapping[i] = i;
+      } else {
+        state_t next = dfa.GetTransition(i)[c];
+        mapping[i] = next == DFA::REJECT ? reject_ : next;
+      }
+    }
+  }
+
+#if REGEN_ENABLE_JIT
+  if (Xbyak::util::Cpu().has(Xbyak::util::Cpu::tSSSE3)) {
+    xgen_ = new ComposeCode();
+    CompiledCompose = (void (*)(const unsigned char *, const unsigned char *, Mapping *, const Mapping *))xgen_->getCode();
+  }
+#endif
+
+  complete_ = true;
+}
+
+SIMDDFA::~SIMDDFA()
+{
+  delete[] table_buf_;
+#if REGEN_ENABLE_JIT
+  delete xgen_;
+#endif
+}
+
+void SIMDDFA::Compose(const unsigned char *begin, const unsigned char *end, Mapping *mapping) const
+{
+#if REGEN_ENABLE_JIT
+  if (CompiledCompose != NULL) {
+    CompiledCompose(begin, end, mapping, table_);
+    return;
+  }
+#endif
+  Mapping tmp;
+  while (begin != end) {
+    const Mapping &trans = table_[*begin++];
+    for (std::size_t i = 0; i < MAX_STATE_NUM; i++) {
+      tmp[i] = trans[(*mapping)[i]];
+    }
+    *mapping = tmp;
+  }
+}
+
+void SIMDDFA::MatchTask(TaskArg targ) const
+{
+  Compose(targ.string.ubegin(), targ.string.uend(), targ.mapping);
+}
+
+bool SIMDDFA::Match(const Regen::StringPiece &string, Regen::StringPiece *result) const
+{
+  if (!complete_ || dfa_.flag().reverse_match()) return dfa_.Match(string, result);
+  if (result != NULL && !dfa_.flag().suffix_match()) {
+    /* match position of Suffix-free matching is unknown from mappings. */
+    return dfa_.Match(string, result);
+  }
+
+  std::size_t thread_num = thread_num_;
+  if (string.size() < thread_num * 64) thread_num = string.size() / 64 + 1;
+  std::vector<Mapping> mappings(thread_num);
+  for (std::size_t i = 0; i < thread_num; i++) {
+    for (std::size_t j = 0; j < MAX_STATE_NUM; j++) {
+      mappings[i][j] = j;
+    }
+  }
+
+  std::size_t task_string_length = string.size() / thread_num;
+  std::size_t remainder_length = string.size() % thread_num;
+  TaskArg targ;
+  const char *str = string.begin();
+#ifdef REGEN_ENABLE_PARALLEL
+  std::vector<boost::thread*> threads;
+#endif
+
+  for (std::size_t i = 0; i < thread_num; i++) {
+    std::size_t length = task_string_length;
+    if (i == thread_num - 1) length += remainder_length;
+    targ.string.set(str, length);
+    targ.mapping = &mappings[i];
+#ifdef REGEN_ENABLE_PARALLEL
+    if (i != thread_num - 1) {
+      threads.push_back(new boost::thread(
+          boost::bind(
+              boost::bind(&regen::SIMDDFA::MatchTask, this, _1),
+              targ)));
+    } else {
+      MatchTask(targ);
+    }
+#else
+    MatchTask(targ);
+#endif
+    str += length;
+  }
+
+#ifdef REGEN_ENABLE_PARALLEL
+  for (std::size_t i = 0; i < threads.size(); i++) {
+    threads[i]->join();
+    delete threads[i];
+  }
+#endif
+
+  uint8_t state = 0;
+  for (std::size_t i = 0; i < thread_num; i++) {
+    state = mappings[i][state];
+  }
+
+  bool accept = false;
+  if (state < dfa_.size()) {
+    accept = dfa_.IsAcceptAtEnd(state, string.empty());
+  }
+  if (accept && result != NULL) {
+    result->set_end(string.end());
+  }
+  return accept;
+}
+
+} // namespace regen
@@ -0,0 +1,61 @@
+#ifndef REGEN_SIMDDFA_H_
+#define  REGEN_SIMDDFA_H_
+#include "regen.h"
+#include "util.h"
+#include "dfa.h"
+
+namespace regen {
+
+#if REGEN_ENABLE_JIT
+class ComposeCode;
+#endif
+
+/* Data-parallel matching for small DFAs (16 or fewer states).
+ * a state-to-state mapping of the whole DFA fits in 16 bytes,
+ * so the mapping of a string is composed byte by byte with `pshufb`,
+ * and mappings of each chunks are combined in order.
+ *
+ * experimental and standalone: Regen::Match never selects it, it is
+ * built explicitly over a compiled DFA (as `fullmatch -s` does).
+ * Match answers as dfa.Match does, result included; when the match
+ * position is not known from the mappings (Suffix-free matching with
+ * a result, reverse matching) or the DFA is not Applicable, it calls
+ * dfa.Match itself. */
+class SIMDDFA {
+public:
+  typedef DFA::state_t state_t;
+  enum { MAX_STATE_NUM = 16 };
+  struct Mapping {
+    uint8_t m[MAX_STATE_NUM];
+    uint8_t &operator[](std::size_t index) { return m[index]; }
+    const uint8_t &operator[](std::size_t index) const { return m[index]; }
+  };
+  SIMDDFA(const DFA &dfa, std::size_t thread_num = 1);
+  ~SIMDDFA();
+  static bool Applicable(const DFA &dfa);
+  bool Complete() const { return complete_; }
+  std::size_t thread_num() const { return thread_num_; }
+  void thread_num(std::size_t thread_num) { thread_num_ = thread_num; }
+  bool Match(const Regen::StringPiece& string, Regen::StringPiece* result = NULL) const;
+  void Compose(const unsigned char *begin, const unsigned char *end, Mapping *mapping) const;
+  struct TaskArg {
+    Regen::StringPiece string;
+    Mapping *mapping;
+  };
+private:
+  void MatchTask(TaskArg targ) const;
+  const DFA &dfa_;
+  bool complete_;
+  std::size_t thread_num_;
+  uint8_t reject_;
+  uint8_t *table_buf_;
+  Mapping *table_;
+#if REGEN_ENABLE_JIT
+  ComposeCode *xgen_;
+  void (*CompiledCompose)(const unsigned char *, const unsigned char *, Mapping *, const Mapping *);
+#endif
+  DISALLOW_COPY_AND_ASSIGN(SIMDDFA);
+};
+
+} // namespace regen
+#endif // REGEN_SIMDDFA_H_
@@ -0,0 +1,375 @@
+#include "simplify.h"
+
+namespace regen {
+
+Simplifier::Simplifier(std::vector<Expr*> *groups, ExprPool *pool):
+    groups_(groups), pool_(pool), ordered_(false)
+{
+  if (groups_ == NULL) return;
+  for (std::size_t i = 0; i < groups_->size(); i++) {
+    group_ids_[(*groups_)[i]].push_back(i);
+  }
+  ordered_ = !groups_->empty();
+}
+
+Expr* Simplifier::Simplify(Expr *root, std::vector<Expr*> *groups, ExprPool *pool)
+{
+  Simplifier s(groups, pool);
+  /* post-order with an explicit stack, simplified subexpressions on a stack.
+   * intersections and XORs are left as they are (their operands are kept
+   * apart from the tree, to be concatenated with the operators). */
+  std::vector<std::pair<Expr*, bool> > stack(1, std::make_pair(root, false));
+  std::vector<Expr*> done;
+  while (!stack.empty()) {
+    Expr *e = stack.back().first;
+    if (!stack.back().second) {
+      stack.back().second = true;
+      switch (e->type()) {
+        case Expr::kConcat: case Expr::kUnion:
+          stack.push_back(std::make_pair(static_cast<BinaryExpr*>(e)->rhs(), false));
+          stack.push_back(std::make_pair(static_cast<BinaryExpr*>(e)->lhs(), false));
+          break;
+        case Expr::kQmark: case Expr::kStar: case Expr::kPlus: case Expr::kRepetition:
+          stack.push_back(std::make_pair(static_cast<UnaryExpr*>(e)->lhs(), false));
+          break;
+        default:
+          break;
+      }
+      continue;
+    }
+    stack.pop_back();
+    switch (e->type()) {
+      case Expr::kConcat: case Expr::kUnion: {
+        BinaryExpr *b = static_cast<BinaryExpr*>(e);
+        b->set_rhs(done.back());
+        done.pop_back();
+        b->set_lhs(done.back());
+        done.pop_back();
+        b->lhs()->set_parent(b);
+        b->rhs()->set_parent(b);
+        break;
+      }
+      case Expr::kQmark: case Expr::kStar: case Expr::kPlus: case Expr::kRepetition: {
+        UnaryExpr *u = static_cast<UnaryExpr*>(e);
+        u->set_lhs(done.back());
+        done.pop_back();
+        u->lhs()->set_parent(u);
+        break;
+      }
+      default:
+        break;
+    }
+    Expr *r = s.Rewrite(e);
+    if (r != e && s.Protected(e)) {
+      std::vector<std::size_t> &ids = s.group_ids_[e];
+      for (std::size_t i = 0; i < ids.size(); i++) {
+        (*groups)[ids[i]] = r;
+      }
+      std::vector<std::size_t> &rids = s.group_ids_[r];
+      rids.insert(rids.end(), ids.begin(), ids.end());
+      s.group_ids_.erase(e);
+    }
+    done.push_back(r);
+  }
+  done.back()->set_parent(NULL);
+  return done.back();
+}
+
+Expr* Simplifier::Rewrite(Expr *e)
+{
+  switch (e->type()) {
+    case Expr::kConcat: {
+      Concat *c = static_cast<Concat*>(e);
+      if (Empty(c->rhs())) return c->lhs();
+      if (Empty(c->lhs())) return c->rhs();
+      return e;
+    }
+    case Expr::kUnion: {
+      /* a chain of unions is rewritten at its top. */
+      if (!Protected(e) && e->parent() != NULL && e->parent()->type() == Expr::kUnion) return e;
+      std::vector<Expr*> operands;
+      Flatten(e, Expr::kUnion, &operands);
+      std::vector<Sequence> alternatives(operands.size());
+      for (std::size_t i = 0; i < operands.size(); i++) {
+        if (Protected(operands[i])) {
+          alternatives[i].push_back(operands[i]);
+        } else {
+          Flatten(operands[i], Expr::kConcat, &alternatives[i]);
+        }
+      }
+      return Alternate(alternatives);
+    }
+    case Expr::kQmark: case Expr::kStar: case Expr::kPlus:
+      return Quantify(static_cast<UnaryExpr*>(e));
+    default:
+      return e;
+  }
+}
+
+/* operands of e (of type) from left to right, through unprotected
+ * subexpressions of the same type. */
+void Simplifier::Flatten(Expr *e, Expr::Type type, std::vector<Expr*> *operands) const
+{
+  if (e->type() != type) {
+    operands->push_back(e);
+    return;
+  }
+  std::vector<Expr*> stack(1, e);
+  while (!stack.empty()) {
+    Expr *f = stack.back();
+    stack.pop_back();
+    if (f == e || (f->type() == type && !Protected(f))) {
+      stack.push_back(static_cast<BinaryExpr*>(f)->rhs());
+      stack.push_back(static_cast<BinaryExpr*>(f)->lhs());
+    } else {
+      operands->push_back(f);
+    }
+  }
+}
+
+bool Simplifier::SingleByte(const Sequence &s) const
+{
+  if (s.size() != 1 || Protected(s[0])) return false;
+  switch (s[0]->type()) {
+    case Expr::kLiteral: case Expr::kCharClass: return true;
+    case Expr::kDot: return !static_cast<Dot*>(s[0])->match_delimiter();
+    default: return false;
+  }
+}
+
+/* alternatives (in order) of a union. recurses on alternatives which share
+ * a prefix (suffix), i.e. on the depth of the factored tree, not on the
+ * number of alternatives. */
+Expr* Simplifier::Alternate(std::vector<Sequence> &alternatives)
+{
+  std::vector<Sequence> alts;
+  /* runs of single bytes into a class. */
+  for (std::size_t i = 0, j; i < alternatives.size(); i = j) {
+    for (j = i; j < alternatives.size() && SingleByte(alternatives[j]); j++) ;
+    if (j - i <= 1) {
+      alts.push_back(alternatives[i]);
+      if (j == i) j++;
+      continue;
+    }
+    std::bitset<256> table;
+    for (std::size_t k = i; k < j; k++) {
+      Expr *e = alternatives[k][0];
+      for (std::size_t c = 0; c < 256; c++) {
+        switch (e->type()) {
+          case Expr::kLiteral: if (static_cast<Literal*>(e)->literal() == c) table.set(c); break;
+          case Expr::kCharClass: if (static_cast<CharClass*>(e)->Involve(c)) table.set(c); break;
+          default: table.set(c); break;
+        }
+      }
+    }
+    Expr *e;
+    if (table.count() == 256) {
+      e = pool_->alloc<Dot>();
+    } else if (table.count() == 1) {
+      std::size_t c = 0;
+      while (!table[c]) c++;
+      e = pool_->alloc<Literal>(c);
+    } else if (table.count() >= 128) {
+      e = pool_->alloc<CharClass>(~table, true);
+    } else {
+      e = pool_->alloc<CharClass>(table);
+    }
+    alts.push_back(Sequence(1, e));
+  }
+
+  /* common prefixes of adjacent alternatives. */
+  std::vector<Sequence> prefixed;
+  for (std::size_t i = 0, j; i < alts.size(); i = j) {
+    for (j = i + 1; j < alts.size() && !alts[i].empty() && !alts[j].empty()
+             && Equal(alts[i][0], alts[j][0]); j++) ;
+    if (j - i == 1) {
+      prefixed.push_back(alts[i]);
+      continue;
+    }
+    std::size_t length = alts[i].size();
+    for (std::size_t k = i + 1; k < j; k++) {
+      std::size_t l = 1;
+      while (l < length && l < alts[k].size() && Equal(alts[i][l], alts[k][l])) l++;
+      length = l;
+    }
+    std::vector<Sequence> rests;
+    for (std::size_t k = i; k < j; k++) {
+      rests.push_back(Sequence(alts[k].begin() + length, alts[k].end()));
+    }
+    if (!Ordered(rests)) {
+      prefixed.insert(prefixed.end(), alts.begin() + i, alts.begin() + j);
+      continue;
+    }
+    Sequence s(alts[i].begin(), alts[i].begin() + length);
+    s.push_back(Alternate(rests));
+    prefixed.push_back(s);
+  }
+
+  /* common suffixes of adjacent alternatives. */
+  std::vector<Sequence> suffixed;
+  for (std::size_t i = 0, j; i < prefixed.size(); i = j) {
+    for (j = i + 1; j < prefixed.size() && !prefixed[i].empty() && !prefixed[j].empty()
+             && Equal(prefixed[i].back(), prefixed[j].back()); j++) ;
+    if (j - i == 1) {
+      suffixed.push_back(prefixed[i]);
+      continue;
+    }
+    std::size_t length = prefixed[i].size();
+    for (std::size_t k = i + 1; k < j; k++) {
+      const Sequence &a = prefixed[i], &b = prefixed[k];
+      std::size_t l = 1;
+      while (l < length && l < b.size() && Equal(a[a.size() - l - 1], b[b.size() - l - 1])) l++;
+      length = l;
+    }
+    std::vector<Sequence> rests;
+    for (std::size_t k = i; k < j; k++) {
+      rests.push_back(Sequence(prefixed[k].begin(), prefixed[k].end() - length));
+    }
+    if (!Ordered(rests)) {
+      suffixed.insert(suffixed.end(), prefixed.begin() + i, prefixed.begin() + j);
+      continue;
+    }
+    Sequence s(1, Alternate(rests));
+    s.insert(s.end(), prefixed[i].end() - length, prefixed[i].end());
+    suffixed.push_back(s);
+  }
+
+  /* empty alternatives: X|() -> X?, unless one precedes X and priority is kept. */
+  std::vector<Expr*> joined, operands;
+  Expr *epsilon = NULL;
+  bool leading = false;
+  for (std::size_t i = 0; i < suffixed.size(); i++) {
+    joined.push_back(Join(suffixed[i]));
+    if (Empty(joined.back())) {
+      if (epsilon == NULL) epsilon = joined.back();
+    } else {
+      leading |= epsilon != NULL;
+      operands.push_back(joined.back());
+    }
+  }
+  if (operands.empty()) return epsilon;
+  if (ordered_ && leading) {
+    /* the first empty alternative stays in place. */
+    operands.clear();
+    for (std::size_t i = 0; i < joined.size(); i++) {
+      if (!Empty(joined[i]) || joined[i] == epsilon) operands.push_back(joined[i]);
+    }
+    epsilon = NULL;
+  }
+  Expr *e = operands[0];
+  for (std::size_t i = 1; i < operands.size(); i++) {
+    e = pool_->alloc<Union>(e, operands[i]);
+  }
+  if (epsilon != NULL) e = Quantify(pool_->alloc<Qmark>(e));
+  return e;
+}
+
+/* true if factoring out of rests keeps the priority of alternatives.
+ * tagged positions order the exits of a nullable rest after its entries
+ * (a|ab as a(|b) prefers ab), so with groups each rest must consume a byte:
+ * one of its factors is a character (a safe approximation of non-nullable). */
+bool Simplifier::Ordered(const std::vector<Sequence> &rests) const
+{
+  if (!ordered_) return true;
+  for (std::size_t i = 0; i < rests.size(); i++) {
+    bool solid = false;
+    for (std::size_t j = 0; j < rests[i].size() && !solid; j++) {
+      Expr::Type type = rests[i][j]->type();
+      solid = type == Expr::kLiteral || type == Expr::kCharClass || type == Expr::kDot;
+    }
+    if (!solid) return false;
+  }
+  return true;
+}
+
+Expr* Simplifier::Join(const Sequence &factors)
+{
+  Expr *e = NULL;
+  for (std::size_t i = 0; i < factors.size(); i++) {
+    Expr *f = factors[i];
+    if (Empty(f)) continue;
+    e = e == NULL ? f : pool_->alloc<Concat>(e, f);
+  }
+  return e != NULL ? e : pool_->alloc<Epsilon>();
+}
+
+/* greedy quantifiers of a quantifier: (R*)* = (R+)* = (R?)* = (R*)+ = (R*)? = (R?)+ = (R+)? = R*,
+ * (R+)+ = R+, (R?)? = R?. */
+Expr* Simplifier::Quantify(UnaryExpr *e)
+{
+  Expr *lhs = e->lhs();
+  if (Empty(lhs)) return lhs;
+  if (e->probability() != 0.0 || Protected(lhs)) return e;
+  if ((e->type() == Expr::kQmark && static_cast<Qmark*>(e)->non_greedy())
+      || (e->type() == Expr::kStar && static_cast<Star*>(e)->non_greedy())) return e;
+  switch (lhs->type()) {
+    case Expr::kQmark: if (static_cast<Qmark*>(lhs)->non_greedy()) return e; break;
+    case Expr::kStar: if (static_cast<Star*>(lhs)->non_greedy()) return e; break;
+    case Expr::kPlus: break;
+    default: return e;
+  }
+  UnaryExpr *inner = static_cast<UnaryExpr*>(lhs);
+  if (inner->probability() != 0.0) return e;
+  Expr::Type type = e->type() == inner->type() ? e->type() : Expr::kStar;
+  if (type == inner->type()) return inner;
+  if (type == e->type()) {
+    e->set_lhs(inner->lhs());
+    inner->lhs()->set_parent(e);
+    return e;
+  }
+  return pool_->alloc<Star>(inner->lhs());
+}
+
+/* structural equality, of subexpressions without groups, operators and
+ * non-greedy (or probabilistic) quantifiers. */
+bool Simplifier::Equal(Expr *e1, Expr *e2) const
+{
+  std::vector<std::pair<Expr*, Expr*> > stack(1, std::make_pair(e1, e2));
+  while (!stack.empty()) {
+    Expr *a = stack.back().first, *b = stack.back().second;
+    stack.pop_back();
+    if (a->type() != b->type() || Protected(a) || Protected(b)) return false;
+    switch (a->type()) {
+      case Expr::kLiteral:
+        if (static_cast<Literal*>(a)->literal() != static_cast<Literal*>(b)->literal()) return false;
+        break;
+      case Expr::kCharClass:
+        for (std::size_t c = 0; c < 256; c++) {
+          if (static_cast<CharClass*>(a)->Involve(c) != static_cast<CharClass*>(b)->Involve(c)) return false;
+        }
+        break;
+      case Expr::kDot:
+        if (static_cast<Dot*>(a)->match_delimiter() != static_cast<Dot*>(b)->match_delimiter()) return false;
+        break;
+      case Expr::kAnchor:
+        if (static_cast<Anchor*>(a)->atype() != static_cast<Anchor*>(b)->atype()) return false;
+        break;
+      case Expr::kEpsilon: case Expr::kNone:
+        break;
+      case Expr::kConcat: case Expr::kUnion:
+        stack.push_back(std::make_pair(static_cast<BinaryExpr*>(a)->lhs(), static_cast<BinaryExpr*>(b)->lhs()));
+        stack.push_back(std::make_pair(static_cast<BinaryExpr*>(a)->rhs(), static_cast<BinaryExpr*>(b)->rhs()));
+        break;
+      case Expr::kQmark: case Expr::kStar: case Expr::kPlus: case Expr::kRepetition: {
+        UnaryExpr *u = static_cast<UnaryExpr*>(a), *v = static_cast<UnaryExpr*>(b);
+        if (u->probability() != 0.0 || v->probability() != 0.0) return false;
+        if (a->type() == Expr::kQmark
+            && (static_cast<Qmark*>(a)->non_greedy() || static_cast<Qmark*>(b)->non_greedy())) return false;
+        if (a->type() == Expr::kStar
+            && (static_cast<Star*>(a)->non_greedy() || static_cast<Star*>(b)->non_greedy())) return false;
+        if (a->type() == Expr::kRepetition) {
+          Repetition *r = static_cast<Repetition*>(a), *s = static_cast<Repetition*>(b);
+          if (r->non_greedy() || s->non_greedy() || r->min() != s->min() || r->max() != s->max()
+              || r->reverse() != s->reverse()) return false;
+        }
+        stack.push_back(std::make_pair(u->lhs(), v->lhs()));
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+} // namespace regen
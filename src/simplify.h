@@ -0,0 +1,42 @@
+#ifndef REGEN_SIMPLIFY_H_
+#define  REGEN_SIMPLIFY_H_
+#include "util.h"
+#include "expr.h"
+
+namespace regen {
+
+/* Algebraic rewriting of a parse tree before its positions are filled.
+ * - alternatives of single characters merge into a CharClass (a|b|[cd] -> [a-d]),
+ * - common prefixes and suffixes of alternatives are factored (foo|foobar|fox -> fo(o(bar)?|x)),
+ * - nested quantifiers are flattened ((a*)* -> a*, (a+)? -> a*),
+ * - Epsilons are dropped from concatenations, and X|() becomes X?,
+ * so that equal subexpressions share positions, and fewer subsets
+ * (DFA states) differ only by dead positions.
+ * groups are kept: a group is never merged into, or factored out of, others,
+ * and when a group is replaced as a whole, groups is updated.
+ * if there are groups, the priority of alternatives (submatch semantics) is kept. */
+class Simplifier {
+public:
+  static Expr* Simplify(Expr *root, std::vector<Expr*> *groups, ExprPool *pool);
+private:
+  typedef std::vector<Expr*> Sequence; // factors of a concatenation
+  Simplifier(std::vector<Expr*> *groups, ExprPool *pool);
+  Expr* Rewrite(Expr *e);
+  Expr* Alternate(std::vector<Sequence> &alternatives);
+  Expr* Quantify(UnaryExpr *e);
+  Expr* Join(const Sequence &factors);
+  void Flatten(Expr *e, Expr::Type type, std::vector<Expr*> *operands) const;
+  bool SingleByte(const Sequence &s) const;
+  bool Ordered(const std::vector<Sequence> &rests) const;
+  bool Equal(Expr *e1, Expr *e2) const;
+  bool Protected(Expr *e) const { return group_ids_.find(e) != group_ids_.end(); }
+  bool Empty(Expr *e) const { return e->type() == Expr::kEpsilon && !Protected(e); }
+  std::vector<Expr*> *groups_;
+  std::map<Expr*, std::vector<std::size_t> > group_ids_;
+  ExprPool *pool_;
+  bool ordered_; // keep the priority of alternatives
+  DISALLOW_COPY_AND_ASSIGN(Simplifier);
+};
+
+} // namespace regen
+#endif // REGEN_SIMPLIFY_H_
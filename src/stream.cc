@@ -0,0 +1,63 @@
+#include "stream.h"
+#include "regex.h"
+#include "program.h"
+
+namespace regen {
+
+StreamMatcher::StreamMatcher(const Regen &regen):
+    own_(Own(regen)), dfa_((own_ != NULL ? own_ : regen.program_->regex())->dfa()), flag_(regen.program_->flag())
+{
+  if (flag_.reverse_match()) exitmsg("StreamMatcher does not support ReverseMatch.\n");
+  Reset();
+}
+
+StreamMatcher::~StreamMatcher()
+{
+  delete own_;
+}
+
+/* Regen::Compile returns before the DFA of a literal pattern, which is
+ * small and built here. the DFA over its limit is grown On-The-Fly. */
+Regex* StreamMatcher::Own(const Regen &regen)
+{
+  const Program &program = *regen.program_;
+  if (program.regex()->dfa().Complete()) return NULL;
+  Regex *own = new Regex(program.regex()->regex(), program.flag());
+  if (program.literal() != NULL) own->Compile(Regen::Options::O0);
+  return own;
+}
+
+void StreamMatcher::Reset()
+{
+  state_ = dfa_.start_state();
+  offset_ = match_end_ = 0;
+  matched_ = decided_ = false;
+}
+
+bool StreamMatcher::Feed(const Regen::StringPiece &chunk)
+{
+  if (decided_) return false;
+  const unsigned char *matchptr = NULL;
+  state_ = dfa_.Resume(state_, chunk, &matchptr);
+  if (matchptr != NULL && !flag_.suffix_match()) {
+    match_end_ = offset_ + (matchptr - chunk.ubegin());
+    matched_ = true;
+  }
+  offset_ += chunk.size();
+  if (state_ == DFA::REJECT || (matched_ && flag_.shortest_match())) decided_ = true;
+  return !decided_;
+}
+
+bool StreamMatcher::Flush(std::size_t *end)
+{
+  /* acceptance at the end of stream ($ or Suffix matching). */
+  if (!decided_ && dfa_.IsAcceptAtEnd(state_, offset_ == 0)) {
+    matched_ = true;
+    match_end_ = offset_;
+  }
+  decided_ = true;
+  if (matched_ && end != NULL) *end = match_end_;
+  return matched_;
+}
+
+} // namespace regen
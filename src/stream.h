@@ -0,0 +1,47 @@
+#ifndef REGEN_STREAM_H_
+#define  REGEN_STREAM_H_
+#include "regen.h"
+#include "util.h"
+#include "dfa.h"
+
+namespace regen {
+
+/* Matching over a stream which arrives in chunks, by the DFA of the pattern.
+ * the DFA state and the last acceptance are carried between Feed calls, so
+ * the result is the same as Regen::Match on the concatenation of all
+ * chunks. a line begins at the start of the stream, or after a delimiter,
+ * which the DFA reads as any other byte, so its state is all the line
+ * context there is. only the end of the match is known (as the offset in
+ * the stream), chunks are never buffered.
+ * the other engines of Regen (literals, bits, counters) look at the whole
+ * string, so they are not used. a Regen without a complete DFA (a literal
+ * pattern, or a DFA over its limit) is never written: the stream builds
+ * the DFA, or grows it On-The-Fly, in a private copy. */
+class StreamMatcher {
+public:
+  /* borrows regen, which must outlive the StreamMatcher. */
+  StreamMatcher(const Regen &regen);
+  ~StreamMatcher();
+  void Reset();
+  /* returns false once the result is decided (following chunks are ignored). */
+  bool Feed(const Regen::StringPiece& chunk);
+  /* end of stream. *end receives the offset of the match end. */
+  bool Flush(std::size_t *end = NULL);
+  std::size_t offset() const { return offset_; }
+  /* false if matching with a private copy. */
+  bool shared() const { return own_ == NULL; }
+private:
+  static Regex* Own(const Regen &regen);
+  Regex *own_; // private copy of a regex without a complete DFA
+  const DFA &dfa_;
+  const Regen::Options &flag_;
+  DFA::state_t state_;
+  std::size_t offset_;    // bytes fed so far
+  std::size_t match_end_; // offset of the last acceptance (Suffix-free)
+  bool matched_;
+  bool decided_;
+  DISALLOW_COPY_AND_ASSIGN(StreamMatcher);
+};
+
+} // namespace regen
+#endif // REGEN_STREAM_H_
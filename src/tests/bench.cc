@@ -3,14 +3,18 @@
 #include "../util.h"
 
 struct testcase {
-  testcase(std::string regex_, std::string text_, std::string pretty_, bool result_): regex(regex_), text(text_), pretty(pretty_), result(result_) {}
+  testcase(std::string regex_, std::string text_, std::string pretty_, bool result_,
+           Regen::Options::ParseFlag flag_ = Regen::Options::NoParseFlags): regex(regex_), text(text_), pretty(pretty_), result(result_), flag(flag_) {}
   std::string regex;
   std::string text;
   std::string pretty;
   bool result;
+  Regen::Options::ParseFlag flag;
 };
 
 struct benchresult {
+  uint64_t parse_time;
+  uint64_t teardown_time;
   uint64_t compile_time;
   uint64_t matching_time;
   bool result;
@@ -63,26 +67,82 @@ int main(int argc, char *argv[]) {
   std::string regex = "http://((([a-zA-Z0-9]|[a-zA-Z0-9][-a-zA-Z0-9]*[a-zA-Z0-9])\\.)*([a-zA-Z]|[a-zA-Z][-a-zA-Z0-9]*[a-zA-Z0-9])\\.?|[0-9]+\\.[0-9]+\\.[0-9]+\\.[0-9]+)(:[0-9]*)?(/([-_.!~*'()a-zA-Z0-9:@&=+$,]|%[0-9A-Fa-f][0-9A-Fa-f])*(;([-_.!~*'()a-zA-Z0-9:@&=+$,]|%[0-9A-Fa-f][0-9A-Fa-f])*)*(/([-_.!~*'()a-zA-Z0-9:@&=+$,]|%[0-9A-Fa-f][0-9A-Fa-f])*(;([-_.!~*'()a-zA-Z0-9:@&=+$,]|%[0-9A-Fa-f][0-9A-Fa-f])*)*)*(\\?([-_.!~*'()a-zA-Z0-9;/?:@&=+$,]|%[0-9A-Fa-f][0-9A-Fa-f])*)?)?";
   text = "http://en.wikipedia.org/wiki/Parsing_expression_grammar";
   bench.push_back(testcase(regex, text, text, true));
-  
+
+  /* machine-generated patterns of 1MB: a long concatenation, a large
+   * alternation and deeply nested groups. */
+  const std::size_t MB = 1024 * 1024;
+  std::vector<std::string> words;
+  std::size_t length = 0;
+  for (uint32_t seed = 1; length < MB; ) {
+    std::string word;
+    for (std::size_t i = 0; i < 8; i++) {
+      seed = seed * 1103515245 + 12345;
+      word += 'a' + (seed >> 16) % 26;
+    }
+    words.push_back(word);
+    length += word.size() + 3;
+  }
+  regex = words[0];
+  for (std::size_t i = 1; i < words.size(); i++) regex += "\\s" + words[i];
+  text = words[0] + " " + words[1] + " " + words[2];
+  bench.push_back(testcase(regex, text, "(1MB of concatenation)", false));
+
+  regex = "(" + words[0];
+  for (std::size_t i = 1; i < words.size(); i++) regex += "|" + words[i];
+  regex += ")+";
+  text = words[words.size() / 2] + words[0] + words[words.size() - 1];
+  bench.push_back(testcase(regex, text, "(1MB of alternation)", true));
+
+  regex = std::string(MB / 4, '(') + "a";
+  for (std::size_t i = 0; i < MB / 4; i++) regex += ")*";
+  text = "aaaaaaaaaa";
+  bench.push_back(testcase(regex, text, "(1MB of nested groups)", true));
+
+  /* intersections and XORs, by product DFAs and by Operator pairs. */
+  text = "";
+  for (uint32_t seed = 1; text.size() < 1000; ) {
+    seed = seed * 1103515245 + 12345;
+    text += 'a' + (seed >> 16) % 26;
+  }
+  const char *extended[][2] = {
+    {".*ab.*&.*cd.*&.*ef.*", "1"}, {"[a-z]*&!(.*(aa|bb|cc).*)", "0"},
+    {".*[0-9]{3}.*&&.*x.*", "1"}, {"(.*a.{6})&(.*b.{6})", "0"}
+  };
+  for (std::size_t i = 0; i < sizeof(extended) / sizeof(extended[0]); i++) {
+    std::string t = text + "abcdef";
+    bench.push_back(testcase(extended[i][0], t, "(1KB) product DFA", extended[i][1][0] == '1', Regen::Options::Extended));
+    bench.push_back(testcase(extended[i][0], t, "(1KB) Operator pairs", extended[i][1][0] == '1',
+                             (Regen::Options::ParseFlag)(Regen::Options::Extended | Regen::Options::NoProductDFA)));
+  }
+
   uint64_t start, end;
   std::vector<benchresult> result(bench.size());
   for (std::size_t i = 0; i < bench.size(); i++) {
-    regen::Regex r(bench[i].regex);
     start = rdtsc();
-    r.Compile(olevel);
+    regen::Regex *r = new regen::Regex(bench[i].regex, bench[i].flag);
+    end   = rdtsc();
+    result[i].parse_time = end - start;
+    start = rdtsc();
+    r->Compile(olevel);
     end   = rdtsc();
     result[i].compile_time = end - start;
     start = rdtsc();
-    result[i].result = r.Match(bench[i].text) == bench[i].result;
+    result[i].result = r->Match(bench[i].text) == bench[i].result;
     end   = rdtsc();
     result[i].matching_time = end - start;
+    start = rdtsc();
+    delete r;
+    end   = rdtsc();
+    result[i].teardown_time = end - start;
   }
 
   const char *ostr[] = {"  Onone", "     O0", "     O1", "     O2", "     O3"};
   for (std::size_t i = 0; i < bench.size(); i++) {
-    printf("BENCH %"PRIuS" : regex = /%s/ text = \"%s\"\n" , i, bench[i].regex.c_str(), bench[i].pretty.c_str());
+    std::string regex = bench[i].regex.size() <= 256 ? bench[i].regex : bench[i].regex.substr(0, 64) + "...";
+    printf("BENCH %" PRIuS " : regex = /%s/ text = \"%s\"\n" , i, regex.c_str(), bench[i].pretty.c_str());
     if (!result[i].result) puts("FAIL\n");
     printf("%s : compile time = %"PRIuS", matching time = %"PRIuS"\n", ostr[olevel+1], static_cast<size_t>(result[i].compile_time), static_cast<size_t>(result[i].matching_time));
+    printf("%s : parse time = %" PRIuS ", teardown time = %" PRIuS "\n", ostr[olevel+1], static_cast<size_t>(result[i].parse_time), static_cast<size_t>(result[i].teardown_time));
   }
   return 0;
 }
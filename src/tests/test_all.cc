@@ -1,5 +1,14 @@
 #include "gtest/gtest.h"
 #include "../regen.h"
+#include "../regex.h"
+#include "../simddfa.h"
+#include "../ahocorasick.h"
+#include "../stream.h"
+#include "../matcher.h"
+#include "../program.h"
+#include "../cache.h"
+#include "../counting.h"
+#include "../bitparallel.h"
 
 struct testcase {
   testcase(std::string regex_, std::string text_, bool result_): regex(regex_), text(text_), result(result_) {}
@@ -123,8 +132,935 @@ testcase test[] = {
       ASSERT_EQ(r.Match(test[i].text), test[i].result);             \
     }                                                               \
   }
+GENTEST(Onone)
 GENTEST(O0)
 GENTEST(O1)
 GENTEST(O2)
 GENTEST(O3)
 #undef GENTEST
+
+TEST(SIMDDFATest, FullMatch) {
+  const std::size_t TESTNUM = sizeof(test) / sizeof(testcase);
+  for (std::size_t i = 0; i < TESTNUM; i++) {
+    regen::Regex r(test[i].regex);
+    r.Compile(Regen::Options::O0);
+    r.MinimizeDFA();
+    if (!regen::SIMDDFA::Applicable(r.dfa())) continue;
+    regen::SIMDDFA s(r.dfa(), 2);
+    ASSERT_EQ(s.Match(test[i].text), test[i].result);
+  }
+}
+
+/* SIMDDFA gives the DFA's answer and match position under each anchoring. */
+TEST(SIMDDFATest, PartialMatch) {
+  const std::size_t TESTNUM = sizeof(test) / sizeof(testcase);
+  for (int anchor = 0; anchor < 4; anchor++) {
+    Regen::Options opt;
+    opt.prefix_match(anchor & 1);
+    opt.suffix_match(anchor & 2);
+    for (std::size_t i = 0; i < TESTNUM; i++) {
+      regen::Regex r(test[i].regex, opt);
+      r.Compile(Regen::Options::O0);
+      r.MinimizeDFA();
+      if (!regen::SIMDDFA::Applicable(r.dfa())) continue;
+      for (std::size_t thread_num = 1; thread_num <= 2; thread_num++) {
+        regen::SIMDDFA s(r.dfa(), thread_num);
+        Regen::StringPiece text(test[i].text), result(text), expected(text);
+        bool match = r.dfa().Match(text, &expected);
+        ASSERT_EQ(s.Match(text), match);
+        ASSERT_EQ(s.Match(text, &result), match);
+        if (match) {
+          ASSERT_EQ(result.begin(), expected.begin());
+          ASSERT_EQ(result.end(), expected.end());
+        }
+      }
+    }
+  }
+}
+
+/* texts long enough to be split into chunks, so the mappings of several
+ * chunks are composed; the needles straddle the chunk boundaries. */
+TEST(SIMDDFATest, Chunks) {
+  const char *patterns[] = {"(ab)*", "(ab|c)*d", "a[^x]*xyz", "xyz", "(a|b)*a(a|b)"};
+  const std::size_t PATTERNNUM = sizeof(patterns) / sizeof(patterns[0]);
+  std::vector<std::string> texts;
+  std::string ab;
+  for (std::size_t i = 0; i < 500; i++) ab += "ab";
+  texts.push_back(ab);
+  texts.push_back(ab + "c");
+  texts.push_back(ab.substr(0, 499) + "cd");
+  texts.push_back(std::string(1000, 'a'));
+  std::string span(ab);
+  span.replace(248, 3, "xyz");
+  texts.push_back(span);
+  texts.push_back("a" + span);
+  texts.push_back(std::string(1000, 'a') + "b");
+  texts.push_back(std::string(999, 'b') + "ab");
+  for (int partial = 0; partial <= 1; partial++) {
+    Regen::Options opt;
+    opt.partial_match(partial);
+    for (std::size_t i = 0; i < PATTERNNUM; i++) {
+      regen::Regex r(patterns[i], opt);
+      r.Compile(Regen::Options::O0);
+      r.MinimizeDFA();
+      ASSERT_TRUE(regen::SIMDDFA::Applicable(r.dfa())) << patterns[i];
+      for (std::size_t thread_num = 2; thread_num <= 4; thread_num++) {
+        regen::SIMDDFA s(r.dfa(), thread_num);
+        for (std::size_t j = 0; j < texts.size(); j++) {
+          Regen::StringPiece text(texts[j]), result(text), expected(text);
+          bool match = r.Match(text, &expected);
+          ASSERT_EQ(s.Match(text), match) << patterns[i] << " " << j;
+          ASSERT_EQ(s.Match(text, &result), match) << patterns[i] << " " << j;
+          if (match) {
+            ASSERT_EQ(result.begin(), expected.begin());
+            ASSERT_EQ(result.end(), expected.end());
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(MatchBatchTest, Parallel) {
+  const std::size_t TESTNUM = sizeof(test) / sizeof(testcase);
+  Regen::Options opt;
+  opt.partial_match(true);
+  opt.captured_match(true);
+  Regen r("(a|bc)+d", opt);
+  r.Compile(Regen::Options::O3);
+  std::vector<Regen::StringPiece> records;
+  for (std::size_t i = 0; i < 1000; i++) {
+    records.push_back(Regen::StringPiece(test[i % TESTNUM].text));
+  }
+  std::vector<unsigned char> bitmap((records.size() + 7) / 8);
+  std::vector<Regen::StringPiece> results(records.size());
+  std::size_t count = r.MatchBatch(&records[0], records.size(), &bitmap[0], &results[0], 4);
+  std::size_t expected = 0;
+  for (std::size_t i = 0; i < records.size(); i++) {
+    Regen::StringPiece result;
+    bool match = r.Match(records[i], &result);
+    if (match) expected++;
+    ASSERT_EQ(match, (bitmap[i / 8] & (1 << (i % 8))) != 0);
+    ASSERT_EQ(result.begin(), results[i].begin());
+    ASSERT_EQ(result.end(), results[i].end());
+  }
+  ASSERT_EQ(count, expected);
+}
+
+TEST(RegenSetTest, FullMatch) {
+  const std::size_t TESTNUM = sizeof(test) / sizeof(testcase);
+  const std::size_t SETSIZE = 8;
+  for (std::size_t i = 0; i < TESTNUM; i += SETSIZE) {
+    RegenSet set;
+    for (std::size_t j = i; j < std::min(i + SETSIZE, TESTNUM); j++) {
+      set.Add(test[j].regex);
+    }
+    set.Compile(Regen::Options::O3);
+    for (std::size_t j = i; j < std::min(i + SETSIZE, TESTNUM); j++) {
+      std::vector<std::size_t> ids;
+      set.Match(test[j].text, &ids);
+      bool match = std::find(ids.begin(), ids.end(), j - i) != ids.end();
+      ASSERT_EQ(match, test[j].result);
+    }
+  }
+}
+
+TEST(RegenSetTest, PartialMatch) {
+  const char *patterns[] = {"abc", "b+c", "^x", "y$"};
+  const std::size_t PATNUM = sizeof(patterns) / sizeof(const char *);
+  Regen::Options opt;
+  opt.partial_match(true);
+  for (int olevel = Regen::Options::Onone; olevel <= Regen::Options::O3; olevel++) {
+    RegenSet set(opt);
+    for (std::size_t i = 0; i < PATNUM; i++) set.Add(patterns[i]);
+    set.Compile(Regen::Options::CompileFlag(olevel));
+    std::vector<std::size_t> ids;
+    ASSERT_TRUE(set.Match("xxabcc21y", &ids));
+    ASSERT_EQ(ids.size(), 4u);
+    ASSERT_EQ(ids[0], 0u);
+    ASSERT_EQ(ids[1], 1u);
+    ASSERT_EQ(ids[2], 2u);
+    ASSERT_EQ(ids[3], 3u);
+    ASSERT_TRUE(set.Match("--bbc--", &ids));
+    ASSERT_EQ(ids.size(), 1u);
+    ASSERT_EQ(ids[0], 1u);
+    ASSERT_FALSE(set.Match("ab-c", &ids));
+    ASSERT_TRUE(ids.empty());
+  }
+}
+
+TEST(AhoCorasickTest, Match) {
+  regen::AhoCorasick ac;
+  const char *keywords[] = {"he", "she", "his", "hers", "she"};
+  for (std::size_t i = 0; i < sizeof(keywords) / sizeof(const char *); i++) {
+    ac.Add(keywords[i]);
+  }
+  ac.Compile();
+  ASSERT_EQ(ac.size(), 4u);
+  std::vector<bool> seen;
+  ASSERT_EQ(ac.Match("ushers", &seen), 3u);
+  ASSERT_TRUE(seen[0] && seen[1] && !seen[2] && seen[3]);
+  ASSERT_EQ(ac.Match("xxhixhis", &seen), 1u);
+  ASSERT_TRUE(seen[2]);
+  ASSERT_EQ(ac.Match("", &seen), 0u);
+}
+
+TEST(RegenSetTest, Prefilter) {
+  const char *patterns[] = {"hello", "wor+ld", "[0-9]+abc", "foo|foobar", "x.*yz",
+                            "a(bc|bd)e", "^start", "end$", "q[a-z]{2}q", "zzz+", "(ab|cd)efg"};
+  const char *texts[] = {"hello world", "start 12abc end", "foobar", "xxyz", "abde", "quuq zzzz",
+                         "cdefg", "start", "abcdefg", "hell", "woorld foo"};
+  const std::size_t PATNUM = sizeof(patterns) / sizeof(const char *);
+  const std::size_t TEXTNUM = sizeof(texts) / sizeof(const char *);
+  for (int partial = 0; partial <= 1; partial++) {
+    Regen::Options opt;
+    opt.partial_match(partial);
+    RegenSet set(opt);
+    for (std::size_t i = 0; i < PATNUM; i++) set.Add(patterns[i]);
+    set.Compile(Regen::Options::O1);
+    for (std::size_t i = 0; i < TEXTNUM; i++) {
+      std::vector<std::size_t> ids, expected;
+      for (std::size_t j = 0; j < PATNUM; j++) {
+        Regen r(patterns[j], opt);
+        r.Compile(Regen::Options::O0);
+        if (r.Match(texts[i])) expected.push_back(j);
+      }
+      ASSERT_EQ(set.Match(texts[i], &ids), !expected.empty());
+      ASSERT_TRUE(ids == expected);
+      ASSERT_EQ(set.Match(texts[i]), !expected.empty());
+    }
+  }
+}
+
+TEST(LiteralMatcherTest, SameAsDFA) {
+  const char *patterns[] = {"abc", "ab|abcd", "a[bc]d", "aa", "(foo|bar)baz", "b|abcde|cd"};
+  const char *texts[] = {"xabcx", "aaa", "abcdab", "foobazbarbaz", "acd", "", "abcdefghijklmnopqrstuvwxyzabc"};
+  const std::size_t PATNUM = sizeof(patterns) / sizeof(const char *);
+  const std::size_t TEXTNUM = sizeof(texts) / sizeof(const char *);
+  for (int mode = 0; mode < 8; mode++) {
+    Regen::Options opt;
+    opt.prefix_match(mode & 1);
+    opt.suffix_match(mode & 2);
+    opt.shortest_match(mode & 4);
+    for (std::size_t i = 0; i < PATNUM; i++) {
+      Regen r(patterns[i], opt);
+      r.Compile();
+      regen::Regex re(patterns[i], opt);
+      re.Compile(Regen::Options::O1);
+      for (std::size_t j = 0; j < TEXTNUM; j++) {
+        Regen::StringPiece result, expected;
+        bool match = re.Match(texts[j], &expected);
+        ASSERT_EQ(r.Match(texts[j]), match);
+        ASSERT_EQ(r.Match(texts[j], &result), match);
+        if (match) {
+          ASSERT_EQ(result.end(), expected.end());
+        }
+      }
+    }
+  }
+  Regen::Options opt;
+  opt.partial_match(true);
+  opt.captured_match(true);
+  Regen r("b|abcde|cd", opt);
+  Regen::StringPiece text("xabcdex"), result;
+  ASSERT_TRUE(r.Match(text, &result));
+  ASSERT_EQ(result.as_string(), "abcde");
+}
+
+TEST(InnerLiteralMatcherTest, SameAsDFA) {
+  const char *patterns[] = {"[a-z]+@example\\.com[^ ]*", "a.*bcd.*e", "(x|y)+abc(d|e)?", "[0-9]*xyz", "q(ab|cd)+zzk"};
+  const char *texts[] = {"mail to foo@example.com now", "@example.com", "abcde\nabcd\nbcde", "xyabcyabcd",
+                         "12xy 345xyz", "qabzzkqcdabzzk", "", "a\nbcd\ne", "bcd bcd\nxbcd\nabcdbcde\nybcd",
+                         "bcd bcd bcd bcd bcd bcd bcd bcd bcd bcd x", "bcd bcd bcd bcd bcd bcd bcd bcd bcd abcde"};
+  const std::size_t PATNUM = sizeof(patterns) / sizeof(const char *);
+  const std::size_t TEXTNUM = sizeof(texts) / sizeof(const char *);
+  for (int shortest = 0; shortest <= 1; shortest++) {
+    Regen::Options opt;
+    opt.partial_match(true);
+    opt.shortest_match(shortest);
+    for (std::size_t i = 0; i < PATNUM; i++) {
+      Regen r(patterns[i], opt);
+      r.Compile(Regen::Options::O1);
+      regen::Regex re(patterns[i], opt);
+      re.Compile(Regen::Options::O1);
+      for (std::size_t j = 0; j < TEXTNUM; j++) {
+        Regen::StringPiece result, expected;
+        bool match = re.Match(texts[j], &expected);
+        ASSERT_EQ(r.Match(texts[j]), match);
+        ASSERT_EQ(r.Match(texts[j], &result), match);
+        if (match) {
+          ASSERT_EQ(result.end(), expected.end());
+        }
+      }
+    }
+  }
+  Regen::Options opt;
+  opt.partial_match(true);
+  opt.captured_match(true);
+  Regen r("[a-z]+@example\\.com", opt);
+  r.Compile();
+  Regen::StringPiece text("mail:\nto foo@example.com now"), result;
+  ASSERT_TRUE(r.Match(text, &result));
+  ASSERT_EQ(result.as_string(), "foo@example.com");
+}
+
+TEST(RegenCacheTest, StaticMatch) {
+  Regen::SetCacheCapacity(2);
+  std::size_t hits = Regen::CacheHits(), misses = Regen::CacheMisses();
+  ASSERT_TRUE(Regen::FullMatch("abc", "a.c"));
+  ASSERT_FALSE(Regen::FullMatch("abcd", "a.c"));
+  ASSERT_TRUE(Regen::PartialMatch("xabcx", "a.c"));
+  ASSERT_EQ(Regen::CacheMisses() - misses, 2u);
+  ASSERT_EQ(Regen::CacheHits() - hits, 1u);
+  /* "a.c" (full) is the least recently used, evicted by "b+". */
+  ASSERT_TRUE(Regen::FullMatch("bb", "b+"));
+  ASSERT_TRUE(Regen::FullMatch("abc", "a.c"));
+  ASSERT_EQ(Regen::CacheMisses() - misses, 4u);
+  Regen::StringPiece text("bbb"), result;
+  ASSERT_TRUE(Regen::FullMatch(text, "b+", &result));
+  ASSERT_EQ(result.end(), text.end());
+  ASSERT_EQ(Regen::CacheHits() - hits, 2u);
+  Regen::SetCacheCapacity(64);
+}
+
+TEST(RegenCacheTest, OptionsKey) {
+  /* a pattern compiled with and without simplify (or product DFAs) is
+   * cached apart. */
+  regen::RegenCache cache;
+  Regen::Options opt;
+  opt.intersection_ext(true);
+  regen::RegenCache::Entry *entries[3];
+  entries[0] = cache.Acquire("(a|b)*a&.*b.*", opt, Regen::Options::O0);
+  opt.simplify(false);
+  entries[1] = cache.Acquire("(a|b)*a&.*b.*", opt, Regen::Options::O0);
+  opt.product_dfa(false);
+  entries[2] = cache.Acquire("(a|b)*a&.*b.*", opt, Regen::Options::O0);
+  ASSERT_EQ(cache.misses(), 3u);
+  ASSERT_EQ(cache.hits(), 0u);
+  ASSERT_NE(entries[0]->regen, entries[1]->regen);
+  ASSERT_NE(entries[1]->regen, entries[2]->regen);
+  for (std::size_t i = 0; i < 3; i++) {
+    ASSERT_TRUE(entries[i]->regen->Match("bba"));
+    ASSERT_FALSE(entries[i]->regen->Match("aa"));
+    cache.Release(entries[i]);
+  }
+  cache.Release(cache.Acquire("(a|b)*a&.*b.*", opt, Regen::Options::O0));
+  ASSERT_EQ(cache.hits(), 1u);
+}
+
+TEST(ConsumeTest, Tokenize) {
+  Regen::StringPiece input("foo = 12+bar;"), token;
+  const char *expected[] = {"foo", " ", "=", " ", "12", "+", "bar", ";"};
+  Regen ident("[a-z]+"), number("[0-9]+"), space(" +");
+  Regen::Options opt;
+  opt.partial_match(true); // Consume is anchored regardless of the options
+  Regen symbol("[=+;]", opt);
+  ident.Compile();
+  number.Compile();
+  space.Compile(Regen::Options::O0);
+  symbol.Compile();
+  for (std::size_t i = 0; i < sizeof(expected) / sizeof(const char *); i++) {
+    ASSERT_TRUE(ident.Consume(&input, &token) || Regen::Consume(&input, number, &token)
+                || space.Consume(&input, &token) || symbol.Consume(&input, &token));
+    ASSERT_EQ(token.as_string(), expected[i]);
+  }
+  ASSERT_TRUE(input.empty());
+  ASSERT_FALSE(ident.Consume(&input, &token));
+
+  input.set("aaab");
+  ASSERT_TRUE(Regen::Consume(&input, "a*", &token));
+  ASSERT_EQ(token.as_string(), "aaa");
+  ASSERT_EQ(input.as_string(), "b");
+  ASSERT_TRUE(Regen::Consume(&input, "a*", &token));
+  ASSERT_TRUE(token.empty());
+  ASSERT_FALSE(Regen::Consume(&input, "a|bc"));
+  ASSERT_EQ(input.as_string(), "b");
+  ASSERT_TRUE(Regen::Consume(&input, "b|bc"));
+  ASSERT_TRUE(input.empty());
+
+  /* the DFA exceeds its budget, Consume runs on the bits of the shared Program. */
+  Regen::Options anchored;
+  anchored.prefix_match(true);
+  anchored.suffix_match(false);
+  regen::Matcher bits("(a|b)*a(a|b){8}", anchored);
+  ASSERT_TRUE(bits.shared());
+  ASSERT_TRUE(bits.program().bitparallel() != NULL);
+  const std::string text = "a" + std::string(9, 'b');
+  input.set(text);
+  ASSERT_TRUE(bits.Consume(&input, &token));
+  ASSERT_EQ(token.as_string(), "a" + std::string(8, 'b'));
+  input.set(text);
+  ASSERT_TRUE(Regen::Consume(&input, "(a|b)*a(a|b){8}", &token));
+  ASSERT_EQ(input.as_string(), "b");
+  ASSERT_FALSE(Regen::Consume(&input, "(a|b)*a(a|b){8}"));
+}
+
+TEST(StreamMatcherTest, Chunked) {
+  const char *patterns[] = {"abc", "a[bc]+d", "(ab|b)*c$", "x.*y", "^ab"};
+  const char *texts[] = {"xxabcdab", "abcbcd\nabd", "ababc", "xyzy\nxy", "ab"};
+  const std::size_t PATNUM = sizeof(patterns) / sizeof(const char *);
+  const std::size_t TEXTNUM = sizeof(texts) / sizeof(const char *);
+  Regen::Options::CompileFlag olevels[] = {Regen::Options::Onone, Regen::Options::O0, Regen::Options::O3};
+  for (int mode = 0; mode < 8; mode++) {
+    Regen::Options opt;
+    opt.prefix_match(mode & 1);
+    opt.suffix_match(mode & 2);
+    opt.shortest_match(mode & 4);
+    for (std::size_t i = 0; i < PATNUM; i++) {
+      for (std::size_t l = 0; l < 3; l++) {
+        Regen r(patterns[i], opt);
+        r.Compile(olevels[l]);
+        regen::StreamMatcher stream(r);
+        for (std::size_t j = 0; j < TEXTNUM; j++) {
+          Regen::StringPiece text(texts[j]), result;
+          bool match = r.Match(text, &result);
+          for (std::size_t split = 0; split <= text.size(); split++) {
+            std::size_t end = 0;
+            stream.Reset();
+            stream.Feed(Regen::StringPiece(text.begin(), split));
+            stream.Feed(Regen::StringPiece(text.begin() + split, text.end()));
+            ASSERT_EQ(stream.Flush(&end), match);
+            if (match) {
+              ASSERT_EQ(text.begin() + end, result.end());
+            }
+          }
+        }
+      }
+    }
+  }
+  /* Compile builds no DFA for a literal pattern, and an On-The-Fly DFA
+   * grows while matching: the stream matches both with a copy. */
+  Regen literal("abc"), compiled("a[bc]+d"), onthefly("a[bc]+d");
+  literal.Compile();
+  compiled.Compile(Regen::Options::O0);
+  onthefly.Compile(Regen::Options::Onone);
+  regen::StreamMatcher s1(literal), s2(compiled), s3(onthefly);
+  ASSERT_FALSE(s1.shared());
+  ASSERT_TRUE(s2.shared());
+  ASSERT_FALSE(s3.shared());
+  s1.Feed("ab");
+  s1.Feed("c");
+  ASSERT_TRUE(s1.Flush());
+}
+
+TEST(FindAllTest, NonOverlapping) {
+  const char *patterns[] = {"[a-z]+[0-9]*", "ab|abc", "a*", "x(yz)*"};
+  Regen::StringPiece text("ab12 abc xyzyz a x\nb3");
+  const std::size_t PATNUM = sizeof(patterns) / sizeof(const char *);
+  for (int captured = 0; captured <= 1; captured++) {
+    Regen::Options opt;
+    opt.partial_match(true);
+    opt.captured_match(captured);
+    for (std::size_t i = 0; i < PATNUM; i++) {
+      Regen r(patterns[i], opt);
+      r.Compile();
+      std::vector<Regen::StringPiece> matches;
+      r.FindAll(text, &matches);
+      /* same as restarting Match (with CapturedMatch) after each match. */
+      opt.captured_match(true);
+      Regen rc(patterns[i], opt);
+      rc.Compile();
+      opt.captured_match(captured);
+      Regen::StringPiece rest(text), result;
+      std::size_t n = 0;
+      while (rc.Match(rest, &result)) {
+        ASSERT_LT(n, matches.size());
+        ASSERT_EQ(matches[n].begin(), result.begin());
+        ASSERT_EQ(matches[n].end(), result.end());
+        n++;
+        if (result.end() == rest.end()) break;
+        rest.set_begin(result.empty() ? result.end() + 1 : result.end());
+      }
+      ASSERT_EQ(matches.size(), n);
+    }
+  }
+  Regen::Options opt;
+  opt.partial_match(true);
+  Regen r("[a-z]+[0-9]*", opt);
+  r.Compile();
+  std::vector<Regen::StringPiece> matches;
+  ASSERT_EQ(r.FindAll(text, &matches), 6u);
+  ASSERT_EQ(matches[0].as_string(), "ab12");
+  ASSERT_EQ(matches[5].as_string(), "b3");
+}
+
+TEST(CaptureTest, Groups) {
+  struct {
+    const char *pattern, *text;
+    const char *groups[4]; // NULL: not participated
+  } cases[] = {
+    {"([a-z]+)@([a-z]+)\\.com", "mail: foo@example.com.", {"foo@example.com", "foo", "example", NULL}},
+    {"(a*)(a*)", "aaa", {"aaa", "aaa", "", NULL}},
+    {"(a|ab)(c|bcd)(d*)", "abcd", {"abcd", "a", "bcd", ""}},
+    {"(ab)*c", "xababc", {"ababc", "ab", NULL, NULL}},
+    {"x(y)?z", "xz", {"xz", NULL, NULL, NULL}},
+    {"((a)|b)+", "ab", {"ab", "b", "a", NULL}},
+    {"(a+?)(a*)", "aaa", {"aaa", "a", "aa", NULL}},
+  };
+  Regen::Options opt;
+  opt.partial_match(true);
+  for (std::size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    Regen r(cases[i].pattern, opt);
+    r.Compile();
+    std::vector<Regen::StringPiece> groups;
+    ASSERT_TRUE(r.MatchGroups(cases[i].text, &groups)) << cases[i].pattern;
+    for (std::size_t j = 0; j < groups.size(); j++) {
+      if (cases[i].groups[j] == NULL) {
+        ASSERT_EQ(groups[j].begin(), (const char*)NULL) << cases[i].pattern << " " << j;
+      } else {
+        ASSERT_EQ(groups[j].as_string(), cases[i].groups[j]) << cases[i].pattern << " " << j;
+      }
+    }
+  }
+  /* a group under a counted repetition reports its last iteration. */
+  struct {
+    const char *pattern, *text;
+    int spans[4]; // begin and end of groups 1 and 2 (-1: not participated)
+  } repeated[] = {
+    {"(a){2}", "aa", {1, 2, -1, -1}},
+    {"(a|b){3}", "abb", {2, 3, -1, -1}},
+    {"(a|b){1,3}c", "abc", {1, 2, -1, -1}},
+    {"x(a|b){2,4}", "xabab", {4, 5, -1, -1}},
+    {"x(ab){2,}", "xababab", {5, 7, -1, -1}},
+    {"x(y)?(z){0,2}", "xzz", {-1, -1, 2, 3}},
+    {"(.([ab])[bc]){2}", "abxacaac", {5, 8, 6, 7}},
+  };
+  for (std::size_t i = 0; i < sizeof(repeated) / sizeof(repeated[0]); i++) {
+    Regen r(repeated[i].pattern, opt);
+    r.Compile();
+    std::vector<Regen::StringPiece> groups;
+    const Regen::StringPiece text(repeated[i].text);
+    ASSERT_TRUE(r.MatchGroups(text, &groups)) << repeated[i].pattern;
+    for (std::size_t j = 1; j < groups.size(); j++) {
+      const int *span = &repeated[i].spans[2 * (j - 1)];
+      if (span[0] < 0) {
+        ASSERT_EQ(groups[j].begin(), (const char*)NULL) << repeated[i].pattern << " " << j;
+      } else {
+        ASSERT_EQ(groups[j].begin() - text.begin(), span[0]) << repeated[i].pattern << " " << j;
+        ASSERT_EQ(groups[j].end() - text.begin(), span[1]) << repeated[i].pattern << " " << j;
+      }
+    }
+  }
+  /* anchors are not followed by tags, only the whole match is reported. */
+  Regen r("^(a+)$", opt);
+  r.Compile();
+  std::vector<Regen::StringPiece> groups;
+  ASSERT_TRUE(r.MatchGroups("aa", &groups));
+  ASSERT_EQ(groups.size(), 1u);
+}
+
+TEST(GlobalReplaceTest, Rewrite) {
+  Regen::Options opt;
+  opt.partial_match(true);
+  struct {
+    const char *pattern, *text, *rewrite, *expected;
+    std::size_t count;
+  } cases[] = {
+    {"[0-9]{3}-[0-9]{4}", "call 555-1234 or 555-9876.", "<\\0>", "call <555-1234> or <555-9876>.", 2},
+    {"([a-z]+)@([a-z]+)\\.com", "to: foo@example.com, bar@test.com", "\\1 at \\2 (\\\\)", "to: foo at example (\\), bar at test (\\)", 2},
+    {"x*", "abc", "-", "-a-b-c-", 4},
+    {"secret", "no match here", "***", "no match here", 0},
+  };
+  for (std::size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    Regen r(cases[i].pattern, opt);
+    r.Compile();
+    std::string out;
+    ASSERT_EQ(r.GlobalReplace(cases[i].text, cases[i].rewrite, &out), cases[i].count);
+    ASSERT_EQ(out, cases[i].expected);
+  }
+  /* a bad rewrite is reported, the output is left as is. */
+  Regen r("([a-z]+)@([a-z]+)", opt);
+  r.Compile();
+  const char *invalid[] = { "\\3", "\\", "\\x" };
+  for (std::size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+    std::string out("kept"), error;
+    ASSERT_FALSE(r.CheckRewrite(invalid[i], &error));
+    ASSERT_FALSE(error.empty());
+    ASSERT_EQ(r.GlobalReplace("foo@bar", invalid[i], &out), std::string::npos);
+    ASSERT_EQ(out, "kept");
+  }
+  ASSERT_TRUE(r.CheckRewrite("\\2\\1\\\\"));
+}
+
+TEST(MatcherTest, SharedProgram) {
+  const std::size_t TESTNUM = sizeof(test) / sizeof(testcase);
+  Regen::Options opt;
+  opt.partial_match(true);
+  Regen compiled("(a|bc)+d", opt), onthefly("(a|bc)+d", opt);
+  compiled.Compile(Regen::Options::O3);
+  regen::Matcher shared(compiled), own(onthefly), own2(onthefly);
+  ASSERT_TRUE(shared.shared());
+  ASSERT_FALSE(own.shared());
+  /* one Program for all the Matchers of a Regen. */
+  ASSERT_EQ(&own.program(), &own2.program());
+  for (std::size_t i = 0; i < TESTNUM; i++) {
+    Regen::StringPiece expected, result1, result2;
+    bool match = compiled.Match(test[i].text, &expected);
+    ASSERT_EQ(shared.Match(test[i].text, &result1), match);
+    ASSERT_EQ(own.Match(test[i].text, &result2), match);
+    ASSERT_EQ(result1.end(), expected.end());
+    ASSERT_EQ(result2.end(), expected.end());
+  }
+  /* On-The-Fly states grew in the Matcher, the Program is untouched. */
+  ASSERT_TRUE(own.program().regex()->dfa().empty());
+  /* Matchers of a pattern share one compiled program in the cache. */
+  regen::Matcher m1("(a|bc)+d", opt), m2("(a|bc)+d", opt);
+  ASSERT_EQ(&m1.program(), &m2.program());
+  /* a Matcher keeps the Program after its Regen is deleted. */
+  regen::Matcher *orphan;
+  {
+    Regen r("x(a|bc)*y", opt);
+    r.Compile();
+    orphan = new regen::Matcher(r);
+  }
+  std::vector<Regen::StringPiece> matches;
+  ASSERT_EQ(orphan->FindAll("xy xabcay xb", &matches), 2u);
+  ASSERT_EQ(matches[1].as_string(), "xabcay");
+  delete orphan;
+  /* workers of MatchBatch match an On-The-Fly DFA with private copies. */
+  std::vector<Regen::StringPiece> records;
+  for (std::size_t i = 0; i < 2000; i++) {
+    records.push_back(Regen::StringPiece(test[i % TESTNUM].text));
+  }
+  std::vector<unsigned char> bitmap((records.size() + 7) / 8);
+  std::size_t count = onthefly.MatchBatch(&records[0], records.size(), &bitmap[0], NULL, 4);
+  std::size_t expected = 0;
+  for (std::size_t i = 0; i < records.size(); i++) {
+    bool match = compiled.Match(records[i]);
+    if (match) expected++;
+    ASSERT_EQ(match, (bitmap[i / 8] & (1 << (i % 8))) != 0);
+  }
+  ASSERT_EQ(count, expected);
+}
+
+TEST(RepetitionTest, CompactNode) {
+  Regen::Options opt;
+  regen::Regex r("[0-9a-f]{1,40}", opt);
+  regen::Expr *root = r.expr_info().orig_root;
+  ASSERT_EQ(root->type(), regen::Expr::kRepetition);
+  ASSERT_EQ(static_cast<regen::Repetition*>(root)->min(), 1);
+  ASSERT_EQ(static_cast<regen::Repetition*>(root)->max(), 40);
+  ASSERT_EQ(r.max_length(), 40u);
+  ASSERT_EQ(r.min_length(), 1u);
+  /* same language as the expanded form. */
+  const struct {
+    const char *regex;
+    const char *text;
+    bool expected;
+  } cases[] = {
+    {"(ab){2,3}", "abab", true},
+    {"(ab){2,3}", "ababab", true},
+    {"(ab){2,3}", "ab", false},
+    {"(ab){2,3}", "abababab", false},
+    {"a{3}", "aaa", true},
+    {"a{3}", "aa", false},
+    {"a{2,}b", "aaaaab", true},
+    {"a{2,}b", "ab", false},
+    {"x{0,2}y", "y", true},
+    {"x{0,2}y", "xxxy", false},
+    {"(a|b){0}c", "c", true},
+  };
+  for (std::size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    Regen re(cases[i].regex, opt);
+    ASSERT_EQ(re.Match(cases[i].text), cases[i].expected);
+    re.Compile(Regen::Options::O1);
+    ASSERT_EQ(re.Match(cases[i].text), cases[i].expected);
+  }
+}
+
+TEST(DFATest, ConstructAfterOnTheFly) {
+  /* states grown by On-The-Fly matching are dropped by Construct, which
+   * numbers the states from scratch. */
+  regen::Regex fresh("(a|bc)+d", Regen::Options()), used("(a|bc)+d", Regen::Options());
+  ASSERT_TRUE(fresh.Compile(Regen::Options::O1));
+  ASSERT_TRUE(used.Match("bcad"));
+  ASSERT_FALSE(used.Match("bcbd"));
+  ASSERT_TRUE(used.Compile(Regen::Options::O1));
+  ASSERT_EQ(used.dfa().size(), fresh.dfa().size());
+  ASSERT_TRUE(used.Match("abcd"));
+  ASSERT_FALSE(used.Match("abd"));
+}
+
+TEST(CountingMatcherTest, SameAsDFA) {
+  const char *regexes[] = {".*b.{8}b", "(a|b)*a(a|b){12}", "x[0-9]{2,5}y", "a.{3,}b", "(ab|c){2}d{0,3}"};
+  const char *alphabet = "ab0xyc";
+  srand(1);
+  for (std::size_t i = 0; i < sizeof(regexes) / sizeof(regexes[0]); i++) {
+    for (int partial = 0; partial <= 1; partial++) {
+      Regen::Options opt;
+      opt.partial_match(partial != 0);
+      regen::Regex r(regexes[i], opt);
+      regen::CountingMatcher *counting = regen::CountingMatcher::Plan(r.expr_info().orig_root, opt);
+      ASSERT_TRUE(counting != NULL);
+      for (std::size_t j = 0; j < 300; j++) {
+        std::string text;
+        for (std::size_t k = rand() % 24; k > 0; k--) text += alphabet[rand() % 6];
+        Regen::StringPiece expected(text), result(text);
+        ASSERT_EQ(counting->Match(text, &result), r.Match(text, &expected));
+        ASSERT_EQ(result.end(), expected.end());
+      }
+      delete counting;
+    }
+  }
+  /* the DFA of (a|b)*a(a|b){12} exceeds the limit, the counters take over. */
+  Regen re("(a|b)*a(a|b){12}");
+  ASSERT_FALSE(re.Compile(Regen::Options::O1));
+  ASSERT_TRUE(re.Match("bbabbbbbbbbbbbb"));
+  ASSERT_FALSE(re.Match("bbabbbbbbbbbbb"));
+}
+
+TEST(PositionSetTest, LargeAlternation) {
+  /* first sets of the nested unions share their operands. */
+  std::string pattern;
+  char buf[16];
+  for (int i = 0; i < 20000; i++) {
+    sprintf(buf, "%sx%d", i == 0 ? "(" : "|", i);
+    pattern += buf;
+  }
+  pattern += ")+";
+  regen::Regex re(pattern);
+  ASSERT_TRUE(re.Match("x0x19999x123"));
+  ASSERT_FALSE(re.Match("x20000"));
+  ASSERT_FALSE(re.Match("x12y"));
+}
+
+TEST(ParserTest, DeepPattern) {
+  /* neither the parser nor the passes over the tree recurse on its depth.
+   * (texts are short: the DFA is built on the fly) */
+  std::string concat;
+  for (int i = 0; i < 200000; i++) concat += i % 3 == 0 ? "[ab]" : "c";
+  regen::Regex re("x|" + concat);
+  ASSERT_TRUE(re.Match("x"));
+  ASSERT_FALSE(re.Match("acca"));
+  ASSERT_FALSE(re.Match("acx"));
+  regen::Regex re1("x|(" + concat + ")+?"); // cloned
+  ASSERT_TRUE(re1.Match("x"));
+  ASSERT_FALSE(re1.Match("bcx"));
+
+  std::string nested = std::string(100000, '(') + "a";
+  for (int i = 0; i < 100000; i++) nested += i % 2 ? ")b" : ")[bc]";
+  regen::Regex re2("x|" + nested);
+  ASSERT_TRUE(re2.Match("x"));
+  ASSERT_FALSE(re2.Match("ab"));
+  ASSERT_FALSE(re2.Match("acd"));
+}
+
+TEST(SimplifierTest, SameAsUnsimplified) {
+  const char *regexes[] = {"foo|foobar|fox", "ab|cb|b", "a|b|[cd]|x*", "(ab|ac)+d|(a+)?b", "a(b|ab)?c", ".*a.{4}|.*b.{4}"};
+  const char *alphabet = "abcdfoxr";
+  srand(1);
+  for (std::size_t i = 0; i < sizeof(regexes) / sizeof(regexes[0]); i++) {
+    Regen::Options opt;
+    opt.partial_match(true);
+    Regen::Options noopt(opt);
+    noopt.simplify(false);
+    regen::Regex r(regexes[i], opt), o(regexes[i], noopt);
+    ASSERT_LE(r.state_exprs().size(), o.state_exprs().size()) << regexes[i];
+    for (std::size_t j = 0; j < 300; j++) {
+      std::string text;
+      for (std::size_t k = rand() % 12; k > 0; k--) text += alphabet[rand() % 8];
+      Regen::StringPiece expected(text), result(text);
+      ASSERT_EQ(r.Match(text, &result), o.Match(text, &expected)) << regexes[i] << " " << text;
+      ASSERT_EQ(result.end(), expected.end());
+    }
+  }
+  /* the factored alternatives are still a set of literals, groups stay in place. */
+  Regen re("foo|foobar|fox");
+  ASSERT_TRUE(re.Match("foobar"));
+  ASSERT_FALSE(re.Match("fobar"));
+  Regen::Options opt;
+  opt.partial_match(true);
+  Regen groups("(ab|ac)(c|d)", opt);
+  std::vector<Regen::StringPiece> g;
+  ASSERT_TRUE(groups.MatchGroups("xacd", &g));
+  ASSERT_EQ(g[1].as_string(), "ac");
+  ASSERT_EQ(g[2].as_string(), "d");
+  regen::Regex dfa(".*a.{4}|.*b.{4}"), nodfa(".*a.{4}|.*b.{4}", Regen::Options::NoSimplify);
+  dfa.Compile(Regen::Options::O0);
+  nodfa.Compile(Regen::Options::O0);
+  ASSERT_LT(dfa.dfa().size(), nodfa.dfa().size());
+}
+
+TEST(ShuffleTest, Product) {
+  Regen shuffle("ab||cd", Regen::Options::Extended);
+  const char *interleavings[] = {"abcd", "acbd", "acdb", "cabd", "cadb", "cdab"};
+  for (std::size_t i = 0; i < sizeof(interleavings) / sizeof(interleavings[0]); i++) {
+    ASSERT_TRUE(shuffle.Match(interleavings[i])) << interleavings[i];
+  }
+  ASSERT_FALSE(shuffle.Match("abdc"));
+  ASSERT_FALSE(shuffle.Match("acd"));
+  /* interleaved byte by byte, not loop by loop. */
+  Regen loops("(ab)*||c", Regen::Options::Extended);
+  ASSERT_TRUE(loops.Match("acbab"));
+  ASSERT_TRUE(loops.Match("c"));
+  ASSERT_FALSE(loops.Match("acab"));
+
+  Regen permutation("#(abc)", Regen::Options::Extended);
+  ASSERT_TRUE(permutation.Match("cab"));
+  ASSERT_TRUE(permutation.Match("bca"));
+  ASSERT_FALSE(permutation.Match("cba "));
+  ASSERT_FALSE(permutation.Match("aab"));
+  Regen nullable("#(a?bc*)", Regen::Options::Extended);
+  ASSERT_TRUE(nullable.Match("b"));
+  ASSERT_TRUE(nullable.Match("ccba"));
+  ASSERT_FALSE(nullable.Match("aba"));
+  /* more than 8 items, with polynomial positions. */
+  regen::Regex many("#(abcdefghijkl)", Regen::Options::Extended);
+  ASSERT_TRUE(many.Match("lkjihgfedcba"));
+  ASSERT_FALSE(many.Match("lkjihgfedcbb"));
+  regen::Regex product(std::string(64, 'a') + "||" + std::string(64, 'b'), Regen::Options::Extended);
+  ASSERT_LE(product.state_exprs().size(), 2u * 65 * 65);
+  ASSERT_TRUE(product.Match(std::string(32, 'b') + std::string(64, 'a') + std::string(32, 'b')));
+}
+
+TEST(ProductDFATest, Operators) {
+  Regen::Options::ParseFlag extended = Regen::Options::Extended;
+  Regen both(".*ab.*&.*cd.*", extended);
+  ASSERT_TRUE(both.Match("xcdab"));
+  ASSERT_FALSE(both.Match("abc"));
+  Regen no_double("[a-z]*&!(.*(aa|bb).*)", extended);
+  ASSERT_TRUE(no_double.Match("abab"));
+  ASSERT_FALSE(no_double.Match("abba"));
+  Regen odd("a*&&(aa)*", extended);
+  ASSERT_TRUE(odd.Match("aaa"));
+  ASSERT_FALSE(odd.Match("aa"));
+  ASSERT_FALSE(odd.Match(""));
+  Regen nested("x((a+&[ab]{2,3})&&.a)*y", extended);
+  ASSERT_TRUE(nested.Match("xaaaaaay"));
+  ASSERT_TRUE(nested.Match("xbaaaay"));
+  ASSERT_FALSE(nested.Match("xaay"));
+
+  /* no Operator in the subsets of the DFA, which is smaller. */
+  regen::Regex product(".*[0-9]{3}.*&&.*x.*", extended);
+  regen::Regex operators(".*[0-9]{3}.*&&.*x.*", (Regen::Options::ParseFlag)(extended | Regen::Options::NoProductDFA));
+  for (std::size_t i = 0; i < product.state_exprs().size(); i++) {
+    ASSERT_NE(product.state_exprs()[i]->type(), regen::Expr::kOperator);
+  }
+  product.Compile(Regen::Options::O0);
+  operators.Compile(Regen::Options::O0);
+  ASSERT_LT(product.dfa().size(), operators.dfa().size());
+  ASSERT_TRUE(product.Match("a123"));
+  ASSERT_TRUE(product.Match("xy"));
+  ASSERT_FALSE(product.Match("x123"));
+  regen::Regex empty(".*a.{4}&.*b.{4}", extended);
+  ASSERT_TRUE(empty.Compile(Regen::Options::O0));
+  ASSERT_FALSE(empty.Match("ab1234"));
+}
+
+TEST(ExprPoolTest, Share) {
+  regen::ExprPool p;
+  regen::Expr *a = p.share<regen::Literal>('a'), *b = p.share<regen::Literal>('b');
+  ASSERT_EQ(a, p.share<regen::Literal>('a'));
+  ASSERT_NE(a, b);
+  regen::Expr *ab = p.share<regen::Concat>(a, b);
+  ASSERT_EQ(ab, p.share<regen::Concat>(a, b));
+  ASSERT_NE(ab, p.share<regen::Concat>(b, a));
+  ASSERT_EQ(p.share<regen::Star>(ab), p.share<regen::Star>(ab));
+  ASSERT_NE(p.share<regen::Star>(ab), p.share<regen::Star>(ab, true));
+  ASSERT_NE(p.share<regen::EOP>(), p.share<regen::EOP>());
+
+  /* the regex of a DFA is a DAG, which still denotes the language of the DFA. */
+  regen::Regex re("(a|b)*a(a|b){3}");
+  re.Compile(Regen::Options::O0);
+  regen::ExprInfo info;
+  regen::ExprPool q;
+  regen::Regex::CreateRegexFromDFA(re.dfa(), &info, &q);
+  regen::Regex dag(std::vector<regen::Expr*>(1, static_cast<regen::BinaryExpr*>(info.expr_root)->lhs()));
+  srand(1);
+  for (std::size_t i = 0; i < 200; i++) {
+    std::string text;
+    for (std::size_t k = rand() % 10; k > 0; k--) text += "ab"[rand() % 2];
+    ASSERT_EQ(re.Match(text), dag.Match(text)) << text;
+  }
+}
+
+TEST(NFATest, RangeEdges) {
+  /* a[b-y]*z, with overlapping ranges from state 1. */
+  regen::NFA nfa;
+  for (std::size_t i = 0; i < 3; i++) nfa.get_new_state();
+  nfa.start_states().insert(0);
+  nfa[2].accept = true;
+  std::set<regen::NFA::state_t> one, two;
+  one.insert(1);
+  two.insert(2);
+  nfa.AddTransition(0, 'a', 'a', one);
+  nfa.AddTransition(1, 'b', 'y', one);
+  nfa.AddTransition(1, 'm', 'z', two);
+  ASSERT_EQ(3u, nfa.edge_end(1) - nfa.edge_begin(1));
+  ASSERT_EQ(2u, nfa.Next(1, 'q').size());
+  regen::DFA dfa(nfa);
+  ASSERT_TRUE(dfa.IsAcceptState(dfa.Run("abcz")));
+  ASSERT_TRUE(dfa.IsAcceptState(dfa.Run("am")));
+  ASSERT_FALSE(dfa.IsAcceptState(dfa.Run("abc")));
+  ASSERT_FALSE(dfa.IsAcceptState(dfa.Run("bz")));
+
+  /* 10^5 states moving together, with one target set for all of them. */
+  const regen::NFA::state_t n = 100000;
+  regen::NFA wide;
+  std::set<regen::NFA::state_t> all, start;
+  for (regen::NFA::state_t i = 0; i < n; i++) {
+    wide.get_new_state();
+    if (i > 0) all.insert(i);
+  }
+  start.insert(0);
+  wide.start_states() = start;
+  wide[n - 1].accept = true;
+  wide.AddTransition(0, 'a', 'z', all);
+  for (regen::NFA::state_t i = 1; i < n; i++) wide.AddTransition(i, 'b', 'b', start);
+  regen::DFA big(wide);
+  ASSERT_EQ(2u, big.size());
+  ASSERT_TRUE(big.IsAcceptState(big.Run("aba")));
+  ASSERT_FALSE(big.IsAcceptState(big.Run("ab")));
+}
+
+TEST(BitParallelMatcherTest, SameAsDFA) {
+  const struct {
+    const char *regex;
+    std::size_t width;
+    std::size_t text_length;
+    std::size_t text_num;
+  } cases[] = {
+    {"(ab|c)*a.c|x[0-9]{2,5}y", 64, 24, 300},
+    {"(a|b)*a(a|b){12}", 64, 24, 300},
+    {"(a|b)*a(a|b){100}", 128, 140, 40},
+    {"(a|b)*a(a|b){200}", 256, 260, 20},
+  };
+  const char *alphabet = "ab0xyc";
+  srand(1);
+  for (std::size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    for (int partial = 0; partial <= 1; partial++) {
+      Regen::Options opt;
+      opt.partial_match(partial != 0);
+      regen::Regex r(cases[i].regex, opt);
+      regen::BitParallelMatcher *bitparallel = regen::BitParallelMatcher::Plan(r, opt);
+      ASSERT_TRUE(bitparallel != NULL);
+      ASSERT_EQ(cases[i].width, bitparallel->width());
+      for (std::size_t j = 0; j < cases[i].text_num; j++) {
+        std::string text;
+        for (std::size_t k = rand() % cases[i].text_length; k > 0; k--) text += alphabet[rand() % (i == 0 ? 6 : 2)];
+        Regen::StringPiece expected(text), result(text);
+        ASSERT_EQ(bitparallel->Match(text, &result), r.Match(text, &expected)) << cases[i].regex << " " << text;
+        ASSERT_EQ(result.end(), expected.end());
+        ASSERT_EQ(bitparallel->Match(text), r.Match(text));
+      }
+      delete bitparallel;
+    }
+  }
+  /* anchors are left to the DFA. */
+  regen::Regex anchored("^ab$", Regen::Options());
+  ASSERT_TRUE(regen::BitParallelMatcher::Plan(anchored, Regen::Options()) == NULL);
+  /* the DFA of (a|b)*a(a|b){40} exceeds the limit, the bits take over. */
+  Regen re("(a|b)*a(a|b){40}");
+  ASSERT_FALSE(re.Compile(Regen::Options::O1));
+  ASSERT_TRUE(re.Match("ba" + std::string(40, 'b')));
+  ASSERT_FALSE(re.Match("ba" + std::string(41, 'b')));
+  /* the 512 states of (a|b)*a(a|b){8} are within the limit, but the bits
+   * are preferred beyond a smaller budget: the DFA is not built. */
+  regen::Regex budget("(a|b)*a(a|b){8}", Regen::Options());
+  ASSERT_FALSE(budget.Compile(Regen::Options::O0, 256));
+  ASSERT_TRUE(budget.Compile(Regen::Options::O0));
+  Regen early("(a|b)*a(a|b){8}");
+  ASSERT_FALSE(early.Compile(Regen::Options::O0));
+  ASSERT_TRUE(early.Match("ba" + std::string(8, 'b')));
+  ASSERT_FALSE(early.Match("ba" + std::string(9, 'b')));
+}
@@ -36,6 +36,9 @@ typedef unsigned char uint8_t;
 #include <fcntl.h>
 #include <unistd.h>
 #endif
+#ifdef REGEN_ENABLE_PARALLEL
+#include <boost/thread/once.hpp>
+#endif
 
 #ifdef _LP64
 #define __PRIS_PREFIX "z"
@@ -143,6 +146,32 @@ struct mmap_t{
 
 } // namespace Util
 
+/* calls a function on the first Call only, also when threads race for it.
+ * after that, Call checks the flag without any lock (boost::call_once). */
+class Once {
+public:
+  /* a zero flag is BOOST_ONCE_INIT. */
+  Once(): flag_() {}
+  template<typename Function> void Call(Function f)
+  {
+#ifdef REGEN_ENABLE_PARALLEL
+    boost::call_once(flag_, f);
+#else
+    if (!flag_) {
+      flag_ = true;
+      f();
+    }
+#endif
+  }
+private:
+#ifdef REGEN_ENABLE_PARALLEL
+  boost::once_flag flag_;
+#else
+  bool flag_;
+#endif
+  DISALLOW_COPY_AND_ASSIGN(Once);
+};
+
 } // namespace regen
 
 #endif // REGEN_UTIL_H_